@@ -2,9 +2,9 @@
 
 (define filename "pokegra-w.narc")
 
-(define (try-load-file narc i)
+(define (try-file-magic narc i)
   (catch 'narc-error
-         (lambda () (narc-load-file narc i))
+         (lambda () (narc-file-magic narc i))
          (lambda (key . args) #f)))
 
 (let* ((narc (load-narc filename))
@@ -12,9 +12,7 @@
   (do ((i 0 (1+ i)))
       ((>= i count))
     (format #t "~3d ~a~%" i
-      (let ((chunk (try-load-file narc i)))
-        (if chunk
-            (get-magic chunk)
-            (if (zero? (narc-get-file-size narc i))
-              "(empty)"
-              "(error)"))))))
+      (if (zero? (narc-get-file-size narc i))
+        "(empty)"
+        (or (try-file-magic narc i)
+            "(error)")))))
@@ -0,0 +1,49 @@
+; Rip every animated pokemon sprite from B/W in a single run.
+; Usage: ripscript rip-bw-animated-all.scm [last-pokemon]
+; last-pokemon is the number of the last pokemon: 711 for b/w (the default), 750 for b2/w2
+
+(define args (command-line))
+
+(define last-pokemon
+  (if (> (length args) 1)
+      (string->number (list-ref args 1))
+      711))
+
+(define filename "Resources/Narcs/pokegra-w.narc")
+(define outdir "./Out/animtedSprites")
+
+(define ENOENT 2)
+(define EEXIST 17)
+
+(define (mkdir-if-not-exist dir)
+  (catch 'system-error
+         (lambda () (mkdir dir) #t)
+         (lambda (key subr msg args rest)
+           (define code (car rest))
+           (if (eq? code EEXIST)
+               #f
+               (throw key subr msg args rest)))))
+
+; (nclr ncgr part subdir)
+; 18 = normal, 19 = shiny; 2 = male, 3 = female; 0 = front, 9 = back.
+; pokemon without female sprites have no female graphics, and are skipped
+(define variants
+  '((18 2 0 "")
+    (18 3 0 "/female")
+    (19 2 0 "/shiny")
+    (19 3 0 "/shiny/female")
+    (18 2 9 "/back")
+    (18 3 9 "/back/female")
+    (19 2 9 "/back/shiny")
+    (19 3 9 "/back/shiny/female")))
+
+(mkdir-if-not-exist outdir)
+(for-each (lambda (v)
+            (if (not (string-null? (list-ref v 3)))
+                (mkdir-if-not-exist (string-append outdir (list-ref v 3)))))
+          ; parents first
+          (sort variants (lambda (a b) (< (string-length (list-ref a 3))
+                                          (string-length (list-ref b 3))))))
+
+(let ((narc (load-narc filename)))
+  (rip-animated-range narc 0 last-pokemon variants outdir '(192 128) '(96 112)))
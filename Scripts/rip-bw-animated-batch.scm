@@ -31,14 +31,6 @@
 (mkdir-if-not-exist (string-append outdir "/back/shiny"))
 (mkdir-if-not-exist (string-append outdir "/back/shiny/female"))
 
-(define (save-animation filename size nclr period callback)
-  (save-gif filename size nclr 10
-            (lambda (frame)
-              (let ((tick (floor (* frame 6/10))))
-                (if (< tick period)
-                    (callback tick)
-                    #f)))))
-
 (let* ((n (string->number(list-ref args 1))) ; n = pokemon #
        (base (* n 20))
        (narc (load-narc filename))
@@ -49,13 +41,7 @@
        (nmcr (narc-load-file narc (+ base (+ 6 (string->number(list-ref args 4)))) 'NMCR))
        (nmar (narc-load-file narc (+ base (+ 7 (string->number(list-ref args 4)))) 'NMAR))
        (cell 0)
-       (period (nmar-period nmar cell))
        (size '(192 128)))
-  (save-animation (format #f "~a/~a.gif" (string-append outdir (list-ref args 5)) n)
-                  size nclr period
-                  (lambda (tick)
-                    (let ((image (make-image size)))
-                      (nmar-draw nmar cell tick
-                                 nmcr nanr ncer ncgr
-                                 image '(96 112))
-                      image))))
+  (nmar-save-gif (format #f "~a/~a.gif" (string-append outdir (list-ref args 5)) n)
+                 nmar cell nmcr nanr ncer ncgr nclr
+                 size '(96 112)))
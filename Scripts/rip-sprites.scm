@@ -49,32 +49,36 @@
 (define (mkdirs dirs)
   (for-each mkdir-all dirs))
   
-(define (narc-maybe-load-file narc i . args)
-  (if (= 0 (narc-get-file-size narc i))
-      #f
-      (apply narc-load-file narc i args)))
-
+; the pixels and palettes come through the disk cache (see RIP_CACHE_DIR),
+; so a second run doesn't have to decode anything
 (define (rip-sprites narc)
+  ; a pokemon's two palettes are shared by all of its sprites, so load them
+  ; once, each onto an image of its own, and copy them from there
+  (define (load-palette p)
+    (let ((palette (make-image)))
+      (image-set-palette-from-narc palette narc p)
+      palette))
+
   (define (rip-pokemon n)
     (let* ((base (* n 6))
-           (sprites (map (lambda (i) (narc-maybe-load-file narc (+ base i) 'NCGR))
-                         (iota 4)))
-           (palettes (list (narc-load-file narc (+ base 4) 'NCLR)
-                           (narc-load-file narc (+ base 5) 'NCLR)))
-           (image (make-image)))
-
-      (define (rip-sprite ncgr dirs)
-        (if ncgr (begin
-          (ncgr-decrypt-pt ncgr)
-          (image-set-pixels-from-ncgr image ncgr)
-          (for-each (lambda (nclr d)
-                      (define outfile (format #f "~a/~a/~a.png" outdir d n))
-                      (image-set-palette-from-nclr image nclr)
-                      (image-save-png image outfile))
-                    palettes
-                    dirs))))
-
-      (for-each rip-sprite sprites dirs)))
+           (sprites (filter (lambda (i) (not (= 0 (narc-get-file-size narc i))))
+                            (map (lambda (i) (+ base i)) (iota 4)))))
+
+      (if (not (null? sprites))
+          (let ((palettes (map load-palette (list (+ base 4) (+ base 5))))
+                (image (make-image)))
+
+            (define (rip-sprite i dirs)
+              (image-set-pixels-from-narc image narc i 'pt)
+              (for-each (lambda (palette d)
+                          (define outfile (format #f "~a/~a/~a.png" outdir d n))
+                          (image-set-palette-from-image image palette)
+                          (image-save-png image outfile))
+                        palettes
+                        dirs))
+
+            (for-each (lambda (i) (rip-sprite i (list-ref dirs (- i base))))
+                      sprites)))))
 
   (let* ((count (narc-file-count narc))
          (n (floor (/ count 6))))
@@ -0,0 +1,98 @@
+/* unpack_bench - Time unpack_pixels against the loop it replaced
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS, malloc, free, size_t */
+#include <stdio.h> /* printf */
+#include <string.h> /* memcmp */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+
+#include "../src/common.h" /* u8, u32 */
+#include "../src/unpack.h" /* unpack_pixels */
+
+/* Big enough to swamp the call overhead, small enough to stay in cache,
+ * like the character data of a sprite */
+#define SRC_SIZE (16 * 1024)
+#define ROUNDS 20000
+
+/* The 4bpp loop from ncgr.c's unpack(), before it was vectorized */
+static void
+unpack4_old(u8 *dest, const u8 *src, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size / 2; i++) {
+		u8 byte = src[i];
+		dest[i*2]     = byte        & 0x0f;
+		dest[i*2 + 1] = (byte >> 4) & 0x0f;
+	}
+}
+
+static void
+unpack4_new(u8 *dest, const u8 *src, size_t size)
+{
+	unpack_pixels(dest, src, size, 4);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* somewhere for the output to go, so the work isn't optimized out */
+static volatile u8 sink;
+
+static double
+time_unpack(void (*unpack)(u8 *, const u8 *, size_t), u8 *dest, const u8 *src)
+{
+	double start = now();
+	for (int i = 0; i < ROUNDS; i++) {
+		unpack(dest, src, SRC_SIZE * 2);
+		sink = dest[i % (SRC_SIZE * 2)];
+	}
+	return now() - start;
+}
+
+int
+main(void)
+{
+	u8 *src = malloc(SRC_SIZE);
+	u8 *expected = malloc(SRC_SIZE * 2);
+	u8 *dest = malloc(SRC_SIZE * 2);
+	if (src == NULL || expected == NULL || dest == NULL) {
+		printf("out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	u32 seed = 12345;
+	for (size_t i = 0; i < SRC_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed >> 16;
+	}
+
+	unpack4_old(expected, src, SRC_SIZE * 2);
+	unpack4_new(dest, src, SRC_SIZE * 2);
+	if (memcmp(expected, dest, SRC_SIZE * 2) != 0) {
+		printf("unpack_bench: unpack_pixels disagrees with the old loop\n");
+		return EXIT_FAILURE;
+	}
+
+	double old_time = time_unpack(unpack4_old, dest, src);
+	double new_time = time_unpack(unpack4_new, dest, src);
+
+	double mb = (double)SRC_SIZE * ROUNDS / (1024 * 1024);
+	printf("unpack 4bpp, %d x %d bytes\n", ROUNDS, SRC_SIZE);
+	printf("  old loop       %8.1f MiB/s\n", mb / old_time);
+	printf("  unpack_pixels  %8.1f MiB/s  (%.2fx)\n", mb / new_time, old_time / new_time);
+
+	free(src);
+	free(expected);
+	free(dest);
+	return EXIT_SUCCESS;
+}
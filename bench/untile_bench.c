@@ -0,0 +1,144 @@
+/* untile_bench - Time unpack_tiles against unpacking and then untiling
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS, malloc, free, size_t */
+#include <stdio.h> /* printf */
+#include <string.h> /* memcmp, memcpy */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+
+#include "../src/common.h" /* struct dim, u8, u32 */
+#include "../src/unpack.h" /* unpack_tiles */
+
+#define ROUNDS 20000
+
+/* What ncgr.c did before unpack_tiles: unpack the tiles in the order
+ * they're stored, then move each one into place through a copy of the
+ * whole image. */
+static void
+untile_old(u8 *dest, const u8 *src, struct dim dim, int depth)
+{
+	const size_t size = dim.height * dim.width;
+	size_t i;
+
+	if (depth == 4) {
+		for (i = 0; i < size / 2; i++) {
+			u8 byte = src[i];
+			dest[i*2]     = byte        & 0x0f;
+			dest[i*2 + 1] = (byte >> 4) & 0x0f;
+		}
+	} else {
+		memcpy(dest, src, size);
+	}
+
+	// let's allocate a few kilobytes of data on the stack - yeah!
+	u8 tmp_px[dim.height][dim.width];
+
+	int x, y, tx, ty, cx, cy;
+	i = 0;
+	for (y = 0; y < dim.height / 8; y++) {
+	for (x = 0; x < dim.width / 8; x++) {
+		for (ty = 0; ty < 8; ty++) {
+		for (tx = 0; tx < 8; tx++) {
+			cy = y * 8 + ty;
+			cx = x * 8 + tx;
+			tmp_px[cy][cx] = dest[i];
+			i++;
+		}
+		}
+	}
+	}
+
+	memcpy(dest, tmp_px, size);
+}
+
+static void
+untile_new(u8 *dest, const u8 *src, struct dim dim, int depth)
+{
+	unpack_tiles(dest, src, dim, depth);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* somewhere for the output to go, so the work isn't optimized out */
+static volatile u8 sink;
+
+static double
+time_untile(void (*untile)(u8 *, const u8 *, struct dim, int),
+            u8 *dest, const u8 *src, struct dim dim, int depth)
+{
+	const int size = dim.height * dim.width;
+	double start = now();
+	for (int i = 0; i < ROUNDS; i++) {
+		untile(dest, src, dim, depth);
+		sink = dest[i % size];
+	}
+	return now() - start;
+}
+
+int
+main(void)
+{
+	/* a cell's largest obj, and a whole pokémon sprite sheet */
+	static const struct dim dims[] = {
+		{.height = 64, .width = 64},
+		{.height = 80, .width = 160},
+	};
+	static const int depths[] = {4, 8};
+
+	const size_t max_size = 80 * 160;
+	u8 *src = malloc(max_size);
+	u8 *expected = malloc(max_size);
+	u8 *dest = malloc(max_size);
+	if (src == NULL || expected == NULL || dest == NULL) {
+		printf("out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	u32 seed = 12345;
+	for (size_t i = 0; i < max_size; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed >> 16;
+	}
+
+	for (size_t d = 0; d < sizeof(dims)/sizeof(dims[0]); d++) {
+		for (size_t k = 0; k < sizeof(depths)/sizeof(depths[0]); k++) {
+			const struct dim dim = dims[d];
+			const int depth = depths[k];
+			const size_t size = dim.height * dim.width;
+
+			untile_old(expected, src, dim, depth);
+			untile_new(dest, src, dim, depth);
+			if (memcmp(expected, dest, size) != 0) {
+				printf("untile_bench: unpack_tiles disagrees with the old code (%dx%d, %dbpp)\n",
+				       dim.width, dim.height, depth);
+				return EXIT_FAILURE;
+			}
+
+			double old_time = time_untile(untile_old, dest, src, dim, depth);
+			double new_time = time_untile(untile_new, dest, src, dim, depth);
+
+			double mpx = (double)size * ROUNDS / 1e6;
+			printf("untile %dx%d at %dbpp, %d times\n",
+			       dim.width, dim.height, depth, ROUNDS);
+			printf("  unpack + untile  %8.1f Mpx/s\n", mpx / old_time);
+			printf("  unpack_tiles     %8.1f Mpx/s  (%.2fx)\n",
+			       mpx / new_time, old_time / new_time);
+		}
+	}
+
+	free(src);
+	free(expected);
+	free(dest);
+	return EXIT_SUCCESS;
+}
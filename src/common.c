@@ -9,7 +9,7 @@
 #include <stdlib.h>  /* size_t, stderr, malloc */
 #include <stdio.h> /* fprintf, vfprintf */
 #include <stdarg.h> /* va_list, va_end, va_start */
-#include <string.h> /* memset */
+#include <string.h> /* memcpy, memset */
 
 #include "common.h"
 
@@ -41,3 +41,29 @@ buffer_alloc(size_t size)
 
 /* There is no buffer_free() - just use free(). */
 
+/******************************************************************************/
+
+/* A quick 64-bit hash, for telling data apart - not for security. To hash
+ * data in pieces, pass each result as the seed for the next piece; the
+ * pieces have to be split up the same way each time. */
+u64
+hash_bytes(const void *data, size_t size, u64 seed)
+{
+	const u64 k = 0x9e3779b97f4a7c15ULL;
+	const u8 *p = data;
+	u64 h = seed ^ (size * k);
+
+	for (; size >= 8; p += 8, size -= 8) {
+		u64 w;
+		memcpy(&w, p, 8);
+		h = (h ^ w) * k;
+		h ^= h >> 29;
+	}
+	for (; size > 0; p++, size--) {
+		h = (h ^ *p) * k;
+		h ^= h >> 29;
+	}
+
+	h ^= h >> 32;
+	return h;
+}
@@ -10,7 +10,7 @@
 
 #include <stdlib.h> /* NULL, size_t, calloc, free, malloc */
 #include <stdio.h> /* fread */
-#include <stdint.h> /* int16_t, uint8_t, uint16_t, uint32_t */
+#include <stdint.h> /* int16_t, uint8_t, uint16_t, uint32_t, uint64_t */
 
 /* assert() is part of the exported API of common.h */
 #include <assert.h> /* assert */
@@ -39,6 +39,7 @@
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef int16_t s16;
 typedef int32_t s32;
@@ -93,6 +94,8 @@ extern void warn(const char *s, ...);
 
 extern struct buffer *buffer_alloc(size_t size);
 
+extern u64 hash_bytes(const void *data, size_t size, u64 seed);
+
 /* There is no buffer_free() - just use free(). */
 
 #endif /* COMMON_H */
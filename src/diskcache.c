@@ -0,0 +1,395 @@
+/* diskcache.c - Decoded files, cached on disk between runs
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <stdlib.h> /* NULL, getenv, malloc, mkstemp */
+#include <stdio.h> /* FILE, fclose, fdopen, fopen, fread, fwrite, remove, rename, snprintf */
+#include <string.h> /* memcpy, strlen */
+#include <errno.h> /* EEXIST, errno */
+
+#ifdef _WIN32
+# include <direct.h> /* _mkdir */
+# define mkdir(path,mode)  _mkdir(path)
+#else
+# include <sys/stat.h> /* mkdir */
+# include <unistd.h> /* close, unlink */
+#endif
+
+#include "common.h" /* OKAY, FAIL, ALLOC, CALLOC, FREAD, FREE, assert, struct buffer, struct dim, struct palette, struct rgba, buffer_alloc, hash_bytes, warn, u8, u32, u64 */
+#include "nitro.h" /* magic_t, nitro_free, nitro_get_magic */
+#include "narc.h" /* struct NARC, narc_get_hash, narc_load_file */
+#include "ncgr.h" /* struct NCGR, ncgr_decrypt_dp, ncgr_decrypt_pt, ncgr_get_dim, ncgr_get_pixels */
+#include "nclr.h" /* struct NCLR, nclr_get_palette */
+#include "diskcache.h"
+
+/* Each entry is a file of its own, named after the NARC's hash and the
+ * index of the file it came from. It's a header followed by the data,
+ * which is written out just the way it is kept in memory, so reading an
+ * entry back is a single read straight into the buffer. */
+
+#define ENTRY_MAGIC ((u32)'RIPC')
+#define ENTRY_VERSION 1
+
+#define KIND_PIXELS ((u32)'PIXL')
+#define KIND_PALETTE ((u32)'PLTT')
+
+/* anything bigger than this is surely garbage */
+#define MAX_ENTRY_SIZE (16 * 1024 * 1024)
+
+struct entry_header {
+	u32 magic;
+	u32 version;
+
+	u64 narc_hash;
+	u32 index;
+	u32 kind;
+	u32 variant;
+
+	// pixels: the dimensions. palettes: the count and bit depth.
+	u32 width;
+	u32 height;
+
+	u32 data_size;
+
+	// a hash of the header, with this set to 0, and the data
+	u64 checksum;
+};
+
+struct disk_cache {
+	char *dir;
+	u64 narc_hash;
+};
+
+/* Returns NULL if caching is off or the cache can't be used. */
+struct disk_cache *
+disk_cache_open(struct NARC *narc)
+{
+	assert(narc != NULL);
+
+	const char *dir = getenv("RIP_CACHE_DIR");
+	if (dir == NULL || *dir == '\0') {
+		return NULL;
+	}
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		warn("Unable to create cache directory %s", dir);
+		return NULL;
+	}
+
+	struct disk_cache *self;
+	if (ALLOC(self) == NULL) {
+		return NULL;
+	}
+	self->dir = malloc(strlen(dir) + 1);
+	if (self->dir == NULL) {
+		FREE(self);
+		return NULL;
+	}
+	memcpy(self->dir, dir, strlen(dir) + 1);
+
+	if (narc_get_hash(narc, &self->narc_hash)) {
+		disk_cache_close(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void
+disk_cache_close(struct disk_cache *self)
+{
+	if (self != NULL) {
+		FREE(self->dir);
+		free(self);
+	}
+}
+
+static int
+entry_path(struct disk_cache *self, int index, u32 kind, u32 variant,
+           char *path, size_t size)
+{
+	int n = snprintf(path, size, "%s/%016llx-%d-%s-%lu.bin", self->dir,
+	                 (unsigned long long)self->narc_hash, index,
+	                 kind == KIND_PIXELS ? "pixels" : "palette",
+	                 (unsigned long)variant);
+	if (n < 0 || (size_t)n >= size) {
+		return FAIL;
+	}
+	return OKAY;
+}
+
+static u64
+entry_checksum(struct entry_header header, const u8 *data)
+{
+	header.checksum = 0;
+	u64 h = hash_bytes(&header, sizeof header, 0);
+	return hash_bytes(data, header.data_size, h);
+}
+
+/* Read an entry. Entries which are missing, stale or damaged all look
+ * the same: a miss. */
+static struct buffer *
+read_entry(struct disk_cache *self, int index, u32 kind, u32 variant,
+           struct entry_header *header)
+{
+	char path[4096];
+	if (entry_path(self, index, kind, variant, path, sizeof path)) {
+		return NULL;
+	}
+
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	struct buffer *data = NULL;
+	if (FREAD(fp, header, 1) != 1 ||
+	    header->magic != ENTRY_MAGIC ||
+	    header->version != ENTRY_VERSION ||
+	    header->narc_hash != self->narc_hash ||
+	    header->index != (u32)index ||
+	    header->kind != kind ||
+	    header->variant != variant ||
+	    header->data_size > MAX_ENTRY_SIZE) {
+		goto miss;
+	}
+
+	data = buffer_alloc(header->data_size);
+	if (data == NULL ||
+	    fread(data->data, 1, data->size, fp) != data->size ||
+	    entry_checksum(*header, data->data) != header->checksum) {
+		goto miss;
+	}
+
+	fclose(fp);
+	return data;
+
+	miss:
+	FREE(data);
+	fclose(fp);
+	return NULL;
+}
+
+/* Write an entry to a temporary file and then move it into place, so that
+ * nobody ever sees half of one - not even another rip running at the
+ * same time. */
+static int
+write_entry(struct disk_cache *self, int index, u32 kind, u32 variant,
+            u32 width, u32 height, const u8 *data, size_t size)
+{
+	char path[4096];
+	char tmp_path[4096 + 8];
+	if (size > MAX_ENTRY_SIZE ||
+	    entry_path(self, index, kind, variant, path, sizeof path)) {
+		return FAIL;
+	}
+
+	struct entry_header header = {
+		.magic = ENTRY_MAGIC,
+		.version = ENTRY_VERSION,
+		.narc_hash = self->narc_hash,
+		.index = index,
+		.kind = kind,
+		.variant = variant,
+		.width = width,
+		.height = height,
+		.data_size = size,
+	};
+	header.checksum = entry_checksum(header, data);
+
+	snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", path);
+#ifndef _WIN32
+	int fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		return FAIL;
+	}
+	FILE *fp = fdopen(fd, "wb");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmp_path);
+		return FAIL;
+	}
+#else
+	FILE *fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		return FAIL;
+	}
+#endif
+
+	int status = OKAY;
+	if (fwrite(&header, sizeof header, 1, fp) != 1 ||
+	    fwrite(data, 1, size, fp) != size) {
+		status = FAIL;
+	}
+	if (fclose(fp)) {
+		status = FAIL;
+	}
+
+#ifdef _WIN32
+	// rename won't replace a file on windows
+	remove(path);
+#endif
+	if (status == OKAY && rename(tmp_path, path)) {
+		status = FAIL;
+	}
+	if (status != OKAY) {
+		remove(tmp_path);
+	}
+	return status;
+}
+
+struct buffer *
+disk_cache_get_pixels(struct disk_cache *self, int index, u32 variant, struct dim *dim)
+{
+	assert(dim != NULL);
+
+	if (self == NULL) {
+		return NULL;
+	}
+
+	struct entry_header header;
+	struct buffer *pixels = read_entry(self, index, KIND_PIXELS, variant, &header);
+	if (pixels == NULL) {
+		return NULL;
+	}
+	if ((size_t)header.width * header.height != pixels->size) {
+		FREE(pixels);
+		return NULL;
+	}
+
+	dim->width = header.width;
+	dim->height = header.height;
+	return pixels;
+}
+
+int
+disk_cache_put_pixels(struct disk_cache *self, int index, u32 variant, const struct buffer *pixels, struct dim dim)
+{
+	assert(pixels != NULL);
+
+	if (self == NULL) {
+		return OKAY;
+	}
+	if ((size_t)dim.width * dim.height != pixels->size) {
+		return FAIL;
+	}
+
+	return write_entry(self, index, KIND_PIXELS, variant,
+	                   dim.width, dim.height, pixels->data, pixels->size);
+}
+
+struct palette *
+disk_cache_get_palette(struct disk_cache *self, int index)
+{
+	if (self == NULL) {
+		return NULL;
+	}
+
+	struct entry_header header;
+	struct buffer *data = read_entry(self, index, KIND_PALETTE, 0, &header);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	struct palette *palette = NULL;
+	if (header.width * sizeof(struct rgba) != data->size ||
+	    ALLOC(palette) == NULL) {
+		goto error;
+	}
+	if (CALLOC(palette->colors, header.width ? header.width : 1) == NULL) {
+		goto error;
+	}
+	palette->count = header.width;
+	palette->bit_depth = header.height;
+	memcpy(palette->colors, data->data, data->size);
+
+	FREE(data);
+	return palette;
+
+	error:
+	FREE(palette);
+	FREE(data);
+	return NULL;
+}
+
+int
+disk_cache_put_palette(struct disk_cache *self, int index, const struct palette *palette)
+{
+	assert(palette != NULL);
+
+	if (self == NULL) {
+		return OKAY;
+	}
+
+	return write_entry(self, index, KIND_PALETTE, 0,
+	                   palette->count, palette->bit_depth,
+	                   (const u8 *)palette->colors,
+	                   palette->count * sizeof(struct rgba));
+}
+
+struct buffer *
+disk_cache_load_pixels(struct disk_cache *self, struct NARC *narc, int index, enum crypt crypt, struct dim *dim)
+{
+	assert(narc != NULL);
+
+	struct buffer *pixels = disk_cache_get_pixels(self, index, crypt, dim);
+	if (pixels != NULL) {
+		return pixels;
+	}
+
+	struct NCGR *ncgr = narc_load_file(narc, index);
+	if (nitro_get_magic(ncgr) != (magic_t)'NCGR') {
+		// a bad index, most likely; let the caller deal with it
+		nitro_free(ncgr);
+		FREE(ncgr);
+		return NULL;
+	}
+
+	switch (crypt) {
+	case CRYPT_NONE: break;
+	case CRYPT_PT: ncgr_decrypt_pt(ncgr); break;
+	case CRYPT_DP: ncgr_decrypt_dp(ncgr); break;
+	}
+
+	pixels = ncgr_get_pixels(ncgr);
+	if (pixels != NULL) {
+		ncgr_get_dim(ncgr, dim);
+		disk_cache_put_pixels(self, index, crypt, pixels, *dim);
+	}
+
+	nitro_free(ncgr);
+	FREE(ncgr);
+	return pixels;
+}
+
+struct palette *
+disk_cache_load_palette(struct disk_cache *self, struct NARC *narc, int index)
+{
+	assert(narc != NULL);
+
+	struct palette *palette = disk_cache_get_palette(self, index);
+	if (palette != NULL) {
+		return palette;
+	}
+
+	struct NCLR *nclr = narc_load_file(narc, index);
+	if (nitro_get_magic(nclr) != (magic_t)'NCLR') {
+		// a bad index, most likely; let the caller deal with it
+		nitro_free(nclr);
+		FREE(nclr);
+		return NULL;
+	}
+
+	palette = nclr_get_palette(nclr, 0);
+	if (palette != NULL) {
+		disk_cache_put_palette(self, index, palette);
+	}
+
+	nitro_free(nclr);
+	FREE(nclr);
+	return palette;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include "common.h" /* struct buffer, struct dim, struct palette, u32 */
+#include "narc.h" /* struct NARC */
+
+/* The disk cache keeps decoded pixels and palettes from a NARC between
+ * runs, so that ripping the same archive again skips decompressing,
+ * decrypting and untiling. It lives in the directory named by the
+ * RIP_CACHE_DIR environment variable, and is off if that isn't set. */
+struct disk_cache;
+
+extern struct disk_cache *disk_cache_open(struct NARC *narc);
+extern void disk_cache_close(struct disk_cache *self);
+
+/* variant tells apart different ways of decoding the same file, e.g.
+ * different encryption. The gets return NULL on a miss. */
+extern struct buffer *disk_cache_get_pixels(struct disk_cache *self, int index, u32 variant, struct dim *dim);
+extern int disk_cache_put_pixels(struct disk_cache *self, int index, u32 variant, const struct buffer *pixels, struct dim dim);
+extern struct palette *disk_cache_get_palette(struct disk_cache *self, int index);
+extern int disk_cache_put_palette(struct disk_cache *self, int index, const struct palette *palette);
+
+/* how an NCGR's pixels are encrypted */
+enum crypt {
+	CRYPT_NONE,
+	CRYPT_PT,
+	CRYPT_DP,
+};
+
+/* Load, decrypt and unpack the pixels of an NCGR in narc, or load the
+ * first palette of an NCLR, trying the cache first and filling it in on
+ * a miss. self may be NULL, in which case the file is simply loaded.
+ * Return NULL on error, or if the file isn't an NCGR (or NCLR). */
+extern struct buffer *disk_cache_load_pixels(struct disk_cache *self, struct NARC *narc, int index, enum crypt crypt, struct dim *dim);
+extern struct palette *disk_cache_load_palette(struct disk_cache *self, struct NARC *narc, int index);
+
+#endif /* DISKCACHE_H */
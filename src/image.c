@@ -7,17 +7,22 @@
  */
 
 #include <stdlib.h> /* NULL, size_t */
-#include <stdio.h> /* FILE, feof, ferror, fprintf, fwrite */
+#include <stdbool.h> /* bool, true, false */
+#include <stdio.h> /* FILE, SEEK_SET, fclose, feof, ferror, fopen, fprintf, fseek, ftell, fwrite */
 
-//#include <string.h> /* memset */
+#include <string.h> /* memcmp, memcpy, memset */
 #include <math.h> /* round */
+#include <limits.h> /* INT_MAX */
+
+#include <pthread.h> /* pthread_getspecific, pthread_key_create, pthread_once, pthread_setspecific */
 
 #include <png.h> /* png_*, setjmp */
-#include <zlib.h> /* Z_BEST_SPEED */
+#include <zlib.h> /* Z_*, crc32, deflate, deflateBound, deflateEnd, deflateInit2, deflateReset, z_stream */
 
 #include <gif_lib.h> /* GifFileType, ColorMapType, EGif* */
 
-#include "common.h" /* OKAY, FAIL, NOMEM, assert, CALLOC, FREE, struct buffer, struct coords, struct palette, struct rgba, u8 */
+#include "pool.h" /* pool_run */
+#include "common.h" /* OKAY, FAIL, NOMEM, assert, CALLOC, FREE, struct buffer, struct coords, struct dim, struct palette, struct rgba, warn, u8, u16, u32 */
 
 #include "image.h" /* struct image */
 
@@ -57,13 +62,510 @@ image_write_pam(struct image *self, FILE *fp)
 	return ferror(fp) ? FAIL : OKAY;
 }
 
-int
-image_write_png(struct image *self, FILE *fp)
+/* how hard to compress pngs; see image_set_png_compression */
+static enum image_png_compression png_compression = IMAGE_PNG_FAST;
+
+void
+image_set_png_compression(enum image_png_compression compression)
 {
-	assert(self != NULL);
-	assert(self->pixels != NULL);
-	assert(self->palette != NULL);
+	png_compression = compression;
+}
+
+/* how many threads to compress big pngs on, and how many rows each
+ * gets at a time; see image_set_png_threads */
+static int png_jobs = 1;
+static int png_band_rows = 0;
+
+/* with png_band_rows = 0, bands are about this many bytes of rows */
+#define PNG_BAND_SIZE (64 * 1024)
+
+void
+image_set_png_threads(int jobs, int band_rows)
+{
+	png_jobs = jobs;
+	png_band_rows = band_rows;
+}
+
+static int
+png_zlib_level(void)
+{
+	switch (png_compression) {
+	case IMAGE_PNG_STORE: return Z_NO_COMPRESSION;
+	case IMAGE_PNG_MAX: return Z_BEST_COMPRESSION;
+	case IMAGE_PNG_FAST: break;
+	}
+	// We're going to recompress the images with advdef later; no sense
+	// wasting time now.
+	return Z_BEST_SPEED;
+}
+
+/* A band of rows of a big image, compressed on its own thread. The
+ * stream is raw deflate; the bands are stitched into one zlib stream
+ * afterwards, pigz-style. */
+struct png_band {
+	z_stream z;
+
+	u8 *out;
+	size_t out_size;
+	size_t len;
+
+	u32 adler;
+	int status;
+
+	// the level z was set up with, if it has been
+	int level;
+	int ready;
+};
+
+/* Sprites are small and there are a lot of them, so rather than going
+ * through libpng, which sets everything up anew for every image, we
+ * write 4bpp images ourselves. Each thread keeps a deflate stream and
+ * the buffers to go with it from one image to the next. */
+struct png_scratch {
+	z_stream z;
+
+	// the filtered rows, as fed to deflate
+	u8 *raw;
+	size_t raw_size;
+
+	// the whole file
+	u8 *out;
+	size_t out_size;
+
+	// for big images; kept around like everything else. zlib keeps a
+	// pointer back to each stream, so they mustn't move.
+	struct png_band **bands;
+	size_t band_count;
+
+	// the level z was set up with, if it has been
+	int level;
+	int ready;
+};
+
+static pthread_key_t png_scratch_key;
+static pthread_once_t png_scratch_once = PTHREAD_ONCE_INIT;
+
+static void
+png_scratch_free(void *p)
+{
+	struct png_scratch *scratch = p;
+	if (scratch->ready) {
+		deflateEnd(&scratch->z);
+	}
+	for (size_t i = 0; i < scratch->band_count; i++) {
+		if (scratch->bands[i]->ready) {
+			deflateEnd(&scratch->bands[i]->z);
+		}
+		FREE(scratch->bands[i]->out);
+		FREE(scratch->bands[i]);
+	}
+	FREE(scratch->bands);
+	FREE(scratch->raw);
+	FREE(scratch->out);
+	free(scratch);
+}
+
+static void
+png_scratch_init(void)
+{
+	pthread_key_create(&png_scratch_key, png_scratch_free);
+}
+
+static struct png_scratch *
+png_scratch_get(void)
+{
+	pthread_once(&png_scratch_once, png_scratch_init);
+
+	struct png_scratch *scratch = pthread_getspecific(png_scratch_key);
+	if (scratch == NULL) {
+		if (CALLOC(scratch, 1) == NULL) {
+			return NULL;
+		}
+		if (pthread_setspecific(png_scratch_key, scratch)) {
+			free(scratch);
+			return NULL;
+		}
+	}
+	return scratch;
+}
+
+static int
+grow(u8 **buf, size_t *size, size_t need)
+{
+	if (*size < need) {
+		u8 *p = realloc(*buf, need);
+		if (p == NULL) {
+			return NOMEM;
+		}
+		*buf = p;
+		*size = need;
+	}
+	return OKAY;
+}
+
+static inline void
+put_u32(u8 *p, u32 v)
+{
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+/* Finish off a chunk whose data has already been written at p + 8.
+ * Returns a pointer to the end of the chunk. */
+static u8 *
+end_chunk(u8 *p, u32 type, u32 size)
+{
+	put_u32(p, size);
+	put_u32(p + 4, type);
+	put_u32(p + 8 + size, crc32(0, p + 4, size + 4));
+	return p + 12 + size;
+}
+
+static u8 *
+put_chunk(u8 *p, u32 type, const u8 *data, u32 size)
+{
+	if (size > 0) {
+		memcpy(p + 8, data, size);
+	}
+	return end_chunk(p, type, size);
+}
+
+/* Get a stream ready for a new image. A negative window_bits makes a
+ * raw deflate stream, as for zlib. */
+static int
+stream_reset(z_stream *z, int *ready, int *current_level, int level, int window_bits)
+{
+	if (*ready && *current_level == level) {
+		return deflateReset(z) == Z_OK ? OKAY : FAIL;
+	}
+
+	if (*ready) {
+		deflateEnd(z);
+		*ready = 0;
+	}
+
+	z->zalloc = Z_NULL;
+	z->zfree = Z_NULL;
+	z->opaque = Z_NULL;
+	int mem_level = level == Z_BEST_COMPRESSION ? 9 : 8;
+	if (deflateInit2(z, level, Z_DEFLATED, window_bits, mem_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return NOMEM;
+	}
+	*current_level = level;
+	*ready = 1;
+	return OKAY;
+}
+
+/* The most the chunks before IDAT can take up: the signature, IHDR,
+ * sBIT, a PLTE of 16 colors and tRNS */
+#define PNG_HEAD_SIZE (8 + (12 + 13) + (12 + 3) + (12 + 16*3) + (12 + 1))
+
+/* The compressed data goes here in scratch->out, leaving room for the
+ * biggest head and the IDAT header. The IDAT CRC and IEND go after it. */
+#define IDAT_DATA (PNG_HEAD_SIZE + 8)
+#define IDAT_TAIL (4 + 12)
+
+/* Compress all of the rows in one go */
+static int
+deflate_serial(struct png_scratch *scratch, size_t raw_size, size_t *len)
+{
+	int level = png_zlib_level();
+	if (stream_reset(&scratch->z, &scratch->ready, &scratch->level, level, 15)) {
+		return NOMEM;
+	}
+
+	z_stream *z = &scratch->z;
+	size_t bound = deflateBound(z, raw_size);
+	if (grow(&scratch->out, &scratch->out_size, IDAT_DATA + bound + IDAT_TAIL)) {
+		return NOMEM;
+	}
+
+	z->next_in = scratch->raw;
+	z->avail_in = raw_size;
+	z->next_out = scratch->out + IDAT_DATA;
+	z->avail_out = bound;
+	if (deflate(z, Z_FINISH) != Z_STREAM_END) {
+		return FAIL;
+	}
+	*len = z->total_out;
+	return OKAY;
+}
+
+struct band_job {
+	struct png_band **bands;
+	const u8 *raw;
+	size_t raw_size;
+	size_t band_size; // in bytes, a whole number of rows
+	int count;
+	int level;
+};
+
+static void
+deflate_band_task(void *ctx, int worker, int i)
+{
+	struct band_job *job = ctx;
+	struct png_band *band = job->bands[i];
+	(void)worker;
+
+	const size_t start = i * job->band_size;
+	const u8 *in = job->raw + start;
+	size_t in_size = job->raw_size - start;
+	if (in_size > job->band_size) {
+		in_size = job->band_size;
+	}
+	const bool last = i == job->count - 1;
+
+	band->status = FAIL;
+	if (stream_reset(&band->z, &band->ready, &band->level, job->level, -15)) {
+		band->status = NOMEM;
+		return;
+	}
+
+	// prime the window with the end of the band before, so the seams
+	// cost next to nothing
+	if (start > 0) {
+		size_t dict_size = start < 32768 ? start : 32768;
+		if (deflateSetDictionary(&band->z, in - dict_size, dict_size) != Z_OK) {
+			return;
+		}
+	}
+
+	// a sync flush ends with an empty stored block: 5 bytes, plus
+	// maybe one more to get to a byte boundary. be generous.
+	size_t bound = deflateBound(&band->z, in_size) + 16;
+	if (grow(&band->out, &band->out_size, bound)) {
+		band->status = NOMEM;
+		return;
+	}
+
+	band->z.next_in = (u8 *)in;
+	band->z.avail_in = in_size;
+	band->z.next_out = band->out;
+	band->z.avail_out = bound;
+	int ret = deflate(&band->z, last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (last ? ret != Z_STREAM_END
+	         : ret != Z_OK || band->z.avail_in != 0 || band->z.avail_out == 0) {
+		return;
+	}
+
+	band->len = band->z.total_out;
+	band->adler = adler32(1, in, in_size);
+	band->status = OKAY;
+}
+
+/* Compress the rows in bands of band_size bytes, one to a thread, and
+ * stitch them into one zlib stream. Each band but the last ends in a
+ * sync flush, which leaves it on a byte boundary. */
+static int
+deflate_parallel(struct png_scratch *scratch, size_t raw_size, size_t band_size, int count,
+                 size_t *len)
+{
+	if (scratch->band_count < (size_t)count) {
+		struct png_band **bands = realloc(scratch->bands, count * sizeof *bands);
+		if (bands == NULL) {
+			return NOMEM;
+		}
+		scratch->bands = bands;
+		for (; scratch->band_count < (size_t)count; scratch->band_count++) {
+			if (CALLOC(bands[scratch->band_count], 1) == NULL) {
+				return NOMEM;
+			}
+		}
+	}
+
+	struct band_job job = {
+		.bands = scratch->bands,
+		.raw = scratch->raw,
+		.raw_size = raw_size,
+		.band_size = band_size,
+		.count = count,
+		.level = png_zlib_level(),
+	};
+	if (pool_run(png_jobs, 0, count, deflate_band_task, &job)) {
+		return NOMEM;
+	}
+
+	size_t size = 2 + 4; // the zlib header and the adler32
+	for (int i = 0; i < count; i++) {
+		if (scratch->bands[i]->status != OKAY) {
+			return scratch->bands[i]->status;
+		}
+		size += scratch->bands[i]->len;
+	}
+	if (grow(&scratch->out, &scratch->out_size, IDAT_DATA + size + IDAT_TAIL)) {
+		return NOMEM;
+	}
+
+	// the zlib header: deflate with a 32K window, plus the level
+	// (roughly) and a check
+	int flevel = job.level < 2 ? 0 : job.level < 6 ? 1 : job.level == 6 ? 2 : 3;
+	int cmf = 0x78;
+	int flg = flevel << 6;
+	flg += 31 - (cmf * 256 + flg) % 31;
+
+	u8 *p = scratch->out + IDAT_DATA;
+	*p++ = cmf;
+	*p++ = flg;
+
+	uLong adler = adler32(0, NULL, 0);
+	for (int i = 0; i < count; i++) {
+		struct png_band *band = scratch->bands[i];
+		memcpy(p, band->out, band->len);
+		p += band->len;
+
+		size_t in_size = raw_size - i * band_size;
+		if (in_size > band_size) {
+			in_size = band_size;
+		}
+		adler = adler32_combine(adler, band->adler, in_size);
+	}
+	put_u32(p, adler);
+
+	*len = size;
+	return OKAY;
+}
+
+/* Write the chunks that go before IDAT, for one palette, so that they end
+ * at end. Returns where they start. */
+static u8 *
+put_png_head(u8 *end, struct dim dim, const struct palette *palette)
+{
+	u8 head[PNG_HEAD_SIZE];
+	const int bit_depth = palette->bit_depth;
+
+	static const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	u8 *p = head;
+	memcpy(p, signature, sizeof signature);
+	p += sizeof signature;
+
+	u8 ihdr[13];
+	put_u32(ihdr, dim.width);
+	put_u32(ihdr + 4, dim.height);
+	ihdr[8] = 4; // bit depth
+	ihdr[9] = 3; // color type: palette
+	ihdr[10] = 0; // compression
+	ihdr[11] = 0; // filter
+	ihdr[12] = 0; // interlace
+	p = put_chunk(p, 'IHDR', ihdr, sizeof ihdr);
+
+	u8 sbit[3] = {bit_depth, bit_depth, bit_depth};
+	p = put_chunk(p, 'sBIT', sbit, sizeof sbit);
+
+	u8 plte[16*3];
+	double factor = 255.0 / (double)maxval_from_bitdepth(bit_depth);
+	for (int i = 0; i < palette->count; i++) {
+		struct rgba *color = &palette->colors[i];
+		plte[i*3] = (int)round(color->r * factor);
+		plte[i*3 + 1] = (int)round(color->g * factor);
+		plte[i*3 + 2] = (int)round(color->b * factor);
+	}
+	p = put_chunk(p, 'PLTE', plte, palette->count * 3);
+
+	u8 trns[1] = {0};
+	p = put_chunk(p, 'tRNS', trns, sizeof trns);
+
+	size_t size = p - head;
+	memcpy(end - size, head, size);
+	return end - size;
+}
+
+/* Pack width x height pixels, stride bytes apart, into scratch->raw,
+ * two to a byte, high nibble first, with a filter byte in front of each
+ * row. Returns the size of a row, or 0 if out of memory. */
+static size_t
+pack_4bpp(struct png_scratch *scratch, const u8 *pixels, size_t stride,
+          size_t width, size_t height)
+{
+	const size_t row_size = (width + 1) / 2 + 1; // with the filter byte
+
+	if (grow(&scratch->raw, &scratch->raw_size, row_size * height)) {
+		return 0;
+	}
+
+	for (size_t y = 0; y < height; y++) {
+		const u8 *src = &pixels[y * stride];
+		u8 *row = &scratch->raw[y * row_size];
+		*row++ = 0; // no filter
+		for (size_t x = 0; x + 1 < width; x += 2) {
+			*row++ = (src[x] & 0x0f) << 4 | (src[x + 1] & 0x0f);
+		}
+		if (width & 1) {
+			*row = (src[width - 1] & 0x0f) << 4;
+		}
+	}
+	return row_size;
+}
 
+/* Compress the packed rows into scratch->out at IDAT_DATA. Big images are
+ * split into bands and done in parallel. */
+static int
+deflate_rows(struct png_scratch *scratch, size_t row_size, size_t height, size_t *len)
+{
+	const size_t raw_size = row_size * height;
+	size_t band_rows = png_band_rows;
+	if (band_rows == 0) {
+		band_rows = PNG_BAND_SIZE / row_size + 1;
+	}
+	const size_t band_count = (height + band_rows - 1) / band_rows;
+
+	if (png_jobs > 1 && band_count > 1 && band_count <= INT_MAX) {
+		return deflate_parallel(scratch, raw_size, band_rows * row_size, band_count, len);
+	}
+	return deflate_serial(scratch, raw_size, len);
+}
+
+/* Write a 4bpp image with palettes of at most 16 colors - which is to
+ * say, nearly every sprite - once for each palette. The output is the
+ * same as libpng's (IHDR, sBIT, PLTE, tRNS, IDAT, IEND) but for the
+ * compressed data. Every row uses filter 0: the spec recommends it for
+ * palette images, and it's what libpng picks for them too.
+ *
+ * Only the chunks before IDAT depend on the palette, so the pixels are
+ * compressed just once, and each file is the same IDAT and IEND with its
+ * own head in front. */
+static int
+write_png_4bpp(struct image *self, struct palette *const palettes[], FILE *const fps[], int n)
+{
+	const size_t width = self->dim.width;
+	const size_t height = self->dim.height;
+
+	struct png_scratch *scratch = png_scratch_get();
+	if (scratch == NULL) {
+		return NOMEM;
+	}
+
+	size_t row_size = pack_4bpp(scratch, self->pixels->data, width, width, height);
+	if (row_size == 0) {
+		return NOMEM;
+	}
+
+	size_t len;
+	int status = deflate_rows(scratch, row_size, height, &len);
+	if (status != OKAY) {
+		return status;
+	}
+
+	u8 *idat = scratch->out + IDAT_DATA - 8;
+	u8 *end = end_chunk(idat, 'IDAT', len);
+	end = put_chunk(end, 'IEND', NULL, 0);
+
+	/* and write out each file */
+
+	for (int i = 0; i < n; i++) {
+		u8 *start = put_png_head(idat, self->dim, palettes[i]);
+		size_t size = end - start;
+		if (fwrite(start, 1, size, fps[i]) != size) {
+			status = FAIL;
+		}
+	}
+	return status;
+}
+
+static int
+write_png_libpng(struct image *self, FILE *fp)
+{
 	const int bit_depth = self->palette->bit_depth;
 
 	png_bytepp row_pointers = NULL;
@@ -122,9 +624,7 @@ image_write_png(struct image *self, FILE *fp)
 
 	png_init_io(png, fp);
 
-	// We're going to recompress the images with advdef later; no sense
-	// wasting time now.
-	png_set_compression_level(png, Z_BEST_SPEED);
+	png_set_compression_level(png, png_zlib_level());
 
 	png_set_IHDR(png, info,
 		self->dim.width, self->dim.height,
@@ -149,6 +649,48 @@ image_write_png(struct image *self, FILE *fp)
 	return OKAY;
 }
 
+int
+image_write_png(struct image *self, FILE *fp)
+{
+	assert(self != NULL);
+	assert(self->palette != NULL);
+
+	return image_write_png_multi(self, &self->palette, &fp, 1);
+}
+
+/* Write the image once with each of n palettes, to the matching file.
+ * The image's own palette is ignored. */
+int
+image_write_png_multi(struct image *self, struct palette *const palettes[], FILE *const fps[], int n)
+{
+	assert(self != NULL);
+	assert(self->pixels != NULL);
+	assert(palettes != NULL);
+	assert(fps != NULL);
+
+	bool fits = self->dim.width > 0 && self->dim.height > 0 &&
+	            self->pixels->size >= (size_t)self->dim.width * self->dim.height;
+	for (int i = 0; i < n; i++) {
+		assert(palettes[i] != NULL);
+		if (palettes[i]->count < 1 || palettes[i]->count > 16) {
+			fits = false;
+		}
+	}
+	if (fits) {
+		return write_png_4bpp(self, palettes, fps, n);
+	}
+
+	int status = OKAY;
+	for (int i = 0; i < n; i++) {
+		struct image image = *self;
+		image.palette = palettes[i];
+		if (write_png_libpng(&image, fps[i])) {
+			status = FAIL;
+		}
+	}
+	return status;
+}
+
 void print_gif_error(int err)
 {
 	const char *text = GifErrorString(err);
@@ -238,6 +780,233 @@ giferror:
 	return FAIL;
 }
 
+/* Animations. Frames aren't written as they come in. Each is held back
+ * until the next one arrives, so that identical frames can be merged and
+ * so that we know how to dispose of it. Then only the part that changed
+ * is written, with color 0 - which is transparent anyway - standing for
+ * pixels that stay the same.
+ *
+ * A frame is disposed of by restoring its rectangle to the background
+ * only when some of its pixels have to disappear in the next frame,
+ * and then its rectangle is grown to cover them. The last frame is
+ * treated as if the blank canvas came next, so that the animation
+ * loops back to a clean slate.
+ *
+ * Gifs and apngs work the same way here; only the chunks differ. */
+struct anim {
+	// what's on the screen before the pending frame is drawn
+	u8 *canvas;
+	// the frame waiting to be written, and the part of it that is
+	u8 *pending;
+	u8 *delta;
+
+	struct dim dim;
+	// in 1/delay_den of a second
+	u16 delay;
+	u16 delay_den;
+	int have_pending;
+};
+
+struct rect {
+	int left, top, right, bottom; // right and bottom are exclusive
+};
+
+static void
+rect_add(struct rect *r, int x, int y)
+{
+	if (r->right <= r->left) {
+		*r = (struct rect){x, y, x + 1, y + 1};
+		return;
+	}
+	if (x < r->left) r->left = x;
+	if (y < r->top) r->top = y;
+	if (x >= r->right) r->right = x + 1;
+	if (y >= r->bottom) r->bottom = y + 1;
+}
+
+static void
+rect_union(struct rect *r, struct rect other)
+{
+	if (other.right > other.left) {
+		rect_add(r, other.left, other.top);
+		rect_add(r, other.right - 1, other.bottom - 1);
+	}
+}
+
+static int
+anim_init(struct anim *self, struct dim dim, u16 delay_den)
+{
+	const size_t size = (size_t)dim.width * dim.height;
+	*self = (struct anim){.dim = dim, .delay_den = delay_den};
+	CALLOC(self->canvas, size ? size : 1);
+	CALLOC(self->pending, size ? size : 1);
+	CALLOC(self->delta, size ? size : 1);
+	if (self->canvas == NULL || self->pending == NULL || self->delta == NULL) {
+		return NOMEM;
+	}
+	return OKAY;
+}
+
+static void
+anim_free(struct anim *self)
+{
+	FREE(self->canvas);
+	FREE(self->pending);
+	FREE(self->delta);
+}
+
+static int
+anim_check(struct anim *self, struct image *frame)
+{
+	if (frame->dim.width != self->dim.width ||
+	    frame->dim.height != self->dim.height ||
+	    frame->pixels->size < (size_t)self->dim.width * self->dim.height) {
+		warn("animation frame is the wrong size");
+		return FAIL;
+	}
+	return OKAY;
+}
+
+/* Take a frame. If it's the same as the pending one, that one is just
+ * shown for longer and there's nothing more to do; otherwise returns
+ * false, and the pending frame (if any) has to be written out before the
+ * new one is held with anim_hold. */
+static bool
+anim_extend(struct anim *self, struct image *frame, u16 delay)
+{
+	const size_t size = (size_t)self->dim.width * self->dim.height;
+	if (self->have_pending && self->delay + delay <= 0xffff &&
+	    memcmp(self->pending, frame->pixels->data, size) == 0) {
+		self->delay += delay;
+		return true;
+	}
+	return false;
+}
+
+static void
+anim_hold(struct anim *self, struct image *frame, u16 delay)
+{
+	const size_t size = (size_t)self->dim.width * self->dim.height;
+	memcpy(self->pending, frame->pixels->data, size);
+	self->delay = delay;
+	self->have_pending = 1;
+}
+
+/* Work out which part of the pending frame to write, and put it in delta
+ * with the unchanged pixels cleared. next is the frame after it, or NULL
+ * if it's the last; full asks for the whole canvas. Returns whether the
+ * frame has to be cleared away afterwards. */
+static bool
+anim_diff(struct anim *self, const u8 *next, bool full, struct rect *rect)
+{
+	const int width = self->dim.width;
+	const int height = self->dim.height;
+	const u8 *frame = self->pending;
+	const u8 *canvas = self->canvas;
+
+	// what changed since the last frame, and what has to disappear
+	// before the next one
+	struct rect changed = {0, 0, 0, 0};
+	struct rect vanishing = {0, 0, 0, 0};
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int i = y * width + x;
+			if (frame[i] != canvas[i]) {
+				rect_add(&changed, x, y);
+			}
+			if (frame[i] != 0 && (next == NULL || next[i] == 0)) {
+				rect_add(&vanishing, x, y);
+			}
+		}
+	}
+
+	bool dispose = vanishing.right > vanishing.left;
+	struct rect r = changed;
+	rect_union(&r, vanishing);
+	if (full) {
+		r = (struct rect){0, 0, width, height};
+	} else if (r.right <= r.left) {
+		// nothing to draw, but the delay still counts
+		r = (struct rect){0, 0, 1, 1};
+	}
+
+	u8 *out = self->delta;
+	for (int y = r.top; y < r.bottom; y++) {
+		const u8 *src = frame + y * width;
+		const u8 *old = canvas + y * width;
+		for (int x = r.left; x < r.right; x++) {
+			*out++ = src[x] == old[x] ? 0 : src[x];
+		}
+	}
+
+	*rect = r;
+	return dispose;
+}
+
+/* The pending frame has been written: now it's on the screen, until it's
+ * disposed of */
+static void
+anim_advance(struct anim *self, struct rect r, bool dispose)
+{
+	const int width = self->dim.width;
+	memcpy(self->canvas, self->pending, (size_t)width * self->dim.height);
+	if (dispose) {
+		for (int y = r.top; y < r.bottom; y++) {
+			memset(self->canvas + y * width + r.left, 0, r.right - r.left);
+		}
+	}
+	self->have_pending = 0;
+}
+
+/* A gif keeps its struct anim in UserData, which giflib leaves to us when
+ * writing to a file. */
+enum {
+	GIF_DISPOSE_NONE = 1,
+	GIF_DISPOSE_BACKGROUND = 2,
+};
+
+/* Write out the pending frame. next is the frame after it, or NULL if
+ * it's the last. */
+static int
+gif_flush(GifFileType *gif, struct anim *anim, const u8 *next)
+{
+	struct rect r;
+	bool dispose = anim_diff(anim, next, false, &r);
+
+	// transparency extension
+	u8 ext[4] = "\x01\x00\x00\x00";
+	ext[0] |= (dispose ? GIF_DISPOSE_BACKGROUND : GIF_DISPOSE_NONE) << 2;
+	ext[1] = anim->delay & 0xff;
+	ext[2] = (anim->delay >> 8) & 0xff;
+	if (EGifPutExtension(gif, GRAPHICS_EXT_FUNC_CODE, sizeof(ext), ext) != GIF_OK) {
+		return FAIL;
+	}
+
+	const int width = r.right - r.left;
+	if (EGifPutImageDesc(gif, r.left, r.top, width, r.bottom - r.top,
+	                     0, NULL) != GIF_OK) {
+		return FAIL;
+	}
+
+	for (int y = 0; y < r.bottom - r.top; y++) {
+		if (EGifPutLine(gif, anim->delta + y * width, width) != GIF_OK) {
+			return FAIL;
+		}
+	}
+
+	anim_advance(anim, r, dispose);
+	return OKAY;
+}
+
+static void
+gif_anim_free(struct anim *anim)
+{
+	if (anim != NULL) {
+		anim_free(anim);
+		free(anim);
+	}
+}
+
 /* Open a new gif image and return a handle.
  * The image should have a palette and a dimension. The pixels are ignored.
  * Returns NULL on failure.
@@ -256,10 +1025,21 @@ image_gif_new(struct image *self, const char *outfile)
 	ColorMapObject *colors = NULL;
 	GifFileType *gif = NULL;
 
+	// gif delays are in hundredths of a second
+	struct anim *anim;
+	if (CALLOC(anim, 1) == NULL) {
+		return NULL;
+	}
+	if (anim_init(anim, self->dim, 100)) {
+		gif_anim_free(anim);
+		return NULL;
+	}
+
 	// Note: this is freed by EGifCloseFile
 	colors = GifMakeMapObject(self->palette->count, NULL);
 	if (colors == NULL) {
 		fprintf(stderr, "error allocating color map\n");
+		gif_anim_free(anim);
 		return NULL;
 	}
 
@@ -276,9 +1056,11 @@ image_gif_new(struct image *self, const char *outfile)
 	gif = EGifOpenFileName(outfile, false, &err);
 	if (gif == NULL) {
 		GifFreeMapObject(colors);
+		gif_anim_free(anim);
 		print_gif_error(err);
 		return NULL;
 	}
+	gif->UserData = anim;
 
 	if (EGifPutScreenDesc(gif, self->dim.width, self->dim.height,
 	                      bit_depth - 1, 0, colors) != GIF_OK) {
@@ -307,10 +1089,12 @@ giferror:
 	if (colors != NULL) {
 		GifFreeMapObject(colors);
 	}
+	gif_anim_free(anim);
 	return NULL;
 }
 
-/* Add a frame, given by the image, to an open gif. */
+/* Add a frame, given by the image, to an open gif. It must be the same
+ * size as the gif. The frame is copied, so the image can be reused. */
 int
 image_gif_add_frame(struct image *self, GifFileType *gif, u16 delay)
 {
@@ -318,25 +1102,19 @@ image_gif_add_frame(struct image *self, GifFileType *gif, u16 delay)
 	assert(gif != NULL);
 	assert(self->pixels != NULL);
 
-	// transparency extension
-	u8 ext[4] = "\x09\x00\x00\x00";
-	ext[1] = delay & 0xff;
-	ext[2] = (delay >> 8) & 0xff;
-	if (EGifPutExtension(gif, GRAPHICS_EXT_FUNC_CODE, sizeof(ext), ext) != GIF_OK) {
-		return FAIL;
-	}
+	struct anim *anim = gif->UserData;
+	assert(anim != NULL);
 
-	if (EGifPutImageDesc(gif, 0, 0, self->dim.width, self->dim.height,
-	                     0, NULL) != GIF_OK) {
+	if (anim_check(anim, self)) {
 		return FAIL;
 	}
-
-	for (int y = 0; y < self->dim.height; y++) {
-		u8 *row = self->pixels->data + self->dim.width * y;
-		if (EGifPutLine(gif, row, self->dim.width) != GIF_OK) {
-			return FAIL;
-		}
+	if (anim_extend(anim, self, delay)) {
+		return OKAY;
+	}
+	if (anim->have_pending && gif_flush(gif, anim, self->pixels->data)) {
+		return FAIL;
 	}
+	anim_hold(anim, self, delay);
 	return OKAY;
 }
 
@@ -344,15 +1122,239 @@ image_gif_add_frame(struct image *self, GifFileType *gif, u16 delay)
 int
 image_gif_close(GifFileType *gif)
 {
+	int status = OKAY;
+	struct anim *anim = gif->UserData;
+	if (anim != NULL && anim->have_pending && gif_flush(gif, anim, NULL)) {
+		status = FAIL;
+	}
+	gif->UserData = NULL;
+	gif_anim_free(anim);
+
 	int err = 0;
 	if (EGifCloseFile(gif, &err) != GIF_OK) {
 		print_gif_error(err);
 		return FAIL;
 	}
 
+	return status;
+}
+
+/* An apng is a 4bpp png like any other, with an acTL chunk to say how many
+ * frames there are, and an fcTL chunk in front of each frame to say where
+ * it goes, how long it stays and what becomes of it. The first frame is
+ * the IDAT, and has to cover the whole image; the rest are fdATs. The
+ * frames share the sequence numbers of the fcTLs and fdATs.
+ *
+ * The frames are compressed just like still pngs, on the same per-thread
+ * scratch. The number of frames isn't known until the end, so acTL is
+ * filled in last. */
+struct image_apng {
+	struct anim anim;
+
+	FILE *fp;
+	// where acTL is in the file
+	long actl_pos;
+
+	u32 seq;
+	u32 frame_count;
+};
+
+enum {
+	APNG_DISPOSE_NONE = 0,
+	APNG_DISPOSE_BACKGROUND = 1,
+	APNG_BLEND_OVER = 1,
+};
+
+#define ACTL_SIZE (12 + 8)
+#define FCTL_SIZE (12 + 26)
+
+static int
+put_actl(FILE *fp, u32 frame_count)
+{
+	u8 chunk[ACTL_SIZE];
+	u8 *data = chunk + 8;
+	put_u32(data, frame_count);
+	put_u32(data + 4, 0); // loop forever
+	end_chunk(chunk, 'acTL', 8);
+	return fwrite(chunk, 1, sizeof chunk, fp) == sizeof chunk ? OKAY : FAIL;
+}
+
+static int
+apng_flush(struct image_apng *self, const u8 *next)
+{
+	struct anim *anim = &self->anim;
+	const bool first = self->frame_count == 0;
+
+	struct rect r;
+	bool dispose = anim_diff(anim, next, first, &r);
+	const size_t width = r.right - r.left;
+	const size_t height = r.bottom - r.top;
+
+	u8 fctl[FCTL_SIZE];
+	u8 *data = fctl + 8;
+	put_u32(data, self->seq++);
+	put_u32(data + 4, width);
+	put_u32(data + 8, height);
+	put_u32(data + 12, r.left);
+	put_u32(data + 16, r.top);
+	data[20] = (anim->delay >> 8) & 0xff;
+	data[21] = anim->delay & 0xff;
+	data[22] = (anim->delay_den >> 8) & 0xff;
+	data[23] = anim->delay_den & 0xff;
+	data[24] = dispose ? APNG_DISPOSE_BACKGROUND : APNG_DISPOSE_NONE;
+	data[25] = APNG_BLEND_OVER;
+	end_chunk(fctl, 'fcTL', 26);
+
+	struct png_scratch *scratch = png_scratch_get();
+	if (scratch == NULL) {
+		return NOMEM;
+	}
+	size_t row_size = pack_4bpp(scratch, anim->delta, width, width, height);
+	if (row_size == 0) {
+		return NOMEM;
+	}
+	size_t len;
+	int status = deflate_rows(scratch, row_size, height, &len);
+	if (status != OKAY) {
+		return status;
+	}
+
+	// the first frame is the IDAT. the rest are fdATs, which are the
+	// same but for a sequence number in front.
+	u8 *chunk;
+	if (first) {
+		chunk = scratch->out + IDAT_DATA - 8;
+		end_chunk(chunk, 'IDAT', len);
+		len += 12;
+	} else {
+		chunk = scratch->out + IDAT_DATA - 12;
+		put_u32(chunk + 8, self->seq++);
+		end_chunk(chunk, 'fdAT', len + 4);
+		len += 16;
+	}
+
+	if (fwrite(fctl, 1, sizeof fctl, self->fp) != sizeof fctl ||
+	    fwrite(chunk, 1, len, self->fp) != len) {
+		return FAIL;
+	}
+
+	self->frame_count++;
+	anim_advance(anim, r, dispose);
 	return OKAY;
 }
 
+static void
+apng_free(struct image_apng *self)
+{
+	anim_free(&self->anim);
+	free(self);
+}
+
+/* Open a new apng and return a handle. As with gifs, the image should have
+ * a palette and a dimension, and the pixels are ignored. Frame delays are
+ * in 1/delay_den of a second. Only palettes of up to 16 colors will do.
+ * Returns NULL on failure. */
+struct image_apng *
+image_apng_new(struct image *self, const char *outfile, u16 delay_den)
+{
+	assert(self != NULL);
+	assert(outfile != NULL);
+	if (self->palette == NULL || self->palette->colors == NULL) {
+		return NULL;
+	}
+	if (self->palette->count < 1 || self->palette->count > 16 ||
+	    self->dim.width <= 0 || self->dim.height <= 0 || delay_den == 0) {
+		warn("can't make an apng of that");
+		return NULL;
+	}
+
+	struct image_apng *apng;
+	if (CALLOC(apng, 1) == NULL) {
+		return NULL;
+	}
+	if (anim_init(&apng->anim, self->dim, delay_den)) {
+		apng_free(apng);
+		return NULL;
+	}
+
+	apng->fp = fopen(outfile, "wb");
+	if (apng->fp == NULL) {
+		warn("Could not open %s", outfile);
+		apng_free(apng);
+		return NULL;
+	}
+
+	u8 head[PNG_HEAD_SIZE];
+	u8 *start = put_png_head(head + sizeof head, self->dim, self->palette);
+	size_t size = head + sizeof head - start;
+	if (fwrite(start, 1, size, apng->fp) != size ||
+	    (apng->actl_pos = ftell(apng->fp)) < 0 ||
+	    put_actl(apng->fp, 0)) {
+		fclose(apng->fp);
+		apng_free(apng);
+		return NULL;
+	}
+
+	return apng;
+}
+
+/* Add a frame to an open apng. It must be the same size as the apng. The
+ * frame is copied, so the image can be reused. */
+int
+image_apng_add_frame(struct image *self, struct image_apng *apng, u16 delay)
+{
+	assert(self != NULL);
+	assert(apng != NULL);
+	assert(self->pixels != NULL);
+
+	struct anim *anim = &apng->anim;
+	if (anim_check(anim, self)) {
+		return FAIL;
+	}
+	if (anim_extend(anim, self, delay)) {
+		return OKAY;
+	}
+	if (anim->have_pending && apng_flush(apng, self->pixels->data)) {
+		return FAIL;
+	}
+	anim_hold(anim, self, delay);
+	return OKAY;
+}
+
+/* Write out the last frame, fill in the frame count and close the apng.
+ * Can fail. */
+int
+image_apng_close(struct image_apng *apng)
+{
+	assert(apng != NULL);
+
+	int status = OKAY;
+
+	// a png needs an IDAT, so an animation without frames is one
+	// blank frame
+	if (apng->frame_count == 0 && !apng->anim.have_pending) {
+		apng->anim.have_pending = 1;
+	}
+	if (apng->anim.have_pending && apng_flush(apng, NULL)) {
+		status = FAIL;
+	}
+
+	u8 iend[12];
+	put_chunk(iend, 'IEND', NULL, 0);
+	if (status == OKAY &&
+	    (fwrite(iend, 1, sizeof iend, apng->fp) != sizeof iend ||
+	     fseek(apng->fp, apng->actl_pos, SEEK_SET) ||
+	     put_actl(apng->fp, apng->frame_count))) {
+		status = FAIL;
+	}
+	if (fclose(apng->fp)) {
+		status = FAIL;
+	}
+
+	apng_free(apng);
+	return status;
+}
+
 int
 image_draw_line(struct image *self, struct coords start, struct coords end)
 {
@@ -17,8 +17,23 @@ struct image {
 	struct dim dim;
 };
 
+/* how hard image_write_png tries to compress; the default is fast */
+enum image_png_compression {
+	IMAGE_PNG_STORE,
+	IMAGE_PNG_FAST,
+	IMAGE_PNG_MAX,
+};
+
+extern void image_set_png_compression(enum image_png_compression compression);
+
+/* Compress big pngs on up to jobs threads, in bands of band_rows rows
+ * each (or about 64K of pixels each if band_rows is 0). Images smaller
+ * than a band are always done on the calling thread. */
+extern void image_set_png_threads(int jobs, int band_rows);
+
 extern int image_write_pam(struct image *self, FILE *fp);
 extern int image_write_png(struct image *self, FILE *fp);
+extern int image_write_png_multi(struct image *self, struct palette *const palettes[], FILE *const fps[], int n);
 extern int image_write_gif(struct image *self, FILE *fp);
 
 // gif animations
@@ -28,6 +43,14 @@ extern struct GifFileType *image_gif_new(struct image *self, const char *outfile
 extern int image_gif_add_frame(struct image *self, struct GifFileType *gif, u16 delay);
 extern int image_gif_close(struct GifFileType *gif);
 
+// apng animations, for palettes of up to 16 colors. delays are in
+// 1/delay_den of a second.
+struct image_apng;
+
+extern struct image_apng *image_apng_new(struct image *self, const char *outfile, u16 delay_den);
+extern int image_apng_add_frame(struct image *self, struct image_apng *apng, u16 delay);
+extern int image_apng_close(struct image_apng *apng);
+
 extern int image_draw_line(struct image *self, struct coords start, struct coords end);
 extern int image_draw_square(struct image *self, struct coords start, struct coords end);
 
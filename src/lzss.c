@@ -1,4 +1,4 @@
-/* lzss.c - LZSS decompression routines
+/* lzss.c - LZSS compression and decompression routines
  *
  * Copyright © 2011 magical
  *
@@ -6,11 +6,12 @@
  * and comes with NO WARRANTY. See rip.c for details.
  */
 
-#include <stdlib.h> /* NULL, size_t, perror */
-#include <stdio.h> /* FILE, EOF, fclose, feof, ferror, fgetc, fmemopen, fputc, fread */
+#include <stdlib.h> /* NULL, size_t, malloc, realloc */
+#include <stdio.h> /* FILE, EOF, feof, ferror, fgetc, fputc, fread */
 #include <stdbool.h> /* bool, true, false */
+#include <string.h> /* memcpy */
 
-#include "common.h" /* OKAY, FAIL, FREE, assert, struct buffer, buffer_alloc, warn, u8, u16, u32 */
+#include "common.h" /* OKAY, FAIL, NOMEM, ALLOC, CALLOC, FREE, assert, struct buffer, buffer_alloc, warn, u8, u16, u32, s32 */
 
 #include "lzss.h"
 
@@ -138,97 +139,691 @@ lzss_decompress(FILE *fp, FILE *out, const size_t n, const int mode)
 	return OKAY;
 }
 
-struct buffer *
-lzss_decompress_file(FILE *fp)
+/* Copy count bytes from disp bytes back in the output. The source and
+ * destination overlap when disp < count, in which case the copy has to
+ * go a byte at a time so that it repeats the bytes it just wrote. */
+static inline void
+copy_match(u8 *dest, size_t disp, size_t count)
 {
-#ifndef _WIN32
-	assert(fp != NULL);
+	const u8 *src = dest - disp;
+	if (disp >= 8) {
+		// no chunk overlaps the bytes it is copying
+		while (count >= 8) {
+			memcpy(dest, src, 8);
+			dest += 8;
+			src += 8;
+			count -= 8;
+		}
+	}
+	while (count-- > 0) {
+		*dest++ = *src++;
+	}
+}
 
-	//<read the signature and size>
-	int sig = 0;
-	u32 size = 0;
-	int mode = 0;
+/* Decompress n bytes of an LZSS stream from memory straight into dest.
+ * Does not read the signature. On return, *pos is the number of bytes
+ * of input consumed. */
+static int
+decompress_mem(const u8 *data, size_t size, size_t *pos, u8 *dest, const size_t n, const int mode)
+{
+	const u8 *p = data;
+	const u8 *end = data + size;
+	size_t i = 0;
 
-	fread(&sig, 1, 1, fp);
-	assert(sig == 0x11 || sig == 0x10);
+	assert(mode == LZSS10 || mode == LZSS11);
+
+	while (i < n) {
+		if (p >= end) {
+			return FAIL;
+		}
+		unsigned int flags = *p++;
+		for (unsigned int bitmask = 0x80; bitmask != 0 && i < n; bitmask >>= 1) {
+			if (!(flags & bitmask)) {
+				if (p >= end) {
+					return FAIL;
+				}
+				dest[i++] = *p++;
+				continue;
+			}
 
-	fread(&size, 3, 1, fp);
+			size_t count, disp;
+			if (end - p < 2) {
+				return FAIL;
+			}
+			if (mode == LZSS11) {
+				switch (p[0] >> 4) {
+				case 1:
+					// 16-bit count, 12-bit disp
+					if (end - p < 4) {
+						return FAIL;
+					}
+					count = ((p[0] & 0xf) << 12 | p[1] << 4 | p[2] >> 4) + 0x111;
+					disp = (p[2] & 0xf) << 8 | p[3];
+					p += 4;
+					break;
+				case 0:
+					// 8-bit count, 12-bit disp
+					if (end - p < 3) {
+						return FAIL;
+					}
+					count = ((p[0] & 0xf) << 4 | p[1] >> 4) + 0x11;
+					disp = (p[1] & 0xf) << 8 | p[2];
+					p += 3;
+					break;
+				default:
+					// 4-bit count, 12-bit disp
+					count = (p[0] >> 4) + 1;
+					disp = (p[0] & 0xf) << 8 | p[1];
+					p += 2;
+				}
+			} else {
+				// 4-bit count, 12-bit disp
+				count = (p[0] >> 4) + 3;
+				disp = (p[0] & 0xf) << 8 | p[1];
+				p += 2;
+			}
+			disp += 1;
 
-	if (ferror(fp) || feof(fp)) {
-		return NULL;
+			if (disp > i) {
+				return FAIL;
+			}
+			if (count > n - i) {
+				count = n - i;
+			}
+			copy_match(dest + i, disp, count);
+			i += count;
+		}
 	}
 
-	struct buffer *buffer = buffer_alloc(size);
-	if (buffer == NULL) {
+	*pos = p - data;
+	return OKAY;
+}
+
+/* check that the rest of the data is just padding */
+static int
+check_padding(const u8 *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (data[i] != 0xFF) {
+			warn("LZSS: invalid padding");
+			// XXX fail or not?
+			return FAIL;
+		}
+	}
+	return OKAY;
+}
+
+/* Decompress size bytes of LZSS data, including the signature, into dest.
+ * dest_size must be the uncompressed size given in the header. */
+int
+lzss_decompress_to(const u8 *data, size_t size, u8 *dest, size_t dest_size)
+{
+	assert(data != NULL);
+	assert(dest != NULL);
+
+	if (size < 4 || (data[0] != 0x10 && data[0] != 0x11) ||
+	    dest_size != (size_t)(data[1] | data[2] << 8 | data[3] << 16)) {
+		return FAIL;
+	}
+	int mode = (data[0] == 0x11) ? LZSS11 : LZSS10;
+
+	size_t pos = 0;
+	if (decompress_mem(data + 4, size - 4, &pos, dest, dest_size, mode)) {
+		warn("lzss_decompress failed");
+		return FAIL;
+	}
+
+	return check_padding(data + 4 + pos, size - 4 - pos);
+}
+
+struct buffer *
+lzss_decompress_buffer(struct buffer *buffer)
+{
+	assert(buffer != NULL);
+
+	if (buffer->size < 4) {
 		return NULL;
 	}
 
-	FILE *out = fmemopen(buffer->data, buffer->size, "wb");
+	u32 size = buffer->data[1] | buffer->data[2] << 8 | buffer->data[3] << 16;
+	struct buffer *out = buffer_alloc(size);
 	if (out == NULL) {
-		perror("fmemopen");
 		return NULL;
 	}
 
-	mode = (sig == 0x11) ? LZSS11 : LZSS10;
+	if (lzss_decompress_to(buffer->data, buffer->size, out->data, out->size)) {
+		FREE(out);
+	}
 
-	int status = OKAY;
-	if (lzss_decompress(fp, out, size, mode)) {
-		warn("lzss_decompress failed");
-		status = FAIL;
+	return out;
+}
+
+/* Decompress the rest of a file. */
+struct buffer *
+lzss_decompress_file(FILE *fp)
+{
+	assert(fp != NULL);
+
+	// slurp it up, then decompress it in memory
+	size_t size = 0;
+	size_t alloc = 0x1000;
+	u8 *data = malloc(alloc);
+	if (data == NULL) {
+		return NULL;
 	}
 
-	// check the padding at the end
-	int c;
-	while ((c = fgetc(fp)) != EOF) {
-		if (c != 0xFF) {
-			warn("LZSS: invalid padding");
-			// XXX fail or not?
-			status = FAIL;
+	for (;;) {
+		size += fread(data + size, 1, alloc - size, fp);
+		if (size < alloc) {
+			break;
+		}
+		u8 *tmp = realloc(data, alloc * 2);
+		if (tmp == NULL) {
+			FREE(data);
+			return NULL;
 		}
+		data = tmp;
+		alloc *= 2;
 	}
 
-	if (fclose(out)) {
-		perror("lzss_decompress_file: fclose");
-		status = FAIL;
+	struct buffer *out = NULL;
+	if (!ferror(fp) && 4 <= size) {
+		u32 uncompressed_size = data[1] | data[2] << 8 | data[3] << 16;
+		out = buffer_alloc(uncompressed_size);
+		if (out != NULL &&
+		    lzss_decompress_to(data, size, out->data, out->size)) {
+			FREE(out);
+		}
 	}
 
-	if (status == OKAY) {
-		return buffer;
+	FREE(data);
+	return out;
+}
+
+/* Streaming decompression */
+
+enum lzss_stream_state {
+	STREAM_HEADER,
+	STREAM_FLAGS,
+	STREAM_TOKEN,
+	STREAM_DONE,
+};
+
+void
+lzss_stream_init(struct lzss_stream *s)
+{
+	assert(s != NULL);
+
+	s->in = NULL;
+	s->in_size = 0;
+	s->size = 0;
+	s->pos = 0;
+	s->count = 0;
+	s->disp = 0;
+	s->mode = LZSS10;
+	s->state = STREAM_HEADER;
+	s->flags = 0;
+	s->bitmask = 0;
+	s->code_len = 0;
+}
+
+/* Give the stream more input. It isn't copied, so it has to stay put
+ * until lzss_stream_drain has used it all up. */
+void
+lzss_stream_feed(struct lzss_stream *s, const u8 *data, size_t size)
+{
+	assert(s != NULL);
+	assert(data != NULL || size == 0);
+	assert(s->in_size == 0);
+
+	s->in = data;
+	s->in_size = size;
+}
+
+/* the length of a code, given its first byte */
+static unsigned int
+stream_code_length(int mode, u8 b)
+{
+	if (mode == LZSS11) {
+		switch (b >> 4) {
+		case 1: return 4;
+		case 0: return 3;
+		}
 	}
+	return 2;
+}
+
+/* Decode into dest until it's full, the input runs out, or the stream
+ * ends. *n is set to the number of bytes written. Returns FAIL if the
+ * data is bad, and OKAY otherwise - check lzss_stream_done to see
+ * whether there's more to come. */
+int
+lzss_stream_drain(struct lzss_stream *s, u8 *dest, size_t size, size_t *n)
+{
+	assert(s != NULL);
+	assert(dest != NULL || size == 0);
+	assert(n != NULL);
+
+	size_t i = 0;
+	*n = 0;
+
+	for (;;) {
+		if (s->count > 0) {
+			if (i >= size) {
+				break;
+			}
+			u8 c = s->window[(s->pos - s->disp) % LZSS_BUF_SIZE];
+			s->window[s->pos % LZSS_BUF_SIZE] = c;
+			dest[i++] = c;
+			s->pos++;
+			s->count--;
+			continue;
+		}
 
-	FREE(buffer);
-#endif
-	return NULL;
+		if (s->state != STREAM_HEADER && s->pos == s->size) {
+			s->state = STREAM_DONE;
+		}
+		if (s->state == STREAM_DONE || s->in_size == 0) {
+			break;
+		}
+		if (s->state == STREAM_TOKEN && i >= size) {
+			break;
+		}
+
+		u8 b = *s->in++;
+		s->in_size--;
+
+		switch (s->state) {
+		case STREAM_HEADER:
+			s->code[s->code_len++] = b;
+			if (s->code_len < 4) {
+				break;
+			}
+			if (s->code[0] != 0x10 && s->code[0] != 0x11) {
+				return FAIL;
+			}
+			s->mode = (s->code[0] == 0x11) ? LZSS11 : LZSS10;
+			s->size = s->code[1] | s->code[2] << 8 | s->code[3] << 16;
+			s->code_len = 0;
+			s->state = STREAM_FLAGS;
+			break;
+		case STREAM_FLAGS:
+			s->flags = b;
+			s->bitmask = 0x80;
+			s->state = STREAM_TOKEN;
+			break;
+		case STREAM_TOKEN:
+			if (!(s->flags & s->bitmask)) {
+				s->window[s->pos % LZSS_BUF_SIZE] = b;
+				dest[i++] = b;
+				s->pos++;
+			} else {
+				s->code[s->code_len++] = b;
+				unsigned int len = stream_code_length(s->mode, s->code[0]);
+				if (s->code_len < len) {
+					break;
+				}
+
+				const u8 *p = s->code;
+				size_t count, disp;
+				switch (len) {
+				case 4:
+					// 16-bit count, 12-bit disp
+					count = ((p[0] & 0xf) << 12 | p[1] << 4 | p[2] >> 4) + 0x111;
+					disp = (p[2] & 0xf) << 8 | p[3];
+					break;
+				case 3:
+					// 8-bit count, 12-bit disp
+					count = ((p[0] & 0xf) << 4 | p[1] >> 4) + 0x11;
+					disp = (p[1] & 0xf) << 8 | p[2];
+					break;
+				default:
+					// 4-bit count, 12-bit disp
+					count = (p[0] >> 4) + (s->mode == LZSS11 ? 1 : 3);
+					disp = (p[0] & 0xf) << 8 | p[1];
+				}
+				disp += 1;
+				s->code_len = 0;
+
+				if (disp > s->pos) {
+					return FAIL;
+				}
+				if (count > s->size - s->pos) {
+					count = s->size - s->pos;
+				}
+				s->count = count;
+				s->disp = disp;
+			}
+
+			s->bitmask >>= 1;
+			if (s->bitmask == 0) {
+				s->state = STREAM_FLAGS;
+			}
+			break;
+		}
+	}
+
+	*n = i;
+	return OKAY;
+}
+
+/* whether all of the uncompressed data has come out */
+bool
+lzss_stream_done(const struct lzss_stream *s)
+{
+	assert(s != NULL);
+
+	return s->state == STREAM_DONE ||
+	       (s->state != STREAM_HEADER && s->count == 0 && s->pos == s->size);
+}
+
+/* Compression */
+
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+
+/* how far down the hash chains to look */
+#define FAST_CHAIN_LIMIT 16
+#define OPTIMAL_CHAIN_LIMIT 256
+
+struct match {
+	u32 count;
+	u32 disp;
+};
+
+/* hash chains over three-byte prefixes */
+struct matcher {
+	const u8 *data;
+	size_t size;
+	size_t max_count;
+	size_t chain_limit;
+
+	s32 head[HASH_SIZE];
+	s32 prev[LZSS_BUF_SIZE];
+};
+
+static inline unsigned
+hash3(const u8 *p)
+{
+	u32 x = p[0] | p[1] << 8 | p[2] << 16;
+	return (x * 0x9E3779B1u) >> (32 - HASH_BITS);
+}
+
+/* add position i to the chains */
+static inline void
+matcher_insert(struct matcher *m, size_t i)
+{
+	if (i + MIN_MATCH <= m->size) {
+		unsigned h = hash3(m->data + i);
+		m->prev[i % LZSS_BUF_SIZE] = m->head[h];
+		m->head[h] = (s32)i;
+	}
+}
+
+/* find the longest match for position i, which must not be inserted yet */
+static struct match
+matcher_find(struct matcher *m, size_t i)
+{
+	struct match best = {0, 0};
+	if (i + MIN_MATCH > m->size) {
+		return best;
+	}
+
+	const u8 *cur = m->data + i;
+	size_t max_count = m->size - i;
+	if (max_count > m->max_count) {
+		max_count = m->max_count;
+	}
+
+	s32 cand = m->head[hash3(cur)];
+	for (size_t depth = m->chain_limit; cand >= 0 && depth > 0; depth--) {
+		size_t disp = i - (size_t)cand;
+		if (disp > LZSS_BUF_SIZE) {
+			break;
+		}
+
+		const u8 *p = m->data + cand;
+		if (p[best.count] == cur[best.count]) {
+			// the match may run into the bytes it is copying;
+			// that's fine, the decoder copies forward
+			size_t n = 0;
+			while (n < max_count && p[n] == cur[n]) {
+				n++;
+			}
+			if (n > best.count) {
+				best.count = (u32)n;
+				best.disp = (u32)disp;
+				if (n == max_count) {
+					break;
+				}
+			}
+		}
+
+		cand = m->prev[cand % LZSS_BUF_SIZE];
+	}
+
+	if (best.count < MIN_MATCH) {
+		best.count = 0;
+	}
+	return best;
+}
+
+/* size in bytes of a code for a match of the given length */
+static inline size_t
+code_size(size_t count, int mode)
+{
+	if (mode == LZSS11) {
+		if (count > 0x110) {
+			return 4;
+		} else if (count > 0x10) {
+			return 3;
+		}
+	}
+	return 2;
 }
 
+static u8 *
+put_code(u8 *out, size_t count, size_t disp, int mode)
+{
+	disp -= 1;
+	if (mode == LZSS11) {
+		if (count > 0x110) {
+			count -= 0x111;
+			*out++ = 0x10 | (count >> 12);
+			*out++ = (count >> 4) & 0xff;
+			*out++ = (count & 0xf) << 4 | disp >> 8;
+		} else if (count > 0x10) {
+			count -= 0x11;
+			*out++ = count >> 4;
+			*out++ = (count & 0xf) << 4 | disp >> 8;
+		} else {
+			*out++ = (count - 1) << 4 | disp >> 8;
+		}
+	} else {
+		*out++ = (count - 3) << 4 | disp >> 8;
+	}
+	*out++ = disp & 0xff;
+	return out;
+}
+
+/* Choose the matches to use for an optimal parse. On return, match[i]
+ * is the code to emit at position i (count 0 for a literal). */
+static int
+optimal_parse(struct matcher *m, struct match *match, int mode)
+{
+	size_t n = m->size;
+	u32 *cost;
+	CALLOC(cost, n + 1);
+	if (cost == NULL) {
+		return NOMEM;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		match[i] = matcher_find(m, i);
+		matcher_insert(m, i);
+	}
+
+	// cost[i] is the cheapest encoding of data[i..n], in bits,
+	// counting one flag bit per token
+	cost[n] = 0;
+	for (size_t i = n; i-- > 0;) {
+		struct match longest = match[i];
+
+		cost[i] = cost[i + 1] + 9;
+		match[i].count = 0;
+
+		// a match can always be cut short, and a shorter one can
+		// leave a cheaper rest, so try every length. LZSS11 matches
+		// can be up to 0x10110 bytes long, though; past 0x110 (where
+		// the code stops growing) only the full length is tried,
+		// which keeps the work per position bounded.
+		size_t max_count = longest.count < 0x110 ? longest.count : 0x110;
+		for (size_t count = MIN_MATCH; count <= longest.count; count++) {
+			if (count > max_count) {
+				count = longest.count;
+			}
+			u32 c = cost[i + count] + 1 + 8 * code_size(count, mode);
+			if (c < cost[i]) {
+				cost[i] = c;
+				match[i].count = (u32)count;
+				match[i].disp = longest.disp;
+			}
+		}
+	}
+
+	FREE(cost);
+	return OKAY;
+}
+
+/* Compress a buffer. The result may be larger than the input, in which
+ * case it will not pass lzss_check(). Returns NULL if the buffer is too
+ * big (16 MiB or more) or if there's no memory. */
 struct buffer *
-lzss_decompress_buffer(struct buffer *buffer)
+lzss_compress_buffer(struct buffer *buffer, int mode, int effort)
 {
-#ifndef _WIN32
 	assert(buffer != NULL);
+	assert(mode == LZSS10 || mode == LZSS11);
+	assert(effort == LZSS_FAST || effort == LZSS_OPTIMAL);
+
+	size_t n = buffer->size;
+	if (n >= 0x1000000) {
+		return NULL;
+	}
 
-	FILE *fp = fmemopen(buffer->data, buffer->size, "rb");
+	struct matcher *m;
+	ALLOC(m);
+	if (m == NULL) {
+		return NULL;
+	}
+	m->data = buffer->data;
+	m->size = n;
+	m->max_count = (mode == LZSS11) ? 0x10110 : 18;
+	m->chain_limit = (effort == LZSS_OPTIMAL) ? OPTIMAL_CHAIN_LIMIT : FAST_CHAIN_LIMIT;
+	for (size_t i = 0; i < HASH_SIZE; i++) {
+		m->head[i] = -1;
+	}
 
-	struct buffer *out = lzss_decompress_file(fp);
+	struct match *match = NULL;
+	if (effort == LZSS_OPTIMAL) {
+		CALLOC(match, n + 1);
+		if (match == NULL || optimal_parse(m, match, mode)) {
+			FREE(match);
+			FREE(m);
+			return NULL;
+		}
+	}
 
-	if (fclose(fp)) {
-		perror("lzss_decompress_buffer: fclose");
+	// worst case: every byte a literal, plus flags and padding
+	struct buffer *out = buffer_alloc(4 + n + (n + 7) / 8 + 3);
+	if (out == NULL) {
+		FREE(match);
+		FREE(m);
+		return NULL;
 	}
 
-	return out;
-#endif
-	return NULL;
+	u8 *p = out->data;
+	*p++ = (mode == LZSS11) ? 0x11 : 0x10;
+	*p++ = n & 0xff;
+	*p++ = (n >> 8) & 0xff;
+	*p++ = (n >> 16) & 0xff;
+
+	u8 *flags = NULL;
+	// the match found by looking ahead, if any
+	unsigned int bitmask = 0;
+	struct match next = {0, 0};
+	for (size_t i = 0; i < n;) {
+		if (bitmask == 0) {
+			flags = p++;
+			*flags = 0;
+			bitmask = 0x80;
+		}
+
+		struct match cur;
+		if (match != NULL) {
+			cur = match[i];
+		} else {
+			cur = next.count ? next : matcher_find(m, i);
+			next.count = 0;
+			if (cur.count && i + 1 < n) {
+				// lazy matching: if the next position has a
+				// longer match, emit a literal instead
+				matcher_insert(m, i);
+				next = matcher_find(m, i + 1);
+				if (next.count > cur.count) {
+					cur.count = 0;
+				} else {
+					next.count = 0;
+				}
+			} else {
+				matcher_insert(m, i);
+			}
+		}
+
+		if (cur.count) {
+			*flags |= bitmask;
+			p = put_code(p, cur.count, cur.disp, mode);
+			if (match == NULL) {
+				// the first position is already inserted
+				for (size_t j = i + 1; j < i + cur.count; j++) {
+					matcher_insert(m, j);
+				}
+			}
+			i += cur.count;
+		} else {
+			*p++ = buffer->data[i];
+			i++;
+		}
+		bitmask >>= 1;
+	}
+
+	while ((p - out->data) % 4 != 0) {
+		*p++ = 0xFF;
+	}
+
+	FREE(match);
+	FREE(m);
+
+	out->size = p - out->data;
+	struct buffer *tmp = realloc(out, sizeof(*out) + out->size);
+	return tmp != NULL ? tmp : out;
 }
 
 /* check whether a buffer looks like valid lzss-compressed data */
 bool
 lzss_check(struct buffer *buffer)
 {
-	if (buffer != NULL && 4 <= buffer->size &&
-	    (buffer->data[0] == '\x10' || buffer->data[0] == '\x11')) {
-		u32 uncompressed_size = *(u32 *)buffer->data >> 8;
+	return buffer != NULL && lzss_check_data(buffer->data, buffer->size);
+}
+
+bool
+lzss_check_data(const u8 *data, size_t size)
+{
+	if (data != NULL && 4 <= size &&
+	    (data[0] == '\x10' || data[0] == '\x11')) {
+		u32 uncompressed_size = data[1] | data[2] << 8 | data[3] << 16;
 
-		if (buffer->size - 4 < uncompressed_size) {
+		if (size - 4 < uncompressed_size) {
 			return true;
 		}
 	}
@@ -11,7 +11,7 @@
 #include <stdio.h> /* FILE */
 #include <stdbool.h> /* bool */
 
-#include "common.h" /* struct buffer, u16 */
+#include "common.h" /* struct buffer, u8, u16 */
 
 #define LZSS_BUF_SIZE ((u16)(0x1000))
 
@@ -20,11 +20,56 @@ enum lzss_mode {
 	LZSS11,
 };
 
+/* how hard lzss_compress_buffer tries */
+enum lzss_effort {
+	LZSS_FAST, /* greedy parse with one step of lookahead */
+	LZSS_OPTIMAL, /* smallest output, several times slower */
+};
+
+/* A decoder which takes its input and gives its output a piece at a
+ * time, so it can stop partway through - after the header of a file,
+ * say - and pick up again later. All it keeps of the output is the last
+ * LZSS_BUF_SIZE bytes, which is as far back as any code can reach. */
+struct lzss_stream {
+	/* input which hasn't been decoded yet */
+	const u8 *in;
+	size_t in_size;
+
+	/* the uncompressed size from the header, and how much of it has
+	 * been decoded so far */
+	size_t size;
+	size_t pos;
+
+	/* the match being copied */
+	size_t count;
+	size_t disp;
+
+	int mode;
+	int state;
+	unsigned int flags;
+	unsigned int bitmask;
+
+	/* the code (or header) being read */
+	unsigned int code_len;
+	u8 code[4];
+
+	u8 window[LZSS_BUF_SIZE];
+};
+
+extern void lzss_stream_init(struct lzss_stream *s);
+extern void lzss_stream_feed(struct lzss_stream *s, const u8 *data, size_t size);
+extern int lzss_stream_drain(struct lzss_stream *s, u8 *dest, size_t size, size_t *n);
+extern bool lzss_stream_done(const struct lzss_stream *s);
+
 extern int lzss_decompress(FILE *fp, FILE *out, const size_t n, const int mode);
 extern struct buffer *lzss_decompress_file(FILE *fp);
 extern struct buffer *lzss_decompress_buffer(struct buffer *buffer);
+extern int lzss_decompress_to(const u8 *data, size_t size, u8 *dest, size_t dest_size);
+
+extern struct buffer *lzss_compress_buffer(struct buffer *buffer, int mode, int effort);
 
 /* check whether a buffer looks like valid lzss-compressed data */
 extern bool lzss_check(struct buffer *buffer);
+extern bool lzss_check_data(const u8 *data, size_t size);
 
 #endif /* LZSS_H */
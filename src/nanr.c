@@ -10,18 +10,18 @@
 #include "nanr.h"
 #include "nmar.h"
 
+#include <stdlib.h> /* free */
+#include <stdbool.h> /* bool */
 #include <stdio.h> /* FILE */
-#include <math.h> /* sin, cos */
+#include <string.h> /* memset */
 
-#include "nitro.h" /* struct nitro, struct format_info, magic_t, format_header */
-#include "common.h" /* OKAY, FAIL, NOMEM, u8, u16, u32, s32, struct buffer */
+#include "nitro.h" /* struct nitro, struct nitro_probe, struct format_info, magic_t, format_header */
+#include "common.h" /* OKAY, FAIL, NOMEM, CALLOC, FREE, assert, u8, u16, u32, s32, struct buffer */
 #include "nmcr.h" /* struct NMCR, nmcr_draw */
 #include "ncer.h" /* struct NCER */
 #include "ncgr.h" /* struct NCGR */
-
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
+#include "nclr.h" /* struct NCLR, nclr_get_palette */
+#include "image.h" /* struct image, struct GifFileType, struct image_apng, image_apng_*, image_gif_new, image_gif_add_frame, image_gif_close */
 
 /* ABNK structure. Shared by NANR and NMAR. */
 
@@ -76,6 +76,26 @@ struct frame_data_2 {
 	s16 y;
 };
 
+/* An acell's frames laid out in time, with their frame data decoded, so
+ * that drawing a tick doesn't mean walking the whole animation. Built
+ * once when the file is loaded. */
+struct timeline_frame {
+	// when the frame starts, and when the run of frames showing the same
+	// cell that it's part of started
+	u32 start;
+	u32 run_start;
+
+	int cell_index;
+	struct coords offset;
+	fx16 m[4];
+};
+
+struct timeline {
+	struct timeline_frame *frames;
+	u32 frame_count;
+	u32 period;
+};
+
 struct ABNK {
 	struct {
 		magic_t magic;
@@ -96,8 +116,30 @@ struct ABNK {
 	struct acell *acells;
 	struct frame *frames;
 	u8 *frame_data;
+
+	// one for each acell, and the frames for all of them
+	struct timeline *timelines;
+	struct timeline_frame *timeline_frames;
 };
 
+static int abnk_build_timelines(struct ABNK *self, const u8 *data, size_t data_size);
+
+/* point the tables at the data following the header */
+static void
+abnk_set_tables(struct ABNK *self, const u8 *data)
+{
+	size_t base = sizeof(self->header) - 8;
+	assert(base == 0x18);
+
+	/* XXX bounds checks - invalid data could walk all over memory */
+	self->acells = (struct acell *)(data +
+	    (self->header.acell_data_offset - base));
+	self->frames = (struct frame *)(data +
+	    (self->header.frame_data_offset - base));
+	self->frame_data = (u8 *)data +
+	    (self->header.frame_data_data_offset - base);
+}
+
 static int
 abnk_read(struct ABNK *self, FILE *fp) {
 	FREAD(fp, &self->header, 1);
@@ -116,17 +158,356 @@ abnk_read(struct ABNK *self, FILE *fp) {
 		return FAIL;
 	}
 
-	size_t base = sizeof(self->header) - 8;
-	assert(base == 0x18);
+	abnk_set_tables(self, self->data->data);
 
-	/* XXX bounds checks - invalid data could walk all over memory */
-	self->acells = (struct acell *)(self->data->data +
-	    (self->header.acell_data_offset - base));
-	self->frames = (struct frame *)(self->data->data +
-	    (self->header.frame_data_offset - base));
-	self->frame_data = self->data->data +
-	    (self->header.frame_data_data_offset - base);
+	return abnk_build_timelines(self, self->data->data, data_size);
+}
+
+/* The tables are borrowed, not copied; self->data stays NULL. */
+static int
+abnk_read_mem(struct ABNK *self, struct cursor *c) {
+	if (CREAD(c, &self->header, 1)) {
+		return FAIL;
+	}
 
+	size_t data_size = self->header.size - sizeof(self->header);
+	const u8 *data = cursor_borrow(c, data_size);
+	if (data == NULL) {
+		return FAIL;
+	}
+
+	abnk_set_tables(self, data);
+
+	return abnk_build_timelines(self, data, data_size);
+}
+
+/* The DS works out sines from a table of 4096 steps to the circle, in
+ * 1.3.12 fixed point, rounded to nearest. This is the first quarter of it
+ * - up to and including 90 degrees; the rest is mirrored from that. */
+static const u16 sin_table[1025] = {
+	0x0000, 0x0006, 0x000d, 0x0013, 0x0019, 0x001f, 0x0026, 0x002c,
+	0x0032, 0x0039, 0x003f, 0x0045, 0x004b, 0x0052, 0x0058, 0x005e,
+	0x0065, 0x006b, 0x0071, 0x0077, 0x007e, 0x0084, 0x008a, 0x0090,
+	0x0097, 0x009d, 0x00a3, 0x00aa, 0x00b0, 0x00b6, 0x00bc, 0x00c3,
+	0x00c9, 0x00cf, 0x00d6, 0x00dc, 0x00e2, 0x00e8, 0x00ef, 0x00f5,
+	0x00fb, 0x0101, 0x0108, 0x010e, 0x0114, 0x011b, 0x0121, 0x0127,
+	0x012d, 0x0134, 0x013a, 0x0140, 0x0146, 0x014d, 0x0153, 0x0159,
+	0x015f, 0x0166, 0x016c, 0x0172, 0x0178, 0x017f, 0x0185, 0x018b,
+	0x0191, 0x0198, 0x019e, 0x01a4, 0x01aa, 0x01b1, 0x01b7, 0x01bd,
+	0x01c3, 0x01ca, 0x01d0, 0x01d6, 0x01dc, 0x01e3, 0x01e9, 0x01ef,
+	0x01f5, 0x01fc, 0x0202, 0x0208, 0x020e, 0x0215, 0x021b, 0x0221,
+	0x0227, 0x022d, 0x0234, 0x023a, 0x0240, 0x0246, 0x024d, 0x0253,
+	0x0259, 0x025f, 0x0265, 0x026c, 0x0272, 0x0278, 0x027e, 0x0284,
+	0x028b, 0x0291, 0x0297, 0x029d, 0x02a3, 0x02aa, 0x02b0, 0x02b6,
+	0x02bc, 0x02c2, 0x02c9, 0x02cf, 0x02d5, 0x02db, 0x02e1, 0x02e8,
+	0x02ee, 0x02f4, 0x02fa, 0x0300, 0x0306, 0x030d, 0x0313, 0x0319,
+	0x031f, 0x0325, 0x032b, 0x0332, 0x0338, 0x033e, 0x0344, 0x034a,
+	0x0350, 0x0356, 0x035d, 0x0363, 0x0369, 0x036f, 0x0375, 0x037b,
+	0x0381, 0x0388, 0x038e, 0x0394, 0x039a, 0x03a0, 0x03a6, 0x03ac,
+	0x03b2, 0x03b9, 0x03bf, 0x03c5, 0x03cb, 0x03d1, 0x03d7, 0x03dd,
+	0x03e3, 0x03e9, 0x03ef, 0x03f6, 0x03fc, 0x0402, 0x0408, 0x040e,
+	0x0414, 0x041a, 0x0420, 0x0426, 0x042c, 0x0432, 0x0438, 0x043e,
+	0x0444, 0x044b, 0x0451, 0x0457, 0x045d, 0x0463, 0x0469, 0x046f,
+	0x0475, 0x047b, 0x0481, 0x0487, 0x048d, 0x0493, 0x0499, 0x049f,
+	0x04a5, 0x04ab, 0x04b1, 0x04b7, 0x04bd, 0x04c3, 0x04c9, 0x04cf,
+	0x04d5, 0x04db, 0x04e1, 0x04e7, 0x04ed, 0x04f3, 0x04f9, 0x04ff,
+	0x0505, 0x050b, 0x0511, 0x0517, 0x051d, 0x0523, 0x0529, 0x052f,
+	0x0534, 0x053a, 0x0540, 0x0546, 0x054c, 0x0552, 0x0558, 0x055e,
+	0x0564, 0x056a, 0x0570, 0x0576, 0x057c, 0x0581, 0x0587, 0x058d,
+	0x0593, 0x0599, 0x059f, 0x05a5, 0x05ab, 0x05b1, 0x05b6, 0x05bc,
+	0x05c2, 0x05c8, 0x05ce, 0x05d4, 0x05da, 0x05df, 0x05e5, 0x05eb,
+	0x05f1, 0x05f7, 0x05fd, 0x0602, 0x0608, 0x060e, 0x0614, 0x061a,
+	0x061f, 0x0625, 0x062b, 0x0631, 0x0637, 0x063c, 0x0642, 0x0648,
+	0x064e, 0x0654, 0x0659, 0x065f, 0x0665, 0x066b, 0x0670, 0x0676,
+	0x067c, 0x0682, 0x0687, 0x068d, 0x0693, 0x0699, 0x069e, 0x06a4,
+	0x06aa, 0x06af, 0x06b5, 0x06bb, 0x06c1, 0x06c6, 0x06cc, 0x06d2,
+	0x06d7, 0x06dd, 0x06e3, 0x06e8, 0x06ee, 0x06f4, 0x06f9, 0x06ff,
+	0x0705, 0x070a, 0x0710, 0x0715, 0x071b, 0x0721, 0x0726, 0x072c,
+	0x0732, 0x0737, 0x073d, 0x0742, 0x0748, 0x074e, 0x0753, 0x0759,
+	0x075e, 0x0764, 0x076a, 0x076f, 0x0775, 0x077a, 0x0780, 0x0785,
+	0x078b, 0x0790, 0x0796, 0x079b, 0x07a1, 0x07a6, 0x07ac, 0x07b2,
+	0x07b7, 0x07bd, 0x07c2, 0x07c8, 0x07cd, 0x07d2, 0x07d8, 0x07dd,
+	0x07e3, 0x07e8, 0x07ee, 0x07f3, 0x07f9, 0x07fe, 0x0804, 0x0809,
+	0x080e, 0x0814, 0x0819, 0x081f, 0x0824, 0x082a, 0x082f, 0x0834,
+	0x083a, 0x083f, 0x0845, 0x084a, 0x084f, 0x0855, 0x085a, 0x085f,
+	0x0865, 0x086a, 0x086f, 0x0875, 0x087a, 0x087f, 0x0885, 0x088a,
+	0x088f, 0x0895, 0x089a, 0x089f, 0x08a5, 0x08aa, 0x08af, 0x08b4,
+	0x08ba, 0x08bf, 0x08c4, 0x08c9, 0x08cf, 0x08d4, 0x08d9, 0x08de,
+	0x08e4, 0x08e9, 0x08ee, 0x08f3, 0x08f8, 0x08fe, 0x0903, 0x0908,
+	0x090d, 0x0912, 0x0918, 0x091d, 0x0922, 0x0927, 0x092c, 0x0931,
+	0x0937, 0x093c, 0x0941, 0x0946, 0x094b, 0x0950, 0x0955, 0x095a,
+	0x095f, 0x0965, 0x096a, 0x096f, 0x0974, 0x0979, 0x097e, 0x0983,
+	0x0988, 0x098d, 0x0992, 0x0997, 0x099c, 0x09a1, 0x09a6, 0x09ab,
+	0x09b0, 0x09b5, 0x09ba, 0x09bf, 0x09c4, 0x09c9, 0x09ce, 0x09d3,
+	0x09d8, 0x09dd, 0x09e2, 0x09e7, 0x09ec, 0x09f1, 0x09f6, 0x09fb,
+	0x09ff, 0x0a04, 0x0a09, 0x0a0e, 0x0a13, 0x0a18, 0x0a1d, 0x0a22,
+	0x0a26, 0x0a2b, 0x0a30, 0x0a35, 0x0a3a, 0x0a3f, 0x0a44, 0x0a48,
+	0x0a4d, 0x0a52, 0x0a57, 0x0a5c, 0x0a60, 0x0a65, 0x0a6a, 0x0a6f,
+	0x0a73, 0x0a78, 0x0a7d, 0x0a82, 0x0a86, 0x0a8b, 0x0a90, 0x0a95,
+	0x0a99, 0x0a9e, 0x0aa3, 0x0aa7, 0x0aac, 0x0ab1, 0x0ab5, 0x0aba,
+	0x0abf, 0x0ac3, 0x0ac8, 0x0acd, 0x0ad1, 0x0ad6, 0x0adb, 0x0adf,
+	0x0ae4, 0x0ae8, 0x0aed, 0x0af2, 0x0af6, 0x0afb, 0x0aff, 0x0b04,
+	0x0b08, 0x0b0d, 0x0b11, 0x0b16, 0x0b1b, 0x0b1f, 0x0b24, 0x0b28,
+	0x0b2d, 0x0b31, 0x0b36, 0x0b3a, 0x0b3e, 0x0b43, 0x0b47, 0x0b4c,
+	0x0b50, 0x0b55, 0x0b59, 0x0b5e, 0x0b62, 0x0b66, 0x0b6b, 0x0b6f,
+	0x0b74, 0x0b78, 0x0b7c, 0x0b81, 0x0b85, 0x0b89, 0x0b8e, 0x0b92,
+	0x0b97, 0x0b9b, 0x0b9f, 0x0ba3, 0x0ba8, 0x0bac, 0x0bb0, 0x0bb5,
+	0x0bb9, 0x0bbd, 0x0bc1, 0x0bc6, 0x0bca, 0x0bce, 0x0bd2, 0x0bd7,
+	0x0bdb, 0x0bdf, 0x0be3, 0x0be8, 0x0bec, 0x0bf0, 0x0bf4, 0x0bf8,
+	0x0bfc, 0x0c01, 0x0c05, 0x0c09, 0x0c0d, 0x0c11, 0x0c15, 0x0c19,
+	0x0c1e, 0x0c22, 0x0c26, 0x0c2a, 0x0c2e, 0x0c32, 0x0c36, 0x0c3a,
+	0x0c3e, 0x0c42, 0x0c46, 0x0c4a, 0x0c4e, 0x0c52, 0x0c56, 0x0c5a,
+	0x0c5e, 0x0c62, 0x0c66, 0x0c6a, 0x0c6e, 0x0c72, 0x0c76, 0x0c7a,
+	0x0c7e, 0x0c82, 0x0c86, 0x0c8a, 0x0c8e, 0x0c91, 0x0c95, 0x0c99,
+	0x0c9d, 0x0ca1, 0x0ca5, 0x0ca9, 0x0cac, 0x0cb0, 0x0cb4, 0x0cb8,
+	0x0cbc, 0x0cc0, 0x0cc3, 0x0cc7, 0x0ccb, 0x0ccf, 0x0cd2, 0x0cd6,
+	0x0cda, 0x0cde, 0x0ce1, 0x0ce5, 0x0ce9, 0x0ced, 0x0cf0, 0x0cf4,
+	0x0cf8, 0x0cfb, 0x0cff, 0x0d03, 0x0d06, 0x0d0a, 0x0d0e, 0x0d11,
+	0x0d15, 0x0d18, 0x0d1c, 0x0d20, 0x0d23, 0x0d27, 0x0d2a, 0x0d2e,
+	0x0d32, 0x0d35, 0x0d39, 0x0d3c, 0x0d40, 0x0d43, 0x0d47, 0x0d4a,
+	0x0d4e, 0x0d51, 0x0d55, 0x0d58, 0x0d5c, 0x0d5f, 0x0d62, 0x0d66,
+	0x0d69, 0x0d6d, 0x0d70, 0x0d74, 0x0d77, 0x0d7a, 0x0d7e, 0x0d81,
+	0x0d85, 0x0d88, 0x0d8b, 0x0d8f, 0x0d92, 0x0d95, 0x0d99, 0x0d9c,
+	0x0d9f, 0x0da2, 0x0da6, 0x0da9, 0x0dac, 0x0db0, 0x0db3, 0x0db6,
+	0x0db9, 0x0dbc, 0x0dc0, 0x0dc3, 0x0dc6, 0x0dc9, 0x0dcc, 0x0dd0,
+	0x0dd3, 0x0dd6, 0x0dd9, 0x0ddc, 0x0ddf, 0x0de3, 0x0de6, 0x0de9,
+	0x0dec, 0x0def, 0x0df2, 0x0df5, 0x0df8, 0x0dfb, 0x0dfe, 0x0e01,
+	0x0e04, 0x0e07, 0x0e0a, 0x0e0d, 0x0e10, 0x0e13, 0x0e16, 0x0e19,
+	0x0e1c, 0x0e1f, 0x0e22, 0x0e25, 0x0e28, 0x0e2b, 0x0e2e, 0x0e31,
+	0x0e34, 0x0e37, 0x0e3a, 0x0e3c, 0x0e3f, 0x0e42, 0x0e45, 0x0e48,
+	0x0e4b, 0x0e4d, 0x0e50, 0x0e53, 0x0e56, 0x0e59, 0x0e5b, 0x0e5e,
+	0x0e61, 0x0e64, 0x0e66, 0x0e69, 0x0e6c, 0x0e6f, 0x0e71, 0x0e74,
+	0x0e77, 0x0e79, 0x0e7c, 0x0e7f, 0x0e81, 0x0e84, 0x0e87, 0x0e89,
+	0x0e8c, 0x0e8f, 0x0e91, 0x0e94, 0x0e96, 0x0e99, 0x0e9b, 0x0e9e,
+	0x0ea1, 0x0ea3, 0x0ea6, 0x0ea8, 0x0eab, 0x0ead, 0x0eb0, 0x0eb2,
+	0x0eb5, 0x0eb7, 0x0eba, 0x0ebc, 0x0ebf, 0x0ec1, 0x0ec3, 0x0ec6,
+	0x0ec8, 0x0ecb, 0x0ecd, 0x0ecf, 0x0ed2, 0x0ed4, 0x0ed6, 0x0ed9,
+	0x0edb, 0x0edd, 0x0ee0, 0x0ee2, 0x0ee4, 0x0ee7, 0x0ee9, 0x0eeb,
+	0x0eee, 0x0ef0, 0x0ef2, 0x0ef4, 0x0ef7, 0x0ef9, 0x0efb, 0x0efd,
+	0x0eff, 0x0f02, 0x0f04, 0x0f06, 0x0f08, 0x0f0a, 0x0f0c, 0x0f0e,
+	0x0f11, 0x0f13, 0x0f15, 0x0f17, 0x0f19, 0x0f1b, 0x0f1d, 0x0f1f,
+	0x0f21, 0x0f23, 0x0f25, 0x0f27, 0x0f29, 0x0f2b, 0x0f2d, 0x0f2f,
+	0x0f31, 0x0f33, 0x0f35, 0x0f37, 0x0f39, 0x0f3b, 0x0f3d, 0x0f3f,
+	0x0f41, 0x0f43, 0x0f45, 0x0f46, 0x0f48, 0x0f4a, 0x0f4c, 0x0f4e,
+	0x0f50, 0x0f51, 0x0f53, 0x0f55, 0x0f57, 0x0f59, 0x0f5a, 0x0f5c,
+	0x0f5e, 0x0f60, 0x0f61, 0x0f63, 0x0f65, 0x0f67, 0x0f68, 0x0f6a,
+	0x0f6c, 0x0f6d, 0x0f6f, 0x0f71, 0x0f72, 0x0f74, 0x0f76, 0x0f77,
+	0x0f79, 0x0f7a, 0x0f7c, 0x0f7d, 0x0f7f, 0x0f81, 0x0f82, 0x0f84,
+	0x0f85, 0x0f87, 0x0f88, 0x0f8a, 0x0f8b, 0x0f8d, 0x0f8e, 0x0f90,
+	0x0f91, 0x0f93, 0x0f94, 0x0f95, 0x0f97, 0x0f98, 0x0f9a, 0x0f9b,
+	0x0f9c, 0x0f9e, 0x0f9f, 0x0fa1, 0x0fa2, 0x0fa3, 0x0fa5, 0x0fa6,
+	0x0fa7, 0x0fa8, 0x0faa, 0x0fab, 0x0fac, 0x0fae, 0x0faf, 0x0fb0,
+	0x0fb1, 0x0fb3, 0x0fb4, 0x0fb5, 0x0fb6, 0x0fb7, 0x0fb8, 0x0fba,
+	0x0fbb, 0x0fbc, 0x0fbd, 0x0fbe, 0x0fbf, 0x0fc0, 0x0fc2, 0x0fc3,
+	0x0fc4, 0x0fc5, 0x0fc6, 0x0fc7, 0x0fc8, 0x0fc9, 0x0fca, 0x0fcb,
+	0x0fcc, 0x0fcd, 0x0fce, 0x0fcf, 0x0fd0, 0x0fd1, 0x0fd2, 0x0fd3,
+	0x0fd4, 0x0fd5, 0x0fd5, 0x0fd6, 0x0fd7, 0x0fd8, 0x0fd9, 0x0fda,
+	0x0fdb, 0x0fdc, 0x0fdc, 0x0fdd, 0x0fde, 0x0fdf, 0x0fe0, 0x0fe0,
+	0x0fe1, 0x0fe2, 0x0fe3, 0x0fe3, 0x0fe4, 0x0fe5, 0x0fe6, 0x0fe6,
+	0x0fe7, 0x0fe8, 0x0fe8, 0x0fe9, 0x0fea, 0x0fea, 0x0feb, 0x0fec,
+	0x0fec, 0x0fed, 0x0fed, 0x0fee, 0x0fef, 0x0fef, 0x0ff0, 0x0ff0,
+	0x0ff1, 0x0ff1, 0x0ff2, 0x0ff2, 0x0ff3, 0x0ff3, 0x0ff4, 0x0ff4,
+	0x0ff5, 0x0ff5, 0x0ff6, 0x0ff6, 0x0ff7, 0x0ff7, 0x0ff8, 0x0ff8,
+	0x0ff8, 0x0ff9, 0x0ff9, 0x0ff9, 0x0ffa, 0x0ffa, 0x0ffa, 0x0ffb,
+	0x0ffb, 0x0ffb, 0x0ffc, 0x0ffc, 0x0ffc, 0x0ffc, 0x0ffd, 0x0ffd,
+	0x0ffd, 0x0ffd, 0x0ffe, 0x0ffe, 0x0ffe, 0x0ffe, 0x0ffe, 0x0fff,
+	0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x0fff, 0x1000, 0x1000,
+	0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000,
+	0x1000,
+};
+
+/* theta is in 65536ths of a circle */
+static int sin16(int theta)
+{
+	int i = ((unsigned)theta >> 4) & 0xfff;
+	int q = i & 0x3ff;
+	switch (i >> 10) {
+	case 0: return sin_table[q];
+	case 1: return sin_table[0x400 - q];
+	case 2: return -sin_table[q];
+	default: return -sin_table[0x400 - q];
+	}
+}
+
+static int cos16(int theta)
+{
+	return sin16(theta + 0x4000);
+}
+
+/* Decode a frame's data. The cell index comes first whatever the type.
+ * Fail if the frame can't be drawn, i.e. it scales by zero. */
+static int
+decode_frame_data(int frame_type, const void *data, struct timeline_frame *out)
+{
+	out->cell_index = *(const u16 *)data;
+	out->m[0] = 0x100; out->m[1] = 0; out->m[2] = 0; out->m[3] = 0x100;
+	out->offset = (struct coords){0, 0};
+
+	switch (frame_type) {
+	case 1: {
+		const struct frame_data_1 *frame_data = data;
+		if (frame_data->x_mag == 0 || frame_data->y_mag == 0) {
+			return FAIL;
+		}
+
+		int sin_theta = sin16(frame_data->theta);
+		int cos_theta = cos16(frame_data->theta);
+
+		out->m[0] = 0x100 *  cos_theta / frame_data->x_mag;
+		out->m[1] = 0x100 * +sin_theta / frame_data->x_mag;
+		out->m[2] = 0x100 * -sin_theta / frame_data->y_mag;
+		out->m[3] = 0x100 *  cos_theta / frame_data->y_mag;
+
+		out->offset.x = frame_data->x;
+		out->offset.y = frame_data->y;
+		}; break;
+	case 2: {
+		const struct frame_data_2 *frame_data = data;
+		out->offset.x = frame_data->x;
+		out->offset.y = frame_data->y;
+		}; break;
+	}
+	return OKAY;
+}
+
+static size_t
+frame_data_size(int frame_type)
+{
+	switch (frame_type) {
+	case 1: return sizeof(struct frame_data_1);
+	case 2: return sizeof(struct frame_data_2);
+	}
+	return sizeof(struct frame_data_0);
+}
+
+/* Is [p, p+size) inside the data? */
+static bool
+in_bounds(const u8 *data, size_t data_size, const void *p, size_t size)
+{
+	const u8 *q = p;
+	return data <= q && q <= data + data_size &&
+	       size <= (size_t)(data + data_size - q);
+}
+
+/* Lay out the frames of every acell. An acell whose frames don't fit in
+ * the data, or can't be decoded, gets no frames at all, so drawing it
+ * fails rather than reading garbage. */
+static int
+abnk_build_timelines(struct ABNK *self, const u8 *data, size_t data_size)
+{
+	const int acell_count = self->header.acell_count;
+	if (!in_bounds(data, data_size, self->acells, acell_count * sizeof(struct acell))) {
+		return FAIL;
+	}
+
+	size_t total = 0;
+	for (int i = 0; i < acell_count; i++) {
+		struct acell *acell = &self->acells[i];
+		const u8 *frames = (const u8 *)self->frames + acell->frame_offset;
+		if (acell->frame_count <= data_size / sizeof(struct frame) &&
+		    in_bounds(data, data_size, frames, acell->frame_count * sizeof(struct frame))) {
+			total += acell->frame_count;
+		}
+	}
+
+	if (CALLOC(self->timelines, acell_count ? acell_count : 1) == NULL ||
+	    CALLOC(self->timeline_frames, total ? total : 1) == NULL) {
+		FREE(self->timelines);
+		return NOMEM;
+	}
+
+	struct timeline_frame *out = self->timeline_frames;
+	for (int i = 0; i < acell_count; i++) {
+		struct acell *acell = &self->acells[i];
+		struct timeline *timeline = &self->timelines[i];
+		struct frame *frames = (void *)((u8 *)self->frames + acell->frame_offset);
+		if (!(acell->frame_count <= data_size / sizeof(struct frame) &&
+		      in_bounds(data, data_size, frames, acell->frame_count * sizeof(struct frame)))) {
+			continue;
+		}
+
+		const size_t size = frame_data_size(acell->frame_type);
+		u32 tick = 0;
+		u32 run_start = 0;
+		int prev_cell = -1;
+		for (u32 j = 0; j < acell->frame_count; j++) {
+			const u8 *frame_data = self->frame_data + frames[j].data_offset;
+			if (!in_bounds(data, data_size, frame_data, size) ||
+			    decode_frame_data(acell->frame_type, frame_data, &out[j]) != OKAY) {
+				break;
+			}
+			if (out[j].cell_index != prev_cell) {
+				run_start = tick;
+			}
+			out[j].start = tick;
+			out[j].run_start = run_start;
+			prev_cell = out[j].cell_index;
+			tick += frames[j].frame_duration;
+			timeline->frame_count = j + 1;
+		}
+		if (timeline->frame_count == acell->frame_count) {
+			timeline->frames = out;
+			timeline->period = tick;
+			out += acell->frame_count;
+		} else {
+			timeline->frame_count = 0;
+		}
+	}
+
+	return OKAY;
+}
+
+static void
+abnk_free(struct ABNK *self)
+{
+	FREE(self->data);
+	FREE(self->timelines);
+	FREE(self->timeline_frames);
+}
+
+/* Find the frame showing at a tick, which must be less than the period. */
+static u32
+timeline_find(const struct timeline *timeline, u32 tick)
+{
+	// the last frame starting at or before tick. frames which last no
+	// time at all start at the same tick as the one after them, and so
+	// are never found
+	u32 lo = 0;
+	u32 hi = timeline->frame_count;
+	while (hi - lo > 1) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (timeline->frames[mid].start <= tick) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static const struct timeline_frame *
+get_frame_data(struct ABNK *abnk, int acell_index, int frame_index)
+{
+	const struct timeline *timeline = &abnk->timelines[acell_index];
+	if (!(0 <= frame_index && (u32)frame_index < timeline->frame_count)) {
+		return NULL;
+	}
+	return &timeline->frames[frame_index];
+}
+
+/* NANR and NMAR headers look the same, so they share a probe */
+static int
+abnk_probe(const u8 *data, size_t size, struct nitro_probe *info)
+{
+	struct nitro header;
+	struct ABNK tmp;
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &header, 1) || CREAD(&c, &tmp.header, 1)) {
+		return FAIL;
+	}
+
+	info->cell_count = tmp.header.acell_count;
 	return OKAY;
 }
 
@@ -150,13 +531,29 @@ nanr_read(void *buf, FILE *fp)
 	return abnk_read(&self->abnk, fp);
 }
 
+static int
+nanr_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NANR *self = buf;
+	assert(self != NULL);
+
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1)) {
+		return FAIL;
+	}
+	assert(self->header.magic == NANR_MAGIC);
+
+	return abnk_read_mem(&self->abnk, &c);
+}
+
 static void
 nanr_free(void *buf)
 {
 	struct NANR *self = buf;
 	if (self != NULL &&
 	    self->header.magic == NANR_MAGIC) {
-		FREE(self->abnk.data);
+		abnk_free(&self->abnk);
 	}
 }
 
@@ -164,7 +561,9 @@ struct format_info NANR_format = {
 	format_header(NANR_MAGIC, struct NANR),
 
 	.read = nanr_read,
+	.read_mem = nanr_read_mem,
 	.free = nanr_free,
+	.probe = abnk_probe,
 };
 
 
@@ -187,13 +586,29 @@ nmar_read(void *buf, FILE *fp)
 	return abnk_read(&self->abnk, fp);
 }
 
+static int
+nmar_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NMAR *self = buf;
+	assert(self != NULL);
+
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1)) {
+		return FAIL;
+	}
+	assert(self->header.magic == NMAR_MAGIC);
+
+	return abnk_read_mem(&self->abnk, &c);
+}
+
 static void
 nmar_free(void *buf)
 {
 	struct NMAR *self = buf;
 	if (self != NULL &&
 	    self->header.magic == NMAR_MAGIC) {
-		FREE(self->abnk.data);
+		abnk_free(&self->abnk);
 	}
 }
 
@@ -201,69 +616,14 @@ struct format_info NMAR_format = {
 	format_header(NMAR_MAGIC, struct NMAR),
 
 	.read = nmar_read,
+	.read_mem = nmar_read_mem,
 	.free = nmar_free,
+	.probe = abnk_probe,
 };
 
 
 /* Methods */
 
-static int sin16(int theta)
-{
-	return (int)(sin(theta * (2*M_PI) / 0x10000) * 0x1000);
-}
-
-static int cos16(int theta)
-{
-	return (int)(cos(theta * (2*M_PI) / 0x10000) * 0x1000);
-}
-
-static int
-get_frame_data(struct ABNK *abnk, struct acell *acell, int frame_index,
-               int *cell_index, fx16 m[], struct coords *offset)
-{
-	if (!(0 <= frame_index && frame_index < acell->frame_count)) {
-		return FAIL;
-	}
-
-	struct frame *frames = (struct frame *)((u8 *)abnk->frames + acell->frame_offset);
-	struct frame *frame = &frames[frame_index];
-
-	void *data = (abnk->frame_data + frame->data_offset);
-
-	switch (acell->frame_type) {
-	case 0: {
-		struct frame_data_0 *frame_data = data;
-		*cell_index = frame_data->cell_index;
-		m[0] = 0x100; m[1] = 0; m[2] = 0; m[3] = 0x100;
-		*offset = (struct coords){0, 0};
-		}; break;
-	case 1: {
-		struct frame_data_1 *frame_data = data;
-		*cell_index = frame_data->cell_index;
-
-		int sin_theta = sin16(frame_data->theta);
-		int cos_theta = cos16(frame_data->theta);
-
-		m[0] = 0x100 *  cos_theta / frame_data->x_mag;
-		m[1] = 0x100 * +sin_theta / frame_data->x_mag;
-		m[2] = 0x100 * -sin_theta / frame_data->y_mag;
-		m[3] = 0x100 *  cos_theta / frame_data->y_mag;
-
-		offset->x = frame_data->x;
-		offset->y = frame_data->y;
-		}; break;
-	case 2: {
-		struct frame_data_2 *frame_data = data;
-		*cell_index = frame_data->cell_index;
-		m[0] = 0x100; m[1] = 0; m[2] = 0; m[3] = 0x100;
-		offset->x = frame_data->x;
-		offset->y = frame_data->y;
-		}; break;
-	}
-
-	return OKAY;
-}
-
 int
 nanr_draw_frame(struct NANR *self, int acell_index, int frame_index,
                 struct NCER *ncer, struct NCGR *ncgr,
@@ -282,19 +642,16 @@ nanr_draw_frame(struct NANR *self, int acell_index, int frame_index,
 		return FAIL;
 	}
 
-	struct acell *acell = &abnk->acells[acell_index];
-
-	int cell_index;
-	fx16 m[4];
-	struct coords cell_offset;
-	if (get_frame_data(&self->abnk, acell, frame_index,
-	                   &cell_index, m, &cell_offset)) {
+	const struct timeline_frame *frame = get_frame_data(abnk, acell_index, frame_index);
+	if (frame == NULL) {
 		return FAIL;
 	}
 
+	fx16 m[4] = {frame->m[0], frame->m[1], frame->m[2], frame->m[3]};
+	struct coords cell_offset = frame->offset;
 	cell_offset.x += frame_offset.x;
 	cell_offset.y += frame_offset.y;
-	return ncer_draw_cell_t(ncer, cell_index, ncgr, image, cell_offset, m);
+	return ncer_draw_cell_t(ncer, frame->cell_index, ncgr, image, cell_offset, m);
 }
 
 int
@@ -330,37 +687,12 @@ nanr_get_frame_at_tick(struct NANR *self, int acell_index, u16 tick)
 		return -1;
 	}
 
-	struct acell *acell = &self->abnk.acells[acell_index];
-
-	struct frame *frames = (struct frame *)((u8 *)self->abnk.frames + acell->frame_offset);
-
-	u16 total = 0;
-	for (int i = 0; i < acell->frame_count; i++) {
-		struct frame *frame = &frames[i];
-
-		if (tick < frame->frame_duration) {
-			return i;
-		} else {
-			tick -= frame->frame_duration;
-			total += frame->frame_duration;
-		}
-	}
-
-	if (total == 0) {
+	const struct timeline *timeline = &self->abnk.timelines[acell_index];
+	if (timeline->period == 0) {
 		return 0;
 	}
 
-	tick = tick % total;
-
-	for (int i = 0; ; i++) {
-		struct frame *frame = &frames[i];
-		if (tick < frame->frame_duration) {
-			return i;
-		} else {
-			tick -= frame->frame_duration;
-		}
-	}
-	return 0;
+	return timeline_find(timeline, tick % timeline->period);
 }
 
 int
@@ -378,20 +710,56 @@ nmar_get_period(struct NMAR *self, int acell_index)
 	assert(self != NULL);
 	assert(self->header.magic == NMAR_MAGIC);
 
-	int period = 0;
-
 	if (!(0 <= acell_index && acell_index < self->abnk.header.acell_count)) {
 		return -1;
 	}
 
-	struct acell *acell = &self->abnk.acells[acell_index];
-	struct frame *frames = (void *)self->abnk.frames + acell->frame_offset;
+	return self->abnk.timelines[acell_index].period;
+}
+
+static int
+gcd(int a, int b)
+{
+	while (b != 0) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* gcd of step and the durations of the frames of an animation */
+static int
+timeline_step(const struct timeline *timeline, int step)
+{
+	for (u32 i = 0; i < timeline->frame_count; i++) {
+		u32 end = i + 1 < timeline->frame_count ? timeline->frames[i + 1].start
+		                                        : timeline->period;
+		step = gcd(step, end - timeline->frames[i].start);
+	}
+	return step;
+}
+
+/* Return the most ticks an animation can be stepped by without missing
+ * anything: all of its frames, and all of the frames of the cell
+ * animations in nanr it might play, last a multiple of this. */
+int
+nmar_get_step(struct NMAR *self, int acell_index, struct NANR *nanr)
+{
+	assert(self != NULL);
+	assert(self->header.magic == NMAR_MAGIC);
+	assert(nanr != NULL);
+	assert(nanr->header.magic == NANR_MAGIC);
 
-	for (int i = 0; i < acell->frame_count; i++) {
-		period += frames[i].frame_duration;
+	if (!(0 <= acell_index && acell_index < self->abnk.header.acell_count)) {
+		return -1;
 	}
 
-	return period;
+	int step = timeline_step(&self->abnk.timelines[acell_index], 0);
+	for (int i = 0; i < nanr->abnk.header.acell_count; i++) {
+		step = timeline_step(&nanr->abnk.timelines[i], step);
+	}
+	return step > 0 ? step : 1;
 }
 
 int
@@ -411,19 +779,16 @@ nmar_draw_frame(struct NMAR *self, int acell_index, int frame_index, int tick,
 		return FAIL;
 	}
 
-	struct acell *acell = &self->abnk.acells[acell_index];
-
-	int cell_index;
-	fx16 m[4];
-	struct coords o;
-	if (get_frame_data(&self->abnk, acell, frame_index, &cell_index, m, &o)) {
+	const struct timeline_frame *frame = get_frame_data(&self->abnk, acell_index, frame_index);
+	if (frame == NULL) {
 		return FAIL;
 	}
 
+	struct coords o = frame->offset;
 	o.x += offset.x;
 	o.y += offset.y;
 
-	return nmcr_draw(nmcr, cell_index, tick, nanr, ncer, ncgr, image, o);
+	return nmcr_draw(nmcr, frame->cell_index, tick, nanr, ncer, ncgr, image, o);
 }
 
 int
@@ -443,26 +808,178 @@ nmar_draw(struct NMAR *self, int acell_index, int tick,
 		return FAIL;
 	}
 
-	//warn("%d %d", acell_index, tick);
-	struct acell *acell = &self->abnk.acells[acell_index];
-	struct frame *frames = (void *)self->abnk.frames + acell->frame_offset;
+	// the cell's own animation runs from the start of the run of frames
+	// showing it
+	const struct timeline *timeline = &self->abnk.timelines[acell_index];
+	if (!(0 <= tick && (u32)tick < timeline->period)) {
+		return FAIL;
+	}
+	u32 i = timeline_find(timeline, tick);
+	return nmar_draw_frame(self, acell_index, i, tick - timeline->frames[i].run_start,
+	                       nmcr, nanr, ncer, ncgr, image, offset);
+}
+
+/* Draw every step'th tick of an animation, until it loops, and hand each
+ * frame to sink. All the frames are drawn into the same image. */
+int
+nmar_render_animation(struct NMAR *self, int acell_index, int step,
+                      struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
+                      struct NCLR *nclr, struct dim dim, struct coords offset,
+                      nmar_frame_sink *sink, void *ctx)
+{
+	assert(self != NULL);
+	assert(self->header.magic == NMAR_MAGIC);
+	assert(nclr != NULL);
+	assert(sink != NULL);
+	assert(step > 0);
+
+	const int period = nmar_get_period(self, acell_index);
+	if (period < 0) {
+		return FAIL;
+	}
+
+	struct image image = {.dim = dim};
+	image.pixels = buffer_alloc(dim.width * dim.height);
+	image.palette = nclr_get_palette(nclr, 0);
+
+	int status = OKAY;
+	if (image.pixels == NULL || image.palette == NULL) {
+		status = NOMEM;
+		goto cleanup;
+	}
+
+	for (int tick = 0; tick < period; tick += step) {
+		memset(image.pixels->data, 0, image.pixels->size);
+		if (nmar_draw(self, acell_index, tick, nmcr, nanr, ncer, ncgr, &image, offset)) {
+			status = FAIL;
+			break;
+		}
+		if (sink(ctx, &image, tick)) {
+			status = ABORT;
+			break;
+		}
+	}
+
+	cleanup:
+	FREE(image.pixels);
+	if (image.palette != NULL) {
+		FREE(image.palette->colors);
+		FREE(image.palette);
+	}
+	return status;
+}
+
+/* gifs get a frame every 6 ticks - 10 centiseconds - which is as fine as
+ * browsers will show them. apngs can have any delay, at 60 ticks per
+ * second, so they get a frame every time anything might change, and
+ * identical frames are merged; that way each frame lasts exactly its
+ * frame_duration. */
+struct anim_sinks {
+	void **files; // struct GifFileType or struct image_apng
+	size_t count;
+	enum nmar_format format;
+	int delay;
+};
+
+static int
+anim_sink(void *ctx, struct image *frame, int tick)
+{
+	struct anim_sinks *sinks = ctx;
+	(void)tick;
+	for (size_t i = 0; i < sinks->count; i++) {
+		int status;
+		if (sinks->format == NMAR_APNG) {
+			status = image_apng_add_frame(frame, sinks->files[i], sinks->delay);
+		} else {
+			status = image_gif_add_frame(frame, sinks->files[i], sinks->delay);
+		}
+		if (status) {
+			return FAIL;
+		}
+	}
+	return OKAY;
+}
+
+/* Save an animation as a gif with a frame every 6 ticks */
+int
+nmar_save_gif(struct NMAR *self, int acell_index,
+              struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
+              struct NCLR *nclr, struct dim dim, struct coords offset,
+              const char *filename)
+{
+	return nmar_save_animations(self, acell_index, nmcr, nanr, ncer, ncgr,
+	                            &nclr, dim, offset, NMAR_GIF, &filename, 1);
+}
+
+/* Save an animation as n gifs or apngs, one with each palette. The frames
+ * only differ in their colors, so each is drawn once and added to all of
+ * the files. */
+int
+nmar_save_animations(struct NMAR *self, int acell_index,
+                     struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
+                     struct NCLR *const nclrs[], struct dim dim, struct coords offset,
+                     enum nmar_format format, const char *const filenames[], int n)
+{
+	assert(n > 0);
 
-	u32 frame_tick = 0;
-	u32 prev_index = -1;
-	for (u16 i = 0; i < acell->frame_count; i++) {
-		u32 duration = frames[i].frame_duration;
-		u32 cell_index = *(u16*)(self->abnk.frame_data + frames[i].data_offset);
-		if (cell_index != prev_index) {
-			frame_tick = 0;
+	struct anim_sinks sinks = {.count = 0, .format = format};
+	if (CALLOC(sinks.files, n) == NULL) {
+		return NOMEM;
+	}
+
+	int step = 6;
+	sinks.delay = 10;
+	if (format == NMAR_APNG) {
+		step = nmar_get_step(self, acell_index, nanr);
+		if (step < 0) {
+			FREE(sinks.files);
+			return FAIL;
+		}
+		sinks.delay = step;
+	}
+
+	int status = OKAY;
+	for (int i = 0; i < n; i++) {
+		// the writers only need the size and palette
+		struct image image = {.dim = dim};
+		image.palette = nclr_get_palette(nclrs[i], 0);
+		if (image.palette == NULL) {
+			status = NOMEM;
+			goto cleanup;
+		}
+
+		if (format == NMAR_APNG) {
+			sinks.files[i] = image_apng_new(&image, filenames[i], 60);
+		} else {
+			sinks.files[i] = image_gif_new(&image, filenames[i]);
+		}
+
+		FREE(image.palette->colors);
+		FREE(image.palette);
+
+		if (sinks.files[i] == NULL) {
+			status = FAIL;
+			goto cleanup;
+		}
+		sinks.count++;
+	}
+
+	status = nmar_render_animation(self, acell_index, step,
+	                               nmcr, nanr, ncer, ncgr, nclrs[0], dim, offset,
+	                               anim_sink, &sinks);
+
+	cleanup:
+	for (size_t i = 0; i < sinks.count; i++) {
+		int err;
+		if (format == NMAR_APNG) {
+			err = image_apng_close(sinks.files[i]);
+		} else {
+			err = image_gif_close(sinks.files[i]);
 		}
-		//warn("frame %d: duration %d index %d", i, duration, *(u16*)((void *)self->abnk.frame_data + frames[i].data_offset));
-		if (tick < duration) {
-			return nmar_draw_frame(self, acell_index, i, frame_tick + tick,
-			                       nmcr, nanr, ncer, ncgr, image, offset);
+		if (err && status == OKAY) {
+			status = FAIL;
 		}
-		tick -= duration;
-		frame_tick += duration;
-		prev_index = cell_index;
 	}
-	return FAIL;
+	FREE(sinks.files);
+	return status;
 }
@@ -6,14 +6,28 @@
  * and comes with NO WARRANTY. See rip.c for details.
  */
 
-#include <stdlib.h> /* NULL */
-#include <stdio.h> /* FILE, SEEK_CUR, SEEK_SET, off_t, feof, ferror, fseeko, ftello */
+#include <stdlib.h> /* NULL, size_t, malloc, qsort */
+#include <stdbool.h> /* bool, true, false */
+#include <stdint.h> /* uintptr_t */
+#include <stdio.h> /* FILE, SEEK_CUR, SEEK_SET, off_t, feof, ferror, fileno, fread, fseeko, ftello */
+#include <string.h> /* memcpy */
+#include <errno.h> /* EINTR, errno */
+#include <pthread.h> /* pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock */
 
-#include "nitro.h" /* struct format_info, struct nitro, magic_t, format_header, nitro_read */
-#include "common.h" /* OKAY, FAIL, NOMEM, assert, FREAD, CALLOC, FREE, u32 */
+#ifndef _WIN32
+# include <sys/mman.h> /* MAP_FAILED, MAP_PRIVATE, PROT_READ, mmap, munmap */
+# include <sys/stat.h> /* struct stat, fstat */
+# include <unistd.h> /* pread, ssize_t */
+#endif
+
+#include "nitro.h" /* struct format_info, struct nitro, struct nitro_probe, magic_t, format_header, format_lookup, nitro_free, nitro_get_magic, nitro_probe, nitro_read, nitro_read_buffer, nitro_read_buffer_copy */
+#include "common.h" /* OKAY, FAIL, NOMEM, assert, FREAD, ALLOC, CALLOC, FREE, warn, struct buffer, buffer_alloc, hash_bytes, u8, u32, u64 */
+#include "lzss.h" /* struct lzss_stream, lzss_check_data, lzss_stream_* */
 
 #include "narc.h"
 
+static bool cache_forget(struct NARC *narc);
+
 /* NARC */
 struct FATB {
 	struct {
@@ -51,6 +65,12 @@ struct NARC {
 
 	/* offset to the beginning of the FIMG data */
 	off_t data_offset;
+
+	/* The whole archive, if it has been mapped into memory with
+	 * narc_map() or read from memory, or NULL. We only own the
+	 * mapping if there's a file pointer. */
+	const u8 *map;
+	size_t map_size;
 };
 
 static int
@@ -112,6 +132,62 @@ narc_read(void *buf, FILE *fp)
 	return OKAY;
 }
 
+static int
+narc_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NARC *self = buf;
+	assert(self != NULL);
+
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1)) {
+		return FAIL;
+	}
+
+	assert(self->header.chunk_count == 3);
+
+	/* read the FATB chunk */
+	if (CREAD(&c, &self->fatb.header, 1)) {
+		return FAIL;
+	}
+	assert(self->fatb.header.magic == (magic_t)'FATB');
+
+	CALLOC(self->fatb.records, self->fatb.header.file_count);
+
+	if (self->fatb.records == NULL) {
+		return NOMEM;
+	}
+
+	if (CREAD(&c, self->fatb.records, self->fatb.header.file_count)) {
+		return FAIL;
+	}
+
+	/* skip the FNTB chunk */
+	if (CREAD(&c, &self->fntb.header, 1)) {
+		return FAIL;
+	}
+	assert(self->fntb.header.magic == (magic_t)'FNTB');
+	if (cursor_borrow(&c, self->fntb.header.size - sizeof(self->fntb.header)) == NULL) {
+		return FAIL;
+	}
+
+	/* set the data offset */
+	struct { magic_t magic; u32 size; } fimg_header;
+
+	if (CREAD(&c, &fimg_header, 1)) {
+		return FAIL;
+	}
+	assert(fimg_header.magic == (magic_t)'FIMG');
+
+	/* the files are loaded lazily out of the data, just as if it were
+	 * a mapped file */
+	self->data_offset = c.pos;
+	self->map = data;
+	self->map_size = size;
+
+	return OKAY;
+}
+
 static void
 narc_free(void *buf)
 {
@@ -119,10 +195,58 @@ narc_free(void *buf)
 
 	if (self != NULL &&
 	    self->header.magic == (magic_t)'CRAN') {
+		bool map_held = cache_forget(self);
 		FREE(self->fatb.records);
+#ifndef _WIN32
+		if (self->map != NULL && self->fp != NULL && !map_held) {
+			munmap((void *)self->map, self->map_size);
+		}
+#endif
+		self->map = NULL;
 	}
 }
 
+/* Map the whole archive into memory. Afterwards, files are parsed
+ * straight out of the mapping instead of being read through the file
+ * pointer, and narc_get_file_view() can be used to look at their raw
+ * bytes. Files loaded from a mapped NARC may borrow its memory, so
+ * they must be freed before the NARC is - except for files from the
+ * cache, which keep the mapping alive until they're released. Mapping
+ * is optional; on failure the NARC keeps working as before. */
+int
+narc_map(struct NARC *self)
+{
+	assert(self != NULL);
+
+#ifndef _WIN32
+	if (self->map != NULL) {
+		return OKAY;
+	}
+	assert(self->fp != NULL);
+
+	int fd = fileno(self->fp);
+	if (fd == -1) {
+		return FAIL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= self->data_offset) {
+		return FAIL;
+	}
+
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return FAIL;
+	}
+
+	self->map = map;
+	self->map_size = (size_t)st.st_size;
+	return OKAY;
+#else
+	return FAIL;
+#endif
+}
+
 u32
 narc_get_file_count(struct NARC *self)
 {
@@ -134,7 +258,7 @@ u32
 narc_get_file_size(struct NARC *self, int index)
 {
 	assert(self != NULL);
-	assert(self->fp != NULL);
+	assert(self->fp != NULL || self->map != NULL);
 
 	assert(0 <= index && index < (signed long)self->fatb.header.file_count);
 
@@ -146,11 +270,147 @@ narc_get_file_size(struct NARC *self, int index)
 	return chunk_size;
 }
 
+/* Point data at the raw bytes of a file inside a mapped NARC.
+ * The view stays valid until the NARC is freed. Fails if the NARC
+ * hasn't been mapped. */
+int
+narc_get_file_view(struct NARC *self, int index, const u8 **data, size_t *size)
+{
+	assert(self != NULL);
+	assert(data != NULL);
+	assert(size != NULL);
+
+	assert(0 <= index && index < (signed long)self->fatb.header.file_count);
+
+	if (self->map == NULL) {
+		return FAIL;
+	}
+
+	struct fatb_record record = self->fatb.records[index];
+
+	assert(record.start <= record.end);
+	size_t start = (size_t)self->data_offset + record.start;
+	size_t end = (size_t)self->data_offset + record.end;
+
+	if (self->map_size < end) {
+		warn("NARC: file %d extends past the end of the archive", index);
+		return FAIL;
+	}
+
+	*data = self->map + start;
+	*size = end - start;
+	return OKAY;
+}
+
+/* Loading files
+
+Loading files is reentrant: any number of threads may load files from
+the same NARC at once, as long as nothing frees it meanwhile. Mapped
+NARCs are only ever read from memory; unmapped ones are read with
+pread(), which doesn't use or move the file position. (On Windows there
+is no pread(), so unmapped NARCs go through the file pointer and must
+be used by one thread at a time.) */
+
+#ifndef _WIN32
+/* read exactly size bytes at offset */
+static int
+pread_all(int fd, u8 *buf, size_t size, off_t offset)
+{
+	while (size > 0) {
+		ssize_t n = pread(fd, buf, size, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return FAIL;
+		}
+		buf += n;
+		size -= n;
+		offset += n;
+	}
+	return OKAY;
+}
+#endif
+
+/* how much of the archive narc_get_hash hashes at a time */
+#define HASH_CHUNK_SIZE 0x10000
+
+/* Hash the bytes of the whole archive, so that it can be recognized
+ * again later - e.g. in the next run. */
+int
+narc_get_hash(struct NARC *self, u64 *hash)
+{
+	assert(self != NULL);
+	assert(hash != NULL);
+
+	u64 h = 0;
+	if (self->map != NULL) {
+		for (size_t pos = 0; pos < self->map_size; pos += HASH_CHUNK_SIZE) {
+			size_t n = self->map_size - pos;
+			if (n > HASH_CHUNK_SIZE) {
+				n = HASH_CHUNK_SIZE;
+			}
+			h = hash_bytes(self->map + pos, n, h);
+		}
+		*hash = h;
+		return OKAY;
+	}
+
+	assert(self->fp != NULL);
+
+	u8 *buf = malloc(HASH_CHUNK_SIZE);
+	if (buf == NULL) {
+		return NOMEM;
+	}
+
+	int status = OKAY;
+#ifndef _WIN32
+	// read with pread_all, like the files are, so that hashing doesn't
+	// disturb anyone loading files at the same time
+	int fd = fileno(self->fp);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st)) {
+		status = FAIL;
+	}
+	for (off_t pos = 0; status == OKAY && pos < st.st_size; pos += HASH_CHUNK_SIZE) {
+		size_t n = HASH_CHUNK_SIZE;
+		if (st.st_size - pos < HASH_CHUNK_SIZE) {
+			n = st.st_size - pos;
+		}
+		if (pread_all(fd, buf, n, pos)) {
+			status = FAIL;
+		} else {
+			h = hash_bytes(buf, n, h);
+		}
+	}
+#else
+	if (fseeko(self->fp, 0, SEEK_SET)) {
+		status = FAIL;
+	}
+	while (status == OKAY) {
+		size_t n = fread(buf, 1, HASH_CHUNK_SIZE, self->fp);
+		if (n > 0) {
+			h = hash_bytes(buf, n, h);
+		}
+		if (n < HASH_CHUNK_SIZE) {
+			if (ferror(self->fp)) {
+				status = FAIL;
+			}
+			break;
+		}
+	}
+#endif
+
+	FREE(buf);
+	*hash = h;
+	return status;
+}
+
 void *
 narc_load_file(struct NARC *self, int index)
 {
 	assert(self != NULL);
-	assert(self->fp != NULL);
+	assert(self->fp != NULL || self->map != NULL);
 
 	assert(0 <= index && index < (signed long)self->fatb.header.file_count);
 
@@ -163,6 +423,20 @@ narc_load_file(struct NARC *self, int index)
 		return NULL;
 	}
 
+	if (self->map != NULL) {
+		const u8 *data;
+		size_t size;
+		if (narc_get_file_view(self, index, &data, &size)) {
+			return NULL;
+		}
+		return nitro_read_buffer(data, size);
+	}
+
+#ifndef _WIN32
+	void *file = NULL;
+	narc_load_files(self, &index, 1, &file);
+	return file;
+#else
 	fseeko(self->fp, self->data_offset + record.start, SEEK_SET);
 
 	if (ferror(self->fp)) {
@@ -170,6 +444,623 @@ narc_load_file(struct NARC *self, int index)
 	}
 
 	return nitro_read(self->fp, chunk_size);
+#endif
+}
+
+/* read size bytes of a file's raw data, starting offset bytes in */
+static int
+read_raw(struct NARC *self, struct fatb_record record, u32 offset, u8 *buf, size_t size)
+{
+	assert(offset + size <= record.end - record.start);
+
+	if (self->map != NULL) {
+		size_t start = (size_t)self->data_offset + record.start + offset;
+		if (self->map_size < start + size) {
+			return FAIL;
+		}
+		memcpy(buf, self->map + start, size);
+		return OKAY;
+	}
+
+#ifndef _WIN32
+	return pread_all(fileno(self->fp), buf, size,
+	                 self->data_offset + record.start + offset);
+#else
+	fseeko(self->fp, self->data_offset + record.start + offset, SEEK_SET);
+	if (fread(buf, 1, size, self->fp) != size) {
+		return FAIL;
+	}
+	return OKAY;
+#endif
+}
+
+/* how much compressed data narc_peek_file reads at a time */
+#define PEEK_CHUNK_SIZE 256
+
+/* Copy the first size bytes of a file into buf, decompressing them if
+ * need be, without loading the rest of it. *n is set to the number of
+ * bytes copied, which is less than size if the file is shorter. */
+int
+narc_peek_file(struct NARC *self, int index, u8 *buf, size_t size, size_t *n)
+{
+	assert(self != NULL);
+	assert(self->fp != NULL || self->map != NULL);
+	assert(buf != NULL || size == 0);
+	assert(n != NULL);
+
+	assert(0 <= index && index < (signed long)self->fatb.header.file_count);
+
+	struct fatb_record record = self->fatb.records[index];
+
+	assert(record.start <= record.end);
+	u32 chunk_size = record.end - record.start;
+
+	u8 raw[PEEK_CHUNK_SIZE];
+	u32 raw_size = chunk_size < sizeof raw ? chunk_size : sizeof raw;
+
+	*n = 0;
+	if (read_raw(self, record, 0, raw, raw_size)) {
+		return FAIL;
+	}
+
+	if (raw_size < 4 || (raw[0] != 0x10 && raw[0] != 0x11)) {
+		// not compressed
+		*n = size < chunk_size ? size : chunk_size;
+		if (*n > raw_size) {
+			return read_raw(self, record, 0, buf, *n);
+		}
+		memcpy(buf, raw, *n);
+		return OKAY;
+	}
+
+	if (!lzss_check_data(raw, chunk_size)) {
+		// no idea what the file is -- bail
+		return FAIL;
+	}
+
+	struct lzss_stream *stream;
+	if (ALLOC(stream) == NULL) {
+		return NOMEM;
+	}
+	lzss_stream_init(stream);
+
+	int status = OKAY;
+	u32 offset = 0;
+	for (;;) {
+		size_t m;
+		lzss_stream_feed(stream, raw, raw_size);
+		offset += raw_size;
+		if (lzss_stream_drain(stream, buf + *n, size - *n, &m)) {
+			status = FAIL;
+			break;
+		}
+		*n += m;
+		if (*n == size || lzss_stream_done(stream)) {
+			break;
+		}
+		if (offset == chunk_size) {
+			// ran out of data
+			status = FAIL;
+			break;
+		}
+
+		raw_size = chunk_size - offset < sizeof raw ? chunk_size - offset : sizeof raw;
+		if (read_raw(self, record, offset, raw, raw_size)) {
+			status = FAIL;
+			break;
+		}
+	}
+
+	FREE(stream);
+	return status;
+}
+
+/* Get the magic number of a file, decompressing only as much as it takes
+ * to find it. */
+int
+narc_get_file_magic(struct NARC *self, int index, magic_t *magic)
+{
+	assert(magic != NULL);
+
+	u8 buf[sizeof(magic_t)];
+	size_t n;
+	if (narc_peek_file(self, index, buf, sizeof buf, &n)) {
+		return FAIL;
+	}
+	if (n < sizeof buf) {
+		return FAIL;
+	}
+
+	memcpy(magic, buf, sizeof buf);
+	return OKAY;
+}
+
+/* Find out what a file is and how big it is, reading only the first
+ * few bytes of it. An empty file gets a magic of 0. */
+int
+narc_probe(struct NARC *self, int index, struct nitro_probe *info)
+{
+	assert(self != NULL);
+	assert(info != NULL);
+
+	assert(0 <= index && index < (signed long)self->fatb.header.file_count);
+
+	struct fatb_record record = self->fatb.records[index];
+
+	assert(record.start <= record.end);
+	u32 chunk_size = record.end - record.start;
+
+	*info = (struct nitro_probe){
+		.size = chunk_size,
+		.uncompressed_size = chunk_size,
+		.compression = -1,
+	};
+	if (chunk_size == 0) {
+		return OKAY;
+	}
+
+	u8 buf[NITRO_PROBE_SIZE];
+	size_t n = chunk_size < 4 ? chunk_size : 4;
+	if (read_raw(self, record, 0, buf, n)) {
+		return FAIL;
+	}
+	if (n == 4 && lzss_check_data(buf, chunk_size)) {
+		info->compression = (buf[0] == 0x11) ? LZSS11 : LZSS10;
+		info->uncompressed_size = buf[1] | buf[2] << 8 | buf[3] << 16;
+	}
+
+	if (narc_peek_file(self, index, buf, sizeof buf, &n)) {
+		return FAIL;
+	}
+	return nitro_probe(buf, n, info);
+}
+
+/* files closer together than this are read in one go */
+#define MAX_READ_GAP 512
+
+struct load_request {
+	u32 start;
+	u32 end;
+	size_t i;
+};
+
+static int
+compare_requests(const void *a, const void *b)
+{
+	const struct load_request *ra = a;
+	const struct load_request *rb = b;
+	if (ra->start != rb->start) {
+		return ra->start < rb->start ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Load n files at once: out[i] is set to the file at indices[i], or NULL
+ * if it is empty or couldn't be loaded. The reads are sorted by offset,
+ * and files that are next to each other in the archive are read with a
+ * single call. Returns FAIL if any non-empty file failed to load. */
+int
+narc_load_files(struct NARC *self, const int *indices, size_t n, void **out)
+{
+	assert(self != NULL);
+	assert(self->fp != NULL || self->map != NULL);
+	assert(indices != NULL || n == 0);
+	assert(out != NULL || n == 0);
+
+	int status = OKAY;
+
+#ifndef _WIN32
+	if (self->map == NULL) {
+		struct load_request *requests;
+		if (CALLOC(requests, n ? n : 1) == NULL) {
+			return NOMEM;
+		}
+
+		size_t count = 0;
+		for (size_t i = 0; i < n; i++) {
+			int index = indices[i];
+			assert(0 <= index && index < (signed long)self->fatb.header.file_count);
+
+			struct fatb_record record = self->fatb.records[index];
+			assert(record.start <= record.end);
+
+			out[i] = NULL;
+			if (record.end - record.start > 4) {
+				requests[count++] = (struct load_request){record.start, record.end, i};
+			}
+		}
+
+		qsort(requests, count, sizeof(*requests), compare_requests);
+
+		int fd = fileno(self->fp);
+		for (size_t k = 0; k < count;) {
+			/* find a run of files close enough to read at once */
+			u32 start = requests[k].start;
+			u32 end = requests[k].end;
+			size_t last = k + 1;
+			while (last < count && requests[last].start <= end + MAX_READ_GAP) {
+				if (end < requests[last].end) {
+					end = requests[last].end;
+				}
+				last++;
+			}
+
+			struct buffer *buffer = buffer_alloc(end - start);
+			if (buffer == NULL ||
+			    pread_all(fd, buffer->data, buffer->size, self->data_offset + start)) {
+				FREE(buffer);
+				status = FAIL;
+				k = last;
+				continue;
+			}
+
+			for (; k < last; k++) {
+				struct load_request *r = &requests[k];
+				out[r->i] = nitro_read_buffer_copy(
+				    buffer->data + (r->start - start), r->end - r->start);
+				if (out[r->i] == NULL) {
+					status = FAIL;
+				}
+			}
+
+			FREE(buffer);
+		}
+
+		FREE(requests);
+		return status;
+	}
+#endif
+
+	for (size_t i = 0; i < n; i++) {
+		out[i] = narc_load_file(self, indices[i]);
+		if (out[i] == NULL && narc_get_file_size(self, indices[i]) > 4) {
+			status = FAIL;
+		}
+	}
+
+	return status;
+}
+
+/* Caching
+
+The cache is a hash table of entries keyed by NARC and index, plus a
+second one keyed by file so that narc_cache_release can find the entry.
+All the entries are also on a list in order of use, and when the cache
+is over budget, the least recently used ones that nobody holds are
+thrown out. An entry's cost is the size of the file once decompressed
+plus the size of the object, which is near enough to what it holds. */
+
+#define CACHE_BUCKETS 1024
+#define CACHE_DEFAULT_BUDGET ((size_t)32 * 1024 * 1024)
+
+/* A NARC's mapping, kept around after the NARC is freed for as long as
+ * cached files which might borrow from it are still held */
+struct orphan_map {
+	void *map;
+	size_t size;
+	size_t refs;
+};
+
+struct cache_entry {
+	/* NULL once the NARC has been freed */
+	struct NARC *narc;
+	int index;
+	int refs;
+
+	void *file;
+	size_t cost;
+
+	/* set once the NARC has been freed, if it was mapped */
+	struct orphan_map *orphan;
+
+	struct cache_entry *next_by_key;
+	struct cache_entry *next_by_file;
+
+	/* most recently used first */
+	struct cache_entry *prev;
+	struct cache_entry *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct cache_entry *by_key[CACHE_BUCKETS];
+	struct cache_entry *by_file[CACHE_BUCKETS];
+	struct cache_entry *head;
+	struct cache_entry *tail;
+	struct narc_cache_stats stats;
+} cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.stats = {.budget = CACHE_DEFAULT_BUDGET},
+};
+
+static size_t
+key_bucket(struct NARC *narc, int index)
+{
+	return ((uintptr_t)narc / 16 * 31 + (unsigned)index) % CACHE_BUCKETS;
+}
+
+static size_t
+file_bucket(void *file)
+{
+	return (uintptr_t)file / 16 % CACHE_BUCKETS;
+}
+
+static struct cache_entry **
+find_by_key(struct NARC *narc, int index)
+{
+	struct cache_entry **p = &cache.by_key[key_bucket(narc, index)];
+	while (*p != NULL && !((*p)->narc == narc && (*p)->index == index)) {
+		p = &(*p)->next_by_key;
+	}
+	return p;
+}
+
+static struct cache_entry **
+find_by_file(void *file)
+{
+	struct cache_entry **p = &cache.by_file[file_bucket(file)];
+	while (*p != NULL && (*p)->file != file) {
+		p = &(*p)->next_by_file;
+	}
+	return p;
+}
+
+static void
+lru_unlink(struct cache_entry *e)
+{
+	if (e->prev != NULL) {
+		e->prev->next = e->next;
+	} else {
+		cache.head = e->next;
+	}
+	if (e->next != NULL) {
+		e->next->prev = e->prev;
+	} else {
+		cache.tail = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+static void
+lru_push(struct cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = cache.head;
+	if (cache.head != NULL) {
+		cache.head->prev = e;
+	} else {
+		cache.tail = e;
+	}
+	cache.head = e;
+}
+
+/* Take an entry out of the tables and free it. The entry must already be
+ * off the list (and out of by_key, if it's been forgotten). */
+static void
+entry_free(struct cache_entry *e, bool keyed)
+{
+	if (keyed) {
+		*find_by_key(e->narc, e->index) = e->next_by_key;
+	}
+	*find_by_file(e->file) = e->next_by_file;
+
+	cache.stats.entries--;
+	cache.stats.bytes -= e->cost;
+
+	nitro_free(e->file);
+	FREE(e->file);
+
+#ifndef _WIN32
+	if (e->orphan != NULL) {
+		e->orphan->refs--;
+		if (e->orphan->refs == 0) {
+			munmap(e->orphan->map, e->orphan->size);
+			FREE(e->orphan);
+		}
+	}
+#endif
+	FREE(e);
+}
+
+/* throw out unused entries until we're within budget */
+static void
+cache_evict(void)
+{
+	struct cache_entry *e = cache.tail;
+	while (e != NULL && cache.stats.bytes > cache.stats.budget) {
+		struct cache_entry *prev = e->prev;
+		if (e->refs == 0) {
+			lru_unlink(e);
+			entry_free(e, true);
+			cache.stats.evictions++;
+		}
+		e = prev;
+	}
+}
+
+/* Drop everything cached from a NARC that's about to be freed. Entries
+ * still in use are forgotten, and freed when they're released; since
+ * they may borrow from the NARC's mapping, the last of them unmaps it
+ * instead of the NARC. Return true if that's the case. */
+static bool
+cache_forget(struct NARC *narc)
+{
+	bool held = false;
+	struct orphan_map *orphan = NULL;
+	if (narc->map != NULL && narc->fp != NULL) {
+		ALLOC(orphan);
+		if (orphan != NULL) {
+			*orphan = (struct orphan_map){
+				.map = (void *)narc->map,
+				.size = narc->map_size,
+			};
+		}
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	struct cache_entry *e = cache.head;
+	while (e != NULL) {
+		struct cache_entry *next = e->next;
+		if (e->narc == narc) {
+			lru_unlink(e);
+			if (e->refs == 0) {
+				entry_free(e, true);
+			} else {
+				*find_by_key(e->narc, e->index) = e->next_by_key;
+				e->narc = NULL;
+				if (narc->map != NULL && narc->fp != NULL) {
+					// without an orphan_map the mapping just leaks,
+					// which beats pulling it out from under the file
+					held = true;
+					if (orphan != NULL) {
+						orphan->refs++;
+						e->orphan = orphan;
+					}
+				}
+			}
+		}
+		e = next;
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	if (orphan != NULL && orphan->refs == 0) {
+		FREE(orphan);
+	}
+	return held;
+}
+
+/* about how much memory a file takes up once it's loaded */
+static size_t
+file_cost(struct NARC *self, int index, void *file)
+{
+	struct fatb_record record = self->fatb.records[index];
+	u32 chunk_size = record.end - record.start;
+	size_t cost = chunk_size;
+
+	u8 buf[4];
+	if (chunk_size >= 4 && !read_raw(self, record, 0, buf, 4) &&
+	    lzss_check_data(buf, chunk_size)) {
+		cost = buf[1] | buf[2] << 8 | buf[3] << 16;
+	}
+
+	const struct format_info *fmt = format_lookup(nitro_get_magic(file));
+	if (fmt != NULL) {
+		cost += fmt->size;
+	}
+	return cost;
+}
+
+/* Load a file, or get it from the cache if it's there. Returns NULL if
+ * it can't be loaded. */
+void *
+narc_cache_load(struct NARC *self, int index)
+{
+	assert(self != NULL);
+	assert(0 <= index && index < (signed long)self->fatb.header.file_count);
+
+	pthread_mutex_lock(&cache.lock);
+	struct cache_entry *e = *find_by_key(self, index);
+	if (e != NULL) {
+		e->refs++;
+		lru_unlink(e);
+		lru_push(e);
+		cache.stats.hits++;
+		pthread_mutex_unlock(&cache.lock);
+		return e->file;
+	}
+	cache.stats.misses++;
+	pthread_mutex_unlock(&cache.lock);
+
+	// don't hold the lock while loading
+	void *file = narc_load_file(self, index);
+	if (file == NULL) {
+		return NULL;
+	}
+	size_t cost = file_cost(self, index, file);
+
+	struct cache_entry *new;
+	if (ALLOC(new) == NULL) {
+		nitro_free(file);
+		FREE(file);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	e = *find_by_key(self, index);
+	if (e != NULL) {
+		// another thread beat us to it
+		e->refs++;
+		pthread_mutex_unlock(&cache.lock);
+		nitro_free(file);
+		FREE(file);
+		FREE(new);
+		return e->file;
+	}
+
+	*new = (struct cache_entry){
+		.narc = self,
+		.index = index,
+		.refs = 1,
+		.file = file,
+		.cost = cost,
+	};
+	struct cache_entry **bucket = &cache.by_key[key_bucket(self, index)];
+	new->next_by_key = *bucket;
+	*bucket = new;
+	bucket = &cache.by_file[file_bucket(file)];
+	new->next_by_file = *bucket;
+	*bucket = new;
+	lru_push(new);
+
+	cache.stats.entries++;
+	cache.stats.bytes += cost;
+	cache_evict();
+	pthread_mutex_unlock(&cache.lock);
+
+	return file;
+}
+
+/* Give back a file from narc_cache_load. */
+void
+narc_cache_release(void *file)
+{
+	if (file == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	struct cache_entry *e = *find_by_file(file);
+	assert(e != NULL);
+	assert(e->refs > 0);
+
+	e->refs--;
+	if (e->refs == 0) {
+		if (e->narc == NULL) {
+			entry_free(e, false);
+		} else {
+			cache_evict();
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void
+narc_cache_set_budget(size_t bytes)
+{
+	pthread_mutex_lock(&cache.lock);
+	cache.stats.budget = bytes;
+	cache_evict();
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void
+narc_cache_get_stats(struct narc_cache_stats *stats)
+{
+	assert(stats != NULL);
+
+	pthread_mutex_lock(&cache.lock);
+	*stats = cache.stats;
+	pthread_mutex_unlock(&cache.lock);
 }
 
 /* the NARC signature is big-endian for some reason */
@@ -177,5 +1068,6 @@ struct format_info NARC_format = {
 	format_header('CRAN', struct NARC),
 	
 	.read = narc_read,
+	.read_mem = narc_read_mem,
 	.free = narc_free,
 };
@@ -7,15 +7,41 @@
 #ifndef NARC_H
 #define NARC_H
 
-#include "nitro.h" /* struct format_info */
-#include "common.h" /* u32 */
+#include "nitro.h" /* struct format_info, struct nitro_probe, magic_t */
+#include "common.h" /* size_t, u8, u32, u64 */
 
 struct NARC;
 
 extern struct format_info NARC_format;
 
+extern int narc_map(struct NARC *self);
+/* Loading files is safe to do from several threads at once; see narc.c */
 extern void *narc_load_file(struct NARC *self, int index);
+extern int narc_load_files(struct NARC *self, const int *indices, size_t n, void **out);
+extern int narc_get_file_view(struct NARC *self, int index, const u8 **data, size_t *size);
+extern int narc_peek_file(struct NARC *self, int index, u8 *buf, size_t size, size_t *n);
+extern int narc_get_file_magic(struct NARC *self, int index, magic_t *magic);
+extern int narc_probe(struct NARC *self, int index, struct nitro_probe *info);
 extern u32 narc_get_file_size(struct NARC *self, int index);
 extern u32 narc_get_file_count(struct NARC *self);
+extern int narc_get_hash(struct NARC *self, u64 *hash);
+
+/* The file cache. Files loaded through it are shared - treat them as
+ * read-only - and have to be given back with narc_cache_release rather
+ * than freed. Released files stay cached, least recently used first out,
+ * for as long as they fit in the budget. Safe to use from any thread. */
+struct narc_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t entries;
+	size_t bytes;
+	size_t budget;
+};
+
+extern void *narc_cache_load(struct NARC *self, int index);
+extern void narc_cache_release(void *file);
+extern void narc_cache_set_budget(size_t bytes);
+extern void narc_cache_get_stats(struct narc_cache_stats *stats);
 
 #endif /* NARC_H */
@@ -6,14 +6,16 @@
  * and comes with NO WARRANTY. See rip.c for details.
  */
 
-#include <stdlib.h> /* NULL, size_t */
+#include <stdlib.h> /* NULL, free, size_t */
+#include <stdbool.h> /* bool */
 #include <stdio.h> /* FILE, stdout */
 #include <limits.h> /* INT_MAX, INT_MIN */
+#include <pthread.h> /* pthread_mutex_t, pthread_mutex_init, pthread_mutex_destroy, pthread_mutex_lock, pthread_mutex_unlock */
 
-#include "nitro.h" /* struct format_info, struct nitro, struct OBJ, magic_t, format_header */
-#include "ncgr.h" /* struct NCGR, ncgr_get_pixel */
+#include "nitro.h" /* struct format_info, struct nitro, struct nitro_probe, struct OBJ, magic_t, format_header */
+#include "ncgr.h" /* struct NCGR, ncgr_get_cell_pixels, ncgr_get_serial */
 #include "image.h" /* struct image */
-#include "common.h" /* OKAY, FAIL, NOMEM, CALLOC, FREAD, assert, struct dim, struct coords, u8, u16, u32, s16, fx16 */
+#include "common.h" /* OKAY, FAIL, NOMEM, ALLOC, CALLOC, FREAD, FREE, assert, struct dim, struct coords, u8, u16, u32, u64, s16, fx16 */
 
 #include "ncer.h"
 
@@ -68,8 +70,27 @@ struct NCER {
 	struct CEBK cebk;
 	//struct LABL labl;
 	//struct UEXT uext;
+
+	/* The cells compiled so far, for the NCGR last drawn with (see
+	 * "Cell plans" below). The lock guards plan_set and what's in it. */
+	pthread_mutex_t plan_lock;
+	struct plan_set *plan_set;
 };
 
+static void plan_set_release(struct NCER *self, struct plan_set *set);
+
+
+static int
+ncer_init(void *buf)
+{
+	struct NCER *self = buf;
+	self->plan_set = NULL;
+	if (pthread_mutex_init(&self->plan_lock, NULL)) {
+		return FAIL;
+	}
+	return OKAY;
+}
+
 
 static int
 ncer_read(void *buf, FILE *fp)
@@ -123,6 +144,86 @@ ncer_read(void *buf, FILE *fp)
 	return OKAY;
 }
 
+/* The cell data is small, so we copy it rather than borrow it. */
+static int
+ncer_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NCER *self = buf;
+	assert(self != NULL);
+
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1)) {
+		return FAIL;
+	}
+	assert(self->header.magic == (magic_t)'NCER');
+	assert(self->header.chunk_count == 3 || self->header.chunk_count == 1);
+
+	if (CREAD(&c, &self->cebk.header, 1)) {
+		return FAIL;
+	}
+	assert(self->cebk.header.magic == (magic_t)'CEBK');
+
+	if (CALLOC(self->cebk.cell_data,
+	           self->cebk.header.cell_count) == NULL) {
+		return NOMEM;
+	}
+	switch (self->cebk.header.cell_type) {
+	case 0:
+		if (CREAD(&c, self->cebk.cell_data, self->cebk.header.cell_count)) {
+			return FAIL;
+		}
+		break;
+	case 1:
+		if (CALLOC(self->cebk.cell_data_ex,
+		           self->cebk.header.cell_count) == NULL) {
+			return NOMEM;
+		}
+		for (int i = 0; i < (signed long)self->cebk.header.cell_count; i++) {
+			if (CREAD(&c, &self->cebk.cell_data[i], 1) ||
+			    CREAD(&c, &self->cebk.cell_data_ex[i], 1)) {
+				return FAIL;
+			}
+		}
+		break;
+	default:
+		warn("Unknown cell type: %d", self->cebk.header.cell_type);
+		return FAIL;
+	}
+
+	self->cebk.obj_count = 0;
+	for (int i = 0; i < (signed long)self->cebk.header.cell_count; i++) {
+		self->cebk.obj_count += self->cebk.cell_data[i].obj_count;
+	}
+
+	if (CALLOC(self->cebk.obj_data, self->cebk.obj_count) == NULL) {
+		return FAIL;
+	}
+
+	if (CREAD(&c, self->cebk.obj_data, self->cebk.obj_count)) {
+		return FAIL;
+	}
+
+	// partition_data?
+
+	return OKAY;
+}
+
+
+static int
+ncer_probe(const u8 *data, size_t size, struct nitro_probe *info)
+{
+	struct NCER tmp;
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &tmp.header, 1) || CREAD(&c, &tmp.cebk.header, 1) ||
+	    tmp.cebk.header.magic != (magic_t)'CEBK') {
+		return FAIL;
+	}
+
+	info->cell_count = tmp.cebk.header.cell_count;
+	return OKAY;
+}
 
 static void
 ncer_free(void *buf)
@@ -134,14 +235,23 @@ ncer_free(void *buf)
 		FREE(self->cebk.cell_data_ex);
 		FREE(self->cebk.obj_data);
 		FREE(self->cebk.partition_data);
+
+		if (self->plan_set != NULL) {
+			plan_set_release(self, self->plan_set);
+			self->plan_set = NULL;
+		}
+		pthread_mutex_destroy(&self->plan_lock);
 	}
 }
 
 struct format_info NCER_format = {
 	format_header('NCER', struct NCER),
 
+	.init = ncer_init,
 	.read = ncer_read,
+	.read_mem = ncer_read_mem,
 	.free = ncer_free,
+	.probe = ncer_probe,
 };
 
 /******************************************************************************/
@@ -207,183 +317,445 @@ ncer_dump(struct NCER *self, FILE *fp)
 	//printf("sizeof(OAM) = %u", (unsigned int) sizeof(struct OBJ));
 }
 
-#define check_range(a, b, c) ((a) <= (b) && (b) < (c))
+/* Floored and ceilinged division, for divisors of either sign */
+static int
+floor_div(int a, int b)
+{
+	int q = a / b;
+	if ((a % b != 0) && ((a < 0) != (b < 0))) {
+		q--;
+	}
+	return q;
+}
+
+static int
+ceil_div(int a, int b)
+{
+	int q = a / b;
+	if ((a % b != 0) && ((a < 0) == (b < 0))) {
+		q++;
+	}
+	return q;
+}
+
+/* Narrow [*first, *last] down to the x for which lo <= a + x*step < hi */
+static void
+clip_linear(int a, int step, int lo, int hi, int *first, int *last)
+{
+	int from, to;
+	if (step == 0) {
+		if (lo <= a && a < hi) {
+			return;
+		}
+		from = 1;
+		to = 0;
+	} else if (step > 0) {
+		from = ceil_div(lo - a, step);
+		to = floor_div(hi - 1 - a, step);
+	} else {
+		from = ceil_div(hi - 1 - a, step);
+		to = floor_div(lo - a, step);
+	}
+	if (from > *first) *first = from;
+	if (to < *last) *last = to;
+}
 
-/* Render an object onto an image, possibly applying a transformation. */
-// XXX this largely duplicates obj_draw. refactor.
+/* Render an object onto an image, possibly applying a transformation.
+ *
+ * Pixels already drawn on the image are left alone. Source pixels are
+ * found by mapping each destination pixel back through the transform;
+ * along a row, that's a step of (transform[0], transform[2]) in 24.8
+ * fixed point each time, so each row is clipped to the pixels which land
+ * inside the source once, up front, and then just walked. */
 static int
 image_render(struct image *self, struct coords offset,
              struct image *source, fx16 transform[4], struct coords center)
 {
-	int y, x;
-	int y2, x2;
-
 	//warn("[%f,%f,%f,%f]", transform[0]/256.0, transform[1]/256.0,
 	//                      transform[2]/256.0, transform[3]/256.0);
 	//warn("size=%d,%d center=%d,%d", source->dim.width, source->dim.height,
 	//                                center.x, center.y);
 
-	for (y = 0; y < source->dim.height; y++) {
-	for (x = 0; x < source->dim.width; x++) {
-		int pixel_index = (offset.y + y - center.y) * self->dim.width
-		                + (offset.x + x - center.x);
-		if (!check_range(0, offset.y+y-center.y, self->dim.height) ||
-		    !check_range(0, offset.x+x-center.x, self->dim.width)) {
-			continue;
-		}
-		if (!check_range(0, pixel_index, self->pixels->size)) {
-			continue;
-		}
-		if (self->pixels->data[pixel_index] != 0) {
-			continue;
-		}
+	const int width = self->dim.width;
+	const int source_width = source->dim.width;
+	if (width <= 0 || source_width <= 0) {
+		return OKAY;
+	}
 
-		if (transform) {
-			/* An arithmetic right shift on a twos-complement
-			 * signed integer is equivalent to a floored division,
-			 * which is exactly what we want. */
-			x2 = (((x - center.x) * transform[0] +
-			       (y - center.y) * transform[1]) >> 8) + center.x;
-			y2 = (((x - center.x) * transform[2] +
-			       (y - center.y) * transform[3]) >> 8) + center.y;
-		} else {
-			x2 = x;
-			y2 = y;
-		}
+	// rows which don't fit in the buffers are never drawn, or drawn from
+	const int height = self->dim.height < (int)(self->pixels->size / width)
+	                 ? self->dim.height : (int)(self->pixels->size / width);
+	const int source_height = source->dim.height < (int)(source->pixels->size / source_width)
+	                        ? source->dim.height : (int)(source->pixels->size / source_width);
 
-		// check whether the transformed coordinates are within the
-		// cell data.
-		int source_pixel_index = y2 * source->dim.width + x2;
-		if (!check_range(0, x2, source->dim.width) ||
-		    !check_range(0, y2, source->dim.height)) {
+	const bool identity = transform == NULL ||
+	    (transform[0] == 0x100 && transform[1] == 0 &&
+	     transform[2] == 0 && transform[3] == 0x100);
+
+	// where source pixel (0, 0) lands
+	const int left = offset.x - center.x;
+	const int top = offset.y - center.y;
+
+	for (int y = 0; y < source->dim.height; y++) {
+		if (!(0 <= top + y && top + y < height)) {
 			continue;
 		}
-		if (!check_range(0, source_pixel_index, source->pixels->size)) {
+		u8 *row = &self->pixels->data[(top + y) * width];
+
+		// the pixels of the row that land on the image
+		int first = -left;
+		int last = width - 1 - left;
+		if (first < 0) first = 0;
+		if (last > source->dim.width - 1) last = source->dim.width - 1;
+
+		if (identity) {
+			if (y >= source_height) {
+				continue;
+			}
+			const u8 *src = &source->pixels->data[y * source_width];
+			for (int x = first; x <= last; x++) {
+				if (row[left + x] == 0) {
+					row[left + x] = src[x];
+				}
+			}
 			continue;
 		}
 
-		//draw the pixel
-		self->pixels->data[pixel_index] =
-		    source->pixels->data[source_pixel_index];
-	}
+		/* The source coordinates, before the shift, are
+		 *   u = (x - center.x) * transform[0] + (y - center.y) * transform[1]
+		 *   v = (x - center.x) * transform[2] + (y - center.y) * transform[3]
+		 * and an arithmetic right shift on a twos-complement signed
+		 * integer is a floored division, so (u >> 8) + center.x is in
+		 * the source exactly when -center.x * 0x100 <= u <
+		 * (source_width - center.x) * 0x100. */
+		const int u0 = -center.x * transform[0] + (y - center.y) * transform[1];
+		const int v0 = -center.x * transform[2] + (y - center.y) * transform[3];
+		clip_linear(u0, transform[0], -center.x * 0x100,
+		            (source_width - center.x) * 0x100, &first, &last);
+		clip_linear(v0, transform[2], -center.y * 0x100,
+		            (source_height - center.y) * 0x100, &first, &last);
+
+		const u8 *src = source->pixels->data;
+		int u = u0 + first * transform[0];
+		int v = v0 + first * transform[2];
+		for (int x = first; x <= last; x++) {
+			if (row[left + x] == 0) {
+				row[left + x] = src[((v >> 8) + center.y) * source_width +
+				                    (u >> 8) + center.x];
+			}
+			u += transform[0];
+			v += transform[2];
+		}
 	}
 	return OKAY;
 }
 
-static int
-obj_draw(struct OBJ *obj, struct NCGR *ncgr, struct image *image,
-         struct coords frame_offset, fx16 transform[4])
-{
-	// x and y specify the position of the top-left corner of the frame.
-	// coordinates for rotations have the origin at center of the frame.
-	//printf("x = %d, y = %d\n", obj->x, obj->y);
+/* Cell plans
+ *
+ * Drawing an obj means decoding its pixels out of the character data,
+ * which is slow, and an animation draws the same few cells over and over.
+ * So a plan decodes a cell's objs once and keeps just the runs of opaque
+ * pixels in each row. Drawing the plan is a matter of copying the runs. */
 
-	// the real dimensions of the cell
-	struct dim cell_dim = obj_sizes[obj->obj_size][obj->obj_shape];
+struct span {
+	/* position of the first pixel, relative to the cell's origin */
+	int x;
+	int y;
 
-	//warn("cell_dim = {.height = %d, .width = %d}", cell_dim.height, cell_dim.width);
-	//warn("tile_index = %d", obj->tile_index);
+	u32 length;
 
-	struct buffer *pixels =
-	    ncgr_get_cell_pixels(ncgr, obj->tile_index, cell_dim);
-	if (pixels == NULL) {
-		return FAIL;
+	/* index of the first pixel in ncer_plan.pixels */
+	u32 start;
+};
+
+struct ncer_plan {
+	size_t span_count;
+	struct span *spans;
+
+	struct buffer *pixels;
+};
+
+/* The tile an obj actually starts at. The stored tile_index is increased
+ * by hex 32 or decimal 50 for each cell after the first; it wraps around
+ * like the 10-bit field it's kept in. */
+static u16
+obj_tile_index(const struct OBJ *obj, int cell_index)
+{
+	return (obj->tile_index + cell_index * 50) & 0x3ff;
+}
+
+/* Compile a plan for a cell. The NCER is only read, never modified, so
+ * drawing a cell always gives the same result, and one NCER can be drawn
+ * from several threads at once. */
+struct ncer_plan *
+ncer_plan_new(struct NCER *self, int index, struct NCGR *ncgr)
+{
+	assert(self != NULL);
+	assert(self->header.magic == (magic_t)'NCER');
+	assert(ncgr != NULL);
+
+	if (!(0 <= index && index < self->cebk.header.cell_count)) {
+		return NULL;
 	}
 
-	// the dimensions of the "on-screen" frame
-	// is either the same as cell_dim, or double
-	struct dim frame_dim = cell_dim;
-	if (obj->rs_mode & 2) {
-		frame_dim.height *= 2;
-		frame_dim.width *= 2;
+	struct CEBK_celldata *cell = self->cebk.cell_data + index;
+	struct OBJ *objs = (void *)((u8*)self->cebk.obj_data + cell->obj_offset);
+
+	struct ncer_plan *plan;
+	if (ALLOC(plan) == NULL) {
+		return NULL;
+	}
+	plan->span_count = 0;
+	plan->spans = NULL;
+	plan->pixels = NULL;
+
+	// there can't be more pixels than the objs have, or more spans
+	// than one for every other pixel in a row
+	size_t max_pixels = 0;
+	size_t max_spans = 0;
+	for (int i = 0; i < cell->obj_count; i++) {
+		struct dim cell_dim = obj_sizes[objs[i].obj_size][objs[i].obj_shape];
+		max_pixels += cell_dim.width * cell_dim.height;
+		max_spans += (cell_dim.width / 2 + 1) * cell_dim.height;
 	}
 
-	struct coords transform_offset = {frame_dim.width / 2, frame_dim.height / 2};
+	plan->pixels = buffer_alloc(max_pixels);
+	if (plan->pixels == NULL ||
+	    CALLOC(plan->spans, max_spans > 0 ? max_spans : 1) == NULL) {
+		goto error;
+	}
 
-	int rs_mode = obj->rs_mode;
-	int x, y;
-	// fixed-point 8.8
-	s16 x_prime_fx, y_prime_fx;
-	int x_prime, y_prime;
+	size_t pixel_count = 0;
+	for (int i = 0; i < cell->obj_count; i++) {
+		struct OBJ *obj = &objs[i];
 
-	if (transform == NULL) { rs_mode &= ~1; }
+		// the real dimensions of the cell
+		struct dim cell_dim = obj_sizes[obj->obj_size][obj->obj_shape];
 
-	//warn("transform_offset = {%d, %d}", transform_offset.x, transform_offset.y);
+		u16 tile = obj_tile_index(obj, index);
 
-	for (y = 0; y < frame_dim.height; y++) {
-	for (x = 0; x < frame_dim.width; x++) {
-		if (obj->y + frame_offset.y + y < 0 ||
-		    obj->x + frame_offset.x + x < 0) {
-			continue;
+		struct buffer *pixels = ncgr_get_cell_pixels(ncgr, tile, cell_dim);
+		if (pixels == NULL) {
+			goto error;
 		}
 
-		if (rs_mode & 1) {
-			// affine transformation!
-			// multiply the matrix by the sprite coordinates;
-			// origin at the center of the frame
-			x_prime_fx = (x - transform_offset.x) * transform[0] + (y - transform_offset.y) * transform[1];
-			y_prime_fx = (x - transform_offset.x) * transform[2] + (y - transform_offset.y) * transform[3];
-			// grab the integer portion and convert the coordinates back
-			x_prime = (x_prime_fx >> 8) + transform_offset.x;
-			y_prime = (y_prime_fx >> 8) + transform_offset.y;
-		} else {
-			// XXX implement flips
-			x_prime = x;
-			y_prime = y;
+		// x and y specify the position of the top-left corner of
+		// the frame. a double-size frame is twice as big as the cell,
+		// which is drawn in the middle of it.
+		struct coords position = {obj->x, obj->y};
+		if (obj->rs_mode & 2) {
+			position.x += cell_dim.width / 2;
+			position.y += cell_dim.height / 2;
 		}
 
-		if (rs_mode & 2) {
-			x_prime -= cell_dim.width / 2;
-			y_prime -= cell_dim.height / 2;
-		}
+		// transparent pixels never get drawn, so leave them out
+		for (int y = 0; y < cell_dim.height; y++) {
+			const u8 *row = &pixels->data[y * cell_dim.width];
+			int x = 0;
+			while (x < cell_dim.width) {
+				if (row[x] == 0) {
+					x++;
+					continue;
+				}
 
-		//warn("x = %d, y = %d; x_prime = %d, y_prime = %d", x, y, x_prime, y_prime);
-
-		// check whether the transformed coordinates are within the
-		// cell data.
-		if (0 <= x_prime && x_prime < cell_dim.width &&
-		    0 <= y_prime && y_prime < cell_dim.height) {
-			//draw the pixel
-			int pixel_offset = (obj->y + frame_offset.y + y) * image->dim.width
-					 + (obj->x + frame_offset.x + x);
-			if (0 <= pixel_offset && (size_t)pixel_offset < image->pixels->size) {
-				/*u8 pixel = pixels->data[y_prime * cell_dim.width + x_prime];
-				if (pixel != 0) {
-					image->pixels->data[pixel_offset] = pixel;
-				}*/
-				if (image->pixels->data[pixel_offset] == 0) {
-					image->pixels->data[pixel_offset] =
-					  pixels->data[y_prime * cell_dim.width + x_prime];
+				struct span *span = &plan->spans[plan->span_count++];
+				span->x = position.x + x;
+				span->y = position.y + y;
+				span->start = pixel_count;
+
+				while (x < cell_dim.width && row[x] != 0) {
+					plan->pixels->data[pixel_count++] = row[x];
+					x++;
 				}
+				span->length = pixel_count - span->start;
 			}
 		}
+
+		FREE(pixels);
 	}
+
+	return plan;
+
+	error:
+	ncer_plan_free(plan);
+	return NULL;
+}
+
+/* Draw a plan over image. Like objs on the DS, the objs drawn first are
+ * on top, so only fill pixels which are still transparent. */
+int
+ncer_plan_draw(struct ncer_plan *plan, struct image *image, struct coords offset)
+{
+	assert(plan != NULL);
+	assert(image != NULL);
+	assert(image->pixels != NULL);
+
+	u8 *data = image->pixels->data;
+	const long size = image->pixels->size;
+
+	for (size_t i = 0; i < plan->span_count; i++) {
+		const struct span *span = &plan->spans[i];
+		const u8 *src = &plan->pixels->data[span->start];
+		long length = span->length;
+		int x = offset.x + span->x;
+		int y = offset.y + span->y;
+
+		if (y < 0) {
+			continue;
+		}
+		if (x < 0) {
+			src -= x;
+			length += x;
+			x = 0;
+		}
+
+		// spans that run off the right edge wrap around onto the
+		// next row; only the ends of the image clip them
+		long start = (long)y * image->dim.width + x;
+		if (start + length > size) {
+			length = size - start;
+		}
+
+		u8 *dest = &data[start];
+		for (long j = 0; j < length; j++) {
+			if (dest[j] == 0) {
+				dest[j] = src[j];
+			}
+		}
 	}
-	FREE(pixels);
+
 	return OKAY;
 }
 
+void
+ncer_plan_free(struct ncer_plan *plan)
+{
+	if (plan != NULL) {
+		FREE(plan->spans);
+		FREE(plan->pixels);
+		free(plan);
+	}
+}
+
+/* The plans for every cell of an NCER, compiled as they're first drawn,
+ * for one NCGR. An NCER keeps the set for the last NCGR it was drawn with,
+ * so drawing an animation compiles each cell once; drawing with another
+ * NCGR starts a new set.
+ *
+ * Other threads may still be drawing from the old set when that happens,
+ * so each thread holds a reference while it draws, and the NCER holds one
+ * while the set is current. The last one out frees it. */
+struct plan_set {
+	u64 ncgr_serial;
+	int refs;
+	int cell_count;
+	struct ncer_plan *plans[];
+};
+
+static void
+plan_set_free(struct plan_set *set)
+{
+	for (int i = 0; i < set->cell_count; i++) {
+		ncer_plan_free(set->plans[i]);
+	}
+	free(set);
+}
+
+/* Get the plan set for ncgr, and a reference to it */
+static struct plan_set *
+plan_set_acquire(struct NCER *self, struct NCGR *ncgr)
+{
+	const u64 serial = ncgr_get_serial(ncgr);
+
+	pthread_mutex_lock(&self->plan_lock);
+	struct plan_set *set = self->plan_set;
+	if (set == NULL || set->ncgr_serial != serial) {
+		const int cell_count = self->cebk.header.cell_count;
+		set = malloc(sizeof *set + cell_count * sizeof set->plans[0]);
+		if (set == NULL) {
+			pthread_mutex_unlock(&self->plan_lock);
+			return NULL;
+		}
+		set->ncgr_serial = serial;
+		set->refs = 1;
+		set->cell_count = cell_count;
+		for (int i = 0; i < cell_count; i++) {
+			set->plans[i] = NULL;
+		}
+
+		if (self->plan_set != NULL && --self->plan_set->refs == 0) {
+			plan_set_free(self->plan_set);
+		}
+		self->plan_set = set;
+	}
+	set->refs++;
+	pthread_mutex_unlock(&self->plan_lock);
+
+	return set;
+}
+
+static void
+plan_set_release(struct NCER *self, struct plan_set *set)
+{
+	pthread_mutex_lock(&self->plan_lock);
+	int refs = --set->refs;
+	pthread_mutex_unlock(&self->plan_lock);
+
+	if (refs == 0) {
+		plan_set_free(set);
+	}
+}
+
+/* Look up the plan for a cell, compiling it if it's not there yet. The
+ * compiling happens outside the lock; if two threads race to compile the
+ * same cell, the first one to finish wins. */
+static struct ncer_plan *
+plan_set_get(struct plan_set *set, struct NCER *self, int index, struct NCGR *ncgr)
+{
+	pthread_mutex_lock(&self->plan_lock);
+	struct ncer_plan *plan = set->plans[index];
+	pthread_mutex_unlock(&self->plan_lock);
+	if (plan != NULL) {
+		return plan;
+	}
+
+	plan = ncer_plan_new(self, index, ncgr);
+	if (plan == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&self->plan_lock);
+	if (set->plans[index] == NULL) {
+		set->plans[index] = plan;
+	} else {
+		ncer_plan_free(plan);
+		plan = set->plans[index];
+	}
+	pthread_mutex_unlock(&self->plan_lock);
+
+	return plan;
+}
+
 static int
 render(struct NCER *self, int index, struct NCGR *ncgr, struct image *image, struct coords offset)
 {
-	struct CEBK_celldata *cell = self->cebk.cell_data + index;
-	struct OBJ *objs = (void *)((u8*)self->cebk.obj_data + cell->obj_offset);
+	if (!(0 <= index && index < self->cebk.header.cell_count)) {
+		return FAIL;
+	}
 
-	for (int i = 0; i < cell->obj_count; i++) {
-		struct OBJ *obj = &objs[i];
-		// tile_index is technically increased by hex 32 or decimal 50 once it gets to the next frame
-		obj->tile_index = obj->tile_index + (index * 50);
-		/*if(obj->rs_mode == 1) {
-			warn("transform, not doubled");
-		} else if (!(obj->rs_mode & 1)) {
-			warn("not transformed");
-		}*/
-
-		if (obj_draw(obj, ncgr, image, offset, NULL)) {
-			return FAIL;
-		}
+	struct plan_set *set = plan_set_acquire(self, ncgr);
+	if (set == NULL) {
+		return NOMEM;
 	}
-	return OKAY;
+
+	int status = FAIL;
+	struct ncer_plan *plan = plan_set_get(set, self, index, ncgr);
+	if (plan != NULL) {
+		status = ncer_plan_draw(plan, image, offset);
+	}
+
+	plan_set_release(self, set);
+	return status;
 }
 
 static void
@@ -26,4 +26,11 @@ extern int ncer_get_cell_count(struct NCER *self);
 extern int ncer_get_cell_dim(struct NCER *self, int index, struct dim *dim, struct coords *center);
 void ncer_dump(struct NCER *self, FILE *fp);
 
+/* A cell decoded ahead of time, for drawing many times over */
+struct ncer_plan;
+
+extern struct ncer_plan *ncer_plan_new(struct NCER *self, int index, struct NCGR *ncgr);
+extern int ncer_plan_draw(struct ncer_plan *plan, struct image *image, struct coords offset);
+extern void ncer_plan_free(struct ncer_plan *plan);
+
 #endif /* NCER_H */
@@ -6,14 +6,14 @@
  * and comes with NO WARRANTY. See rip.c for details.
  */
 
-#include <stdlib.h> /* NULL, size_t, ssize_t */
+#include <stdlib.h> /* NULL, size_t */
 #include <stdio.h> /* FILE, feof, ferror */
 #include <string.h> /* memcpy, memset */
+#include <pthread.h> /* pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock */
 
-#include <sys/types.h> /* ssize_t */
-
-#include "common.h" /* OKAY, FAIL, NOMEM, struct buffer, struct dim, u8, u16, u32, FREAD, FREE, assert, warn, buffer_alloc  */
-#include "nitro.h" /* struct format_info, struct nitro, magic_t, format_header */
+#include "common.h" /* OKAY, FAIL, NOMEM, struct buffer, struct dim, u8, u16, u32, u64, FREAD, FREE, assert, warn, buffer_alloc  */
+#include "nitro.h" /* struct format_info, struct nitro, struct nitro_probe, magic_t, format_header */
+#include "unpack.h" /* unpack_pixels, unpack_tiles */
 
 #include "ncgr.h"
 
@@ -37,6 +37,10 @@ struct CHAR {
 		u32 unknown;
 	} header;
 
+	/* The character data (header.data_size bytes). Either it belongs
+	 * to buffer, or buffer is NULL and it's borrowed from the memory
+	 * the NCGR was read from. */
+	const u8 *data;
 	struct buffer *buffer;
 };
 
@@ -45,8 +49,30 @@ struct NCGR {
 
 	struct CHAR char_;
 	//struct CPOS cpos;
+
+	/* Changes whenever the pixels do; see ncgr_get_serial */
+	u64 serial;
 };
 
+/* Serial numbers are never reused, unlike the addresses of freed NCGRs */
+static pthread_mutex_t serial_lock = PTHREAD_MUTEX_INITIALIZER;
+static u64 next_serial = 1;
+
+static void
+new_serial(struct NCGR *self)
+{
+	pthread_mutex_lock(&serial_lock);
+	self->serial = next_serial++;
+	pthread_mutex_unlock(&serial_lock);
+}
+
+static int
+ncgr_init(void *buf)
+{
+	new_serial(buf);
+	return OKAY;
+}
+
 static int
 ncgr_read(void *buf, FILE *fp)
 {
@@ -74,10 +100,56 @@ ncgr_read(void *buf, FILE *fp)
 	if (ferror(fp) || feof(fp)) {
 		return FAIL;
 	}
+	self->char_.data = self->char_.buffer->data;
+
+	return OKAY;
+}
+
+static int
+ncgr_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NCGR *self = buf;
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1)) {
+		return FAIL;
+	}
+
+	assert(self->header.chunk_count == 1 || self->header.chunk_count == 2);
+
+	if (CREAD(&c, &self->char_.header, 1)) {
+		return FAIL;
+	}
+
+	assert(self->char_.header.magic == (magic_t)'CHAR');
+
+	self->char_.data = cursor_borrow(&c, self->char_.header.data_size);
+	if (self->char_.data == NULL) {
+		return FAIL;
+	}
 
 	return OKAY;
 }
 
+static int
+ncgr_probe(const u8 *data, size_t size, struct nitro_probe *info)
+{
+	struct NCGR tmp;
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &tmp.header, 1) || CREAD(&c, &tmp.char_.header, 1) ||
+	    tmp.char_.header.magic != (magic_t)'CHAR') {
+		return FAIL;
+	}
+
+	switch (tmp.char_.header.bit_depth) {
+	case 3: info->bit_depth = 4; break;
+	case 4: info->bit_depth = 8; break;
+	default: return OKAY;
+	}
+	return ncgr_get_dim(&tmp, &info->dim);
+}
+
 static void
 ncgr_free(void *buf) {
 	struct NCGR *self = buf;
@@ -85,16 +157,31 @@ ncgr_free(void *buf) {
 	if (self != NULL &&
 	    self->header.magic == (magic_t)'NCGR') {
 		FREE(self->char_.buffer);
+		self->char_.data = NULL;
 	}
 }
 
 struct format_info NCGR_format = {
 	format_header('NCGR', struct NCGR),
 	
+	.init = ncgr_init,
 	.read = ncgr_read,
+	.read_mem = ncgr_read_mem,
 	.free = ncgr_free,
+	.probe = ncgr_probe,
 };
 
+/* A number which identifies both the NCGR and the state of its pixels:
+ * no two NCGRs share one, and decrypting an NCGR gives it a new one. So
+ * anything worked out from the pixels can be kept as long as the serial
+ * number it was worked out from still matches. */
+u64
+ncgr_get_serial(struct NCGR *self)
+{
+	assert(self != NULL);
+	return self->serial;
+}
+
 int
 ncgr_get_dim(struct NCGR *self, struct dim *dim)
 {
@@ -140,61 +227,52 @@ get_boundary_size(struct NCGR *self)
 static int
 unpack(struct NCGR *self, size_t start, size_t size, u8 *dest)
 {
-	struct buffer *buffer = self->char_.buffer;
+	const u8 *data = self->char_.data;
+	const size_t data_size = self->char_.header.data_size;
 	switch (self->char_.header.bit_depth) {
 	case 3:
 		// 4 bits per pixel
-		//warn("%u + %u / 2 <= %u", start, size, buffer->size);
-		assert((start + size) / 2 <= buffer->size);
-		size_t i;
-		for (i = 0; i < size / 2; i++) {
-			u8 byte = buffer->data[start / 2 + i];
-			dest[i*2]     = byte        & 0x0f;
-			dest[i*2 + 1] = (byte >> 4) & 0x0f;
-		}
-		break;
+		//warn("%u + %u / 2 <= %u", start, size, data_size);
+		assert((start + size) / 2 <= data_size);
+		return unpack_pixels(dest, data + start / 2, size, 4);
 	case 4:
 		// 8 bits per pixel
-		assert((start + size) <= buffer->size);
-		memcpy(dest, buffer->data + start, size);
-		break;
+		assert((start + size) <= data_size);
+		return unpack_pixels(dest, data + start, size, 8);
 	default:
 		warn("Unknown bit depth: %d", self->char_.header.bit_depth);
 		return FAIL;
 	}
-	return OKAY;
 }
 
-static void
-untile(struct buffer *pixels, struct dim dim)
+/* unpack a block of tiles from the character data straight into a
+ * row-major image of the given dimensions */
+static int
+unpack_tiled(struct NCGR *self, size_t start, struct dim dim, u8 *dest)
 {
-	// let's allocate a few kilobytes of data on the stack - yeah!
-	u8 tmp_px[dim.height][dim.width];
-	//memset(tmp_px, 0, pixels->size);
-
-	int x, y, tx, ty, cx, cy, i;
-	i = 0;
-	for (y = 0; y < dim.height / 8; y++) {
-	for (x = 0; x < dim.width / 8; x++) {
-		for (ty = 0; ty < 8; ty++) {
-		for (tx = 0; tx < 8; tx++) {
-			cy = y * 8 + ty;
-			cx = x * 8 + tx;
-			tmp_px[cy][cx] = pixels->data[i];
-			i++;
-		}
-		}
-	}
+	const u8 *data = self->char_.data;
+	const size_t data_size = self->char_.header.data_size;
+	const size_t size = dim.height * dim.width;
+	switch (self->char_.header.bit_depth) {
+	case 3:
+		// 4 bits per pixel
+		assert((start + size) / 2 <= data_size);
+		return unpack_tiles(dest, data + start / 2, dim, 4);
+	case 4:
+		// 8 bits per pixel
+		assert((start + size) <= data_size);
+		return unpack_tiles(dest, data + start, dim, 8);
+	default:
+		warn("Unknown bit depth: %d", self->char_.header.bit_depth);
+		return FAIL;
 	}
-
-	memcpy(pixels->data, tmp_px, pixels->size);
 }
 
 struct buffer *
 ncgr_get_pixels(struct NCGR *self)
 {
 	assert(self != NULL);
-	assert(self->char_.buffer != NULL);
+	assert(self->char_.data != NULL);
 
 	struct dim dim;
 	size_t size;
@@ -207,16 +285,18 @@ ncgr_get_pixels(struct NCGR *self)
 		return NULL;
 	}
 
-	if (unpack(self, 0, size, pixels->data)) {
+	int status;
+	if ((self->char_.header.tiled & 0xff) == 0) {
+		status = unpack_tiled(self, 0, dim, pixels->data);
+	} else {
+		status = unpack(self, 0, size, pixels->data);
+	}
+	if (status) {
 		FREE(pixels);
 		return NULL;
 	}
 	assert(self->char_.header.bit_depth == 3);
 
-	if ((self->char_.header.tiled & 0xff) == 0) {
-		untile(pixels, dim);
-	}
-
 	return pixels;
 }
 
@@ -225,7 +305,7 @@ struct buffer *
 ncgr_get_cell_pixels(struct NCGR *self, u16 tile, struct dim cell_dim)
 {
 	assert(self != NULL);
-	assert(self->char_.buffer != NULL);
+	assert(self->char_.data != NULL);
 
 	size_t size = cell_dim.height * cell_dim.width;
 
@@ -237,11 +317,9 @@ ncgr_get_cell_pixels(struct NCGR *self, u16 tile, struct dim cell_dim)
 	if ((self->char_.header.tiled & 0xff) == 0) {
 		size_t start = (tile << get_boundary_size(self)) * 2;
 
-		if (unpack(self, start, size, pixels->data)) {
+		if (unpack_tiled(self, start, cell_dim, pixels->data)) {
 			goto error;
 		}
-
-		untile(pixels, cell_dim);
 	} else {
 		u16 width = self->char_.header.width; // width in tiles
 		assert(width != 0xffff);
@@ -285,29 +363,118 @@ error:
 #define MULT 0x41c64e6dL
 #define ADD 0x6073L
 
-void
-ncgr_decrypt_dp(struct NCGR *self)
+/* The keys only ever hold 16 bits, so the rng is really
+ * seed' = seed * MULT + ADD mod 2^16. That's affine, so stepping
+ * it k times is one more affine function, which we can find by
+ * repeated squaring. */
+static void
+rng_jump(u32 k, u16 *mult, u16 *add)
 {
-	const ssize_t size = self->char_.buffer->size / sizeof(u16);
-	u16 *data = (u16*)self->char_.buffer->data;
+	u16 m = 1, a = 0;
+	u16 step_m = (u16)MULT, step_a = ADD;
+	while (k > 0) {
+		if (k & 1) {
+			m = m * step_m;
+			a = a * step_m + step_a;
+		}
+		step_a = step_a * step_m + step_a;
+		step_m = step_m * step_m;
+		k >>= 1;
+	}
+	*mult = m;
+	*add = a;
+}
+
+/* Each lane runs its own copy of the rng, LANES steps ahead of the
+ * last, so a whole block of keys comes out at once with no lane waiting
+ * on another. Working on a local copy of each block keeps dest and src
+ * from aliasing, which lets the compiler turn the lanes into vectors. */
+#define LANES 8
 
-	u16 seed = data[size - 1];
-	for (ssize_t i = size - 1; i >= 0; i--) {
-		data[i] ^= seed;
+/* XOR count keys, starting with seed, into src and store the result in
+ * dest. The keys go forwards through the data if dir is 1, or backwards
+ * from the last word if dir is -1. dest may be the same as src. */
+static void
+decrypt(u16 *dest, const u16 *src, size_t count, u16 seed, int dir)
+{
+	u16 key[LANES];
+	u16 mult, add;
+	size_t i = 0;
+
+	// going backwards, the lanes are laid out in reverse so that
+	// they still match up with the data in memory order
+	for (int j = 0; j < LANES; j++) {
+		key[dir > 0 ? j : LANES - 1 - j] = seed;
 		seed = seed * MULT + ADD;
 	}
+	rng_jump(LANES, &mult, &add);
+
+	for (; i + LANES <= count; i += LANES) {
+		size_t k = dir > 0 ? i : count - (i + LANES);
+		u16 block[LANES];
+		memcpy(block, &src[k], sizeof block);
+		for (int j = 0; j < LANES; j++) {
+			block[j] ^= key[j];
+			key[j] = key[j] * mult + add;
+		}
+		memcpy(&dest[k], block, sizeof block);
+	}
+
+	// the leftovers are still lined up in the lanes
+	for (int j = 0; i < count; i++, j++) {
+		if (dir > 0) {
+			dest[i] = src[i] ^ key[j];
+		} else {
+			dest[count - 1 - i] = src[count - 1 - i] ^ key[LANES - 1 - j];
+		}
+	}
+}
+
+#undef LANES
+
+/* Decryption needs our own copy of borrowed data. Rather than copy it
+ * first and decrypt it after, decrypt it on the way over. */
+static int
+decrypt_private(struct NCGR *self, int dir)
+{
+	const size_t size = self->char_.header.data_size;
+	const size_t count = size / sizeof(u16);
+	const u16 *src = (const u16*)self->char_.data;
+	u16 *dest;
+
+	if (count == 0) {
+		return OKAY;
+	}
+
+	if (self->char_.buffer == NULL) {
+		struct buffer *buffer = buffer_alloc(size);
+		if (buffer == NULL) {
+			return NOMEM;
+		}
+		self->char_.buffer = buffer;
+		self->char_.data = buffer->data;
+	}
+	dest = (u16*)self->char_.buffer->data;
+
+	u16 seed = dir > 0 ? src[0] : src[count - 1];
+	decrypt(dest, src, count, seed, dir);
+	new_serial(self);
+	return OKAY;
 }
 
 void
-ncgr_decrypt_pt(struct NCGR *self)
+ncgr_decrypt_dp(struct NCGR *self)
 {
-	const ssize_t size = self->char_.buffer->size / sizeof(u16);
-	u16 *data = (u16*)self->char_.buffer->data;
+	if (decrypt_private(self, -1)) {
+		warn("ncgr_decrypt_dp: out of memory");
+	}
+}
 
-	u16 seed = data[0];
-	for (ssize_t i = 0; i < size; i++) {
-		data[i] ^= seed;
-		seed = seed * MULT + ADD;
+void
+ncgr_decrypt_pt(struct NCGR *self)
+{
+	if (decrypt_private(self, 1)) {
+		warn("ncgr_decrypt_pt: out of memory");
 	}
 }
 
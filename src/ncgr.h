@@ -8,7 +8,7 @@
 #define NCGR_H
 
 #include "nitro.h" /* struct format_info */
-#include "common.h" /* struct buffer, u8, u32 */
+#include "common.h" /* struct buffer, u8, u32, u64 */
 
 struct NCGR;
 
@@ -17,6 +17,7 @@ extern struct format_info NCGR_format;
 extern int ncgr_get_dim(struct NCGR *self, struct dim *dim);
 extern struct buffer *ncgr_get_pixels(struct NCGR *self);
 extern struct buffer *ncgr_get_cell_pixels(struct NCGR *self, u16 tile, struct dim cell_dim);
+extern u64 ncgr_get_serial(struct NCGR *self);
 
 extern void ncgr_decrypt_dp(struct NCGR *self);
 extern void ncgr_decrypt_pt(struct NCGR *self);
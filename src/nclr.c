@@ -29,6 +29,10 @@ struct PLTT {
 		u32 data_offset;
 	} header;
 
+	/* The color data (header.data_size bytes). Either it belongs
+	 * to buffer, or buffer is NULL and it's borrowed from the memory
+	 * the NCLR was read from. */
+	const u8 *data;
 	struct buffer *buffer;
 };
 
@@ -66,6 +70,32 @@ nclr_read(void *buf, FILE *fp)
 	if (ferror(fp) || feof(fp)) {
 		return FAIL;
 	}
+	self->pltt.data = self->pltt.buffer->data;
+
+	return OKAY;
+}
+
+static int
+nclr_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NCLR *self = buf;
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1) ||
+	    CREAD(&c, &self->pltt.header, 1)) {
+		return FAIL;
+	}
+
+	assert(self->header.magic == (magic_t)'NCLR');
+	assert(self->pltt.header.magic == (magic_t)'PLTT');
+
+	//assert(self->pltt.header.bit_depth == 4);
+	assert(self->pltt.header.data_offset == 16);
+
+	self->pltt.data = cursor_borrow(&c, self->pltt.header.data_size);
+	if (self->pltt.data == NULL) {
+		return FAIL;
+	}
 
 	return OKAY;
 }
@@ -77,6 +107,7 @@ nclr_free(void *buf) {
 	if (self != NULL &&
 	    self->header.magic == (magic_t)'NCLR') {
 		FREE(self->pltt.buffer);
+		self->pltt.data = NULL;
 	}
 }
 
@@ -84,6 +115,7 @@ struct format_info NCLR_format = {
 	format_header('NCLR', struct NCLR),
 
 	.read = nclr_read,
+	.read_mem = nclr_read_mem,
 	.free = nclr_free,
 };
 
@@ -95,7 +127,7 @@ nclr_get_palette(struct NCLR *self, int index)
 
 	struct PLTT *pltt = &self->pltt;
 
-	assert(pltt->buffer != NULL);
+	assert(pltt->data != NULL);
 
 	int count = 16;
 
@@ -117,14 +149,14 @@ nclr_get_palette(struct NCLR *self, int index)
 		return NULL;
 	}
 
-	assert(pltt->buffer->size >= sizeof(u16) * count);
+	assert(pltt->header.data_size >= sizeof(u16) * count);
 
 	palette->count = count;
 	palette->bit_depth = 5; // XXX
 
 	/* unpack the colors */
 
-	u16 *colors16 = (u16 *)pltt->buffer->data;
+	const u16 *colors16 = (const u16 *)pltt->data;
 	for (int i = 0; i < count; i++) {
 		palette->colors[i].r = colors16[i] & 0x1f;
 		palette->colors[i].g = (colors16[i] >> 5) & 0x1f;
@@ -13,7 +13,7 @@
 #include <sys/types.h> /* off_t */
 
 #include "common.h" /* OKAY, FAIL, ABORT, NOMEM, FREAD, assert, struct dim */
-#include "lzss.h" /* lzss_decompress_buffer */
+#include "lzss.h" /* lzss_check_data, lzss_decompress_to */
 #include "nitro.h"
 
 #include "narc.h" /* NARC_format */
@@ -73,29 +73,32 @@ strmagic(magic_t magic, char *buf)
 	return buf;
 }
 
-static void *
-nitro_read_nocompressed(FILE *fp, magic_t magic)
+/* the size of the object for a format */
+static size_t
+chunk_size(const struct format_info *fmt)
+{
+	return fmt->size > 0 ? fmt->size : sizeof(struct nitro);
+}
+
+/* look up a format, complaining if we don't know about it */
+static const struct format_info *
+lookup_or_warn(magic_t magic)
 {
-	void *chunk;
 	const struct format_info *fmt = format_lookup(magic);
 
 	if (fmt == NULL) {
 		warn("Unknown format: %08x", magic);
-		return NULL;
 	} else if (fmt->size == 0) {
 		char magic_buf[MAGIC_BUF_SIZE];
 		warn("Unsupported format: %s", strmagic(magic, magic_buf));
-		chunk = malloc(sizeof(struct nitro));
-	} else {
-		chunk = malloc(fmt->size);
-	}
-
-	if (chunk == NULL) {
-		return NULL;
 	}
+	return fmt;
+}
 
-	/* time to actually load it */
-
+/* set up a freshly allocated chunk */
+static int
+nitro_init(const struct format_info *fmt, void *chunk)
+{
 	// simply initializing the structure to all 0s would break on
 	// architectures where the null pointer != 0.
 	if (fmt->initializer != NULL) {
@@ -107,12 +110,33 @@ nitro_read_nocompressed(FILE *fp, magic_t magic)
 	}
 
 	if (fmt->init != NULL) {
-		if (fmt->init(chunk)) {
-			goto error;
-		}
+		return fmt->init(chunk);
 	} else {
 		/* it's already zeroed; there's nothing more to do */
 	}
+	return OKAY;
+}
+
+static void *
+nitro_read_nocompressed(FILE *fp, magic_t magic)
+{
+	void *chunk;
+	const struct format_info *fmt = lookup_or_warn(magic);
+
+	if (fmt == NULL) {
+		return NULL;
+	}
+
+	chunk = malloc(chunk_size(fmt));
+	if (chunk == NULL) {
+		return NULL;
+	}
+
+	/* time to actually load it */
+
+	if (nitro_init(fmt, chunk)) {
+		goto error;
+	}
 
 	if (fmt->read != NULL) {
 		switch (fmt->read(chunk, fp)) {
@@ -144,27 +168,135 @@ nitro_read_nocompressed(FILE *fp, magic_t magic)
 	return NULL;
 }
 
+/* Parse data into an already-allocated chunk */
+static int
+nitro_read_mem(const struct format_info *fmt, void *chunk, const u8 *data, size_t size)
+{
+	if (nitro_init(fmt, chunk)) {
+		return FAIL;
+	}
+
+	if (fmt->read_mem != NULL) {
+		switch (fmt->read_mem(chunk, data, size)) {
+		case OKAY:
+			break;
+		case ABORT:
+			return FAIL;
+		case FAIL:
+		case NOMEM:
+		default:
+			if (fmt->free != NULL) {
+				fmt->free(chunk);
+			}
+			return FAIL;
+		}
+	} else {
+		if (size < sizeof(struct nitro)) {
+			return FAIL;
+		}
+		memcpy(chunk, data, sizeof(struct nitro));
+	}
+
+	return OKAY;
+}
+
+/* The decompressed data is stored in the same allocation as the object,
+ * right after it, so the object can borrow from it like any other
+ * memory and it all goes away when the chunk is freed. We don't know
+ * the format until after decompressing, so leave room for the biggest. */
+static size_t
+decompressed_data_offset(void)
+{
+	const struct format_info * const *fmt = formats;
+	size_t size = sizeof(struct nitro);
+
+	for (; *fmt != NULL; fmt++) {
+		if (size < chunk_size(*fmt)) {
+			size = chunk_size(*fmt);
+		}
+	}
+
+	// round up to keep the data aligned
+	return (size + 15) & ~(size_t)15;
+}
+
 static void *
-nitro_read_compressed(struct buffer *buffer)
+nitro_read_compressed(const u8 *data, size_t size)
 {
-	struct buffer *decompressed = lzss_decompress_buffer(buffer);
-	FREE(buffer);
-	if (decompressed == NULL) {
+	size_t uncompressed_size = data[1] | data[2] << 8 | data[3] << 16;
+	if (uncompressed_size < sizeof(magic_t)) {
 		return NULL;
 	}
 
-	buffer = decompressed;
-
-	FILE *fp = fmemopen(buffer->data, buffer->size, "rb");
-	if (fp == NULL) {
+	size_t offset = decompressed_data_offset();
+	u8 *chunk = malloc(offset + uncompressed_size);
+	if (chunk == NULL) {
 		return NULL;
 	}
-	magic_t magic = *(magic_t *)buffer->data;
+
+	u8 *decompressed = chunk + offset;
+	if (lzss_decompress_to(data, size, decompressed, uncompressed_size)) {
+		goto error;
+	}
+
+	magic_t magic;
+	memcpy(&magic, decompressed, sizeof(magic));
+
 	// no recursing for us!
-	void *chunk = nitro_read_nocompressed(fp, magic);
-	fclose(fp);
-	FREE(buffer);
+	const struct format_info *fmt = lookup_or_warn(magic);
+	if (fmt == NULL) {
+		goto error;
+	}
+
+	if (nitro_read_mem(fmt, chunk, decompressed, uncompressed_size)) {
+		goto error;
+	}
+
 	return chunk;
+
+	error:
+	FREE(chunk);
+	return NULL;
+}
+
+/* Parse data kept in the tail of chunk, starting decompressed_data_offset()
+ * bytes in. The object owns the data, like a decompressed one would.
+ * Frees chunk on failure. */
+static void *
+nitro_read_in_place(u8 *chunk, const u8 *data, size_t size)
+{
+	if (size < sizeof(magic_t)) {
+		goto error;
+	}
+
+	int b = data[0];
+	if (b == 0x10 || b == 0x11) {
+		//probably compressed data
+		void *obj = NULL;
+		if (lzss_check_data(data, size)) {
+			obj = nitro_read_compressed(data, size);
+		}
+		FREE(chunk);
+		return obj;
+	}
+
+	magic_t magic;
+	memcpy(&magic, data, sizeof(magic));
+
+	const struct format_info *fmt = lookup_or_warn(magic);
+	if (fmt == NULL) {
+		goto error;
+	}
+
+	if (nitro_read_mem(fmt, chunk, data, size)) {
+		goto error;
+	}
+
+	return chunk;
+
+	error:
+	FREE(chunk);
+	return NULL;
 }
 
 /* XXX get rid of the size parameter somehow */
@@ -192,14 +324,11 @@ nitro_read(FILE *fp, off_t size)
 		if (fread(buffer->data, 1, size, fp) != size) {
 			return NULL;
 		}
-		if (lzss_check(buffer)) {
-			// nitro_read_compressed will free the buffer
-			return nitro_read_compressed(buffer);
-		} else {
-			// no idea what the file is -- bail
-			FREE(buffer);
-			return NULL;
-		}
+		// compressed data is never borrowed, so it's safe to
+		// free the buffer right away
+		void *chunk = nitro_read_buffer(buffer->data, buffer->size);
+		FREE(buffer);
+		return chunk;
 	}
 
 	return nitro_read_nocompressed(fp, magic);
@@ -219,3 +348,78 @@ nitro_free(void *chunk)
 	}
 }
 
+int
+nitro_probe(const u8 *data, size_t size, struct nitro_probe *info)
+{
+	assert(data != NULL);
+	assert(info != NULL);
+
+	if (size < sizeof(magic_t)) {
+		return FAIL;
+	}
+	memcpy(&info->magic, data, sizeof(magic_t));
+
+	// unknown formats are fine; there's just nothing more to say
+	const struct format_info *fmt = format_lookup(info->magic);
+	if (fmt != NULL && fmt->probe != NULL) {
+		return fmt->probe(data, size, info);
+	}
+	return OKAY;
+}
+
+/* Like nitro_read, but the data comes from memory - e.g. a mapped NARC -
+ * and is parsed in place. */
+void *
+nitro_read_buffer(const u8 *data, size_t size)
+{
+	assert(data != NULL);
+
+	if (size < sizeof(magic_t)) {
+		return NULL;
+	}
+
+	int b = data[0];
+	if (b == 0x10 || b == 0x11) {
+		//probably compressed data
+		if (lzss_check_data(data, size)) {
+			return nitro_read_compressed(data, size);
+		} else {
+			// no idea what the file is -- bail
+			return NULL;
+		}
+	}
+
+	magic_t magic;
+	memcpy(&magic, data, sizeof(magic));
+
+	const struct format_info *fmt = lookup_or_warn(magic);
+	if (fmt == NULL) {
+		return NULL;
+	}
+
+	void *chunk = malloc(chunk_size(fmt));
+	if (chunk == NULL) {
+		return NULL;
+	}
+
+	if (nitro_read_mem(fmt, chunk, data, size)) {
+		FREE(chunk);
+	}
+
+	return chunk;
+}
+
+void *
+nitro_read_buffer_copy(const u8 *data, size_t size)
+{
+	assert(data != NULL);
+
+	size_t offset = decompressed_data_offset();
+	u8 *chunk = malloc(offset + size);
+	if (chunk == NULL) {
+		return NULL;
+	}
+
+	memcpy(chunk + offset, data, size);
+	return nitro_read_in_place(chunk, chunk + offset, size);
+}
@@ -8,6 +8,7 @@
 #define NITRO_H
 
 #include <stdio.h> /* FILE */
+#include <string.h> /* memcpy */
 #include <sys/types.h> /* off_t */
 
 #include "common.h" /* struct dim, u8, u16, u32, s16 */
@@ -51,6 +52,28 @@ struct OBJ {
 // obj_sizes [size][shape]
 extern struct dim obj_sizes[4][4];
 
+// What can be told about a file from its first NITRO_PROBE_SIZE bytes,
+// without loading it. The format-specific fields are zero when they don't
+// apply.
+struct nitro_probe {
+	magic_t magic;
+
+	// the size of the file as stored, and once decompressed
+	u32 size;
+	u32 uncompressed_size;
+	// LZSS10 or LZSS11 (see lzss.h), or -1 if it isn't compressed
+	int compression;
+
+	// NCGR: the dimensions of the image, and bits per pixel
+	struct dim dim;
+	int bit_depth;
+
+	// NCER: the number of cells. NANR, NMAR: the number of acells.
+	int cell_count;
+};
+
+#define NITRO_PROBE_SIZE 64
+
 struct format_info {
 	magic_t magic;
 
@@ -59,9 +82,49 @@ struct format_info {
 
 	int (*init)(void *);
 	int (*read)(void *, FILE *);
+	// Objects read from memory may keep pointers into the data
+	// instead of copying it.
+	int (*read_mem)(void *, const u8 *, size_t);
 	void (*free)(void *);
+	// Fill in the format-specific fields of a probe from the start of
+	// a file. Optional.
+	int (*probe)(const u8 *, size_t, struct nitro_probe *);
+};
+
+// A cursor is the read_mem equivalent of a FILE.
+struct cursor {
+	const u8 *data;
+	size_t size;
+	size_t pos;
 };
 
+// Copy n bytes out of the cursor. Fails if there aren't enough left.
+static inline int
+cursor_read(struct cursor *c, void *dest, size_t n)
+{
+	if (c->size - c->pos < n) {
+		return FAIL;
+	}
+	memcpy(dest, c->data + c->pos, n);
+	c->pos += n;
+	return OKAY;
+}
+
+// Borrow n bytes from the cursor. Returns NULL if there aren't enough left.
+static inline const u8 *
+cursor_borrow(struct cursor *c, size_t n)
+{
+	if (c->size - c->pos < n) {
+		return NULL;
+	}
+	const u8 *p = c->data + c->pos;
+	c->pos += n;
+	return p;
+}
+
+// CREAD is FREAD for cursors
+#define CREAD(c, x, nmemb) (cursor_read(c, x, sizeof(*(x)) * (nmemb)))
+
 //extern const struct format_info * const formats[];
 
 #define format_header(magic_, type) \
@@ -74,7 +137,15 @@ struct format_info {
 extern const struct format_info *format_lookup(magic_t magic);
 // size may be zero unless you're reading compressed data
 extern void *nitro_read(FILE *fp, off_t size);
+// read from memory. the object may keep pointers into data, so data
+// has to outlive it (compressed data is the exception)
+extern void *nitro_read_buffer(const u8 *data, size_t size);
+// like nitro_read_buffer, but the object gets its own copy of the data
+extern void *nitro_read_buffer_copy(const u8 *data, size_t size);
 extern void nitro_free(void *chunk);
+// find out what we can from the first few bytes of an uncompressed file;
+// only the format-specific fields and the magic are filled in
+extern int nitro_probe(const u8 *data, size_t size, struct nitro_probe *info);
 
 static inline magic_t
 nitro_get_magic(void *chunk)
@@ -13,6 +13,7 @@
 #include "nmcr.h" /* struct NMCR */
 #include "ncgr.h" /* struct NCGR */
 #include "ncer.h" /* struct NCER */
+#include "nclr.h" /* struct NCLR */
 
 struct NMAR;
 
@@ -22,6 +23,7 @@ extern struct format_info NMAR_format;
 
 extern int nmar_get_cell_count(struct NMAR *self);
 extern int nmar_get_period(struct NMAR *self, int acell_index);
+extern int nmar_get_step(struct NMAR *self, int acell_index, struct NANR *nanr);
 extern int nmar_draw_frame(struct NMAR *self, int acell_index, int frame_index, int tick,
                            struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
                            struct image *image, struct coords offset);
@@ -29,4 +31,28 @@ extern int nmar_draw(struct NMAR *self, int acell_index, int tick,
                      struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
                      struct image *image, struct coords offset);
 
+/* Called with each frame of an animation. The image is reused for the
+ * next frame, so copy anything you want to keep. Return nonzero to stop. */
+typedef int nmar_frame_sink(void *ctx, struct image *frame, int tick);
+
+extern int nmar_render_animation(struct NMAR *self, int acell_index, int step,
+                                 struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
+                                 struct NCLR *nclr, struct dim dim, struct coords offset,
+                                 nmar_frame_sink *sink, void *ctx);
+extern int nmar_save_gif(struct NMAR *self, int acell_index,
+                         struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
+                         struct NCLR *nclr, struct dim dim, struct coords offset,
+                         const char *filename);
+
+/* what nmar_save_animations writes */
+enum nmar_format {
+	NMAR_GIF,
+	NMAR_APNG,
+};
+
+extern int nmar_save_animations(struct NMAR *self, int acell_index,
+                                struct NMCR *nmcr, struct NANR *nanr, struct NCER *ncer, struct NCGR *ncgr,
+                                struct NCLR *const nclrs[], struct dim dim, struct coords offset,
+                                enum nmar_format format, const char *const filenames[], int n);
+
 #endif /* NANR_H */
@@ -55,6 +55,20 @@ struct NMCR {
 };
 
 
+/* point the tables at the data following the header */
+static void
+mcbk_set_tables(struct MCBK *self, const u8 *data)
+{
+	size_t base = sizeof(self->header) - 8;
+	assert(base == 0x14);
+
+	/* XXX bounds checks - invalid data could walk all over memory */
+	self->map_headers = (struct map_header *)(data +
+	    (self->header.header_offset - base));
+	self->map_data = (struct map_data *)(data +
+	    (self->header.data_offset - base));
+}
+
 static int
 nmcr_read(void *buf, FILE *fp)
 {
@@ -79,14 +93,36 @@ nmcr_read(void *buf, FILE *fp)
 		return FAIL;
 	}
 
-	size_t base = sizeof(self->mcbk.header) - 8;
-	assert(base == 0x14);
+	mcbk_set_tables(&self->mcbk, self->mcbk.data->data);
 
-	/* XXX bounds checks - invalid data could walk all over memory */
-	self->mcbk.map_headers = (struct map_header *)(self->mcbk.data->data +
-	    (self->mcbk.header.header_offset - base));
-	self->mcbk.map_data = (struct map_data *)(self->mcbk.data->data +
-	    (self->mcbk.header.data_offset - base));
+	return OKAY;
+}
+
+/* The tables are borrowed, not copied; mcbk.data stays NULL. */
+static int
+nmcr_read_mem(void *buf, const u8 *data, size_t size)
+{
+	struct NMCR *self = buf;
+	assert(self != NULL);
+
+	struct cursor c = {data, size, 0};
+
+	if (CREAD(&c, &self->header, 1)) {
+		return FAIL;
+	}
+	assert(self->header.magic == NMCR_MAGIC);
+
+	if (CREAD(&c, &self->mcbk.header, 1)) {
+		return FAIL;
+	}
+
+	size_t data_size = self->mcbk.header.size - sizeof(self->mcbk.header);
+	const u8 *tables = cursor_borrow(&c, data_size);
+	if (tables == NULL) {
+		return FAIL;
+	}
+
+	mcbk_set_tables(&self->mcbk, tables);
 
 	return OKAY;
 }
@@ -105,6 +141,7 @@ struct format_info NMCR_format = {
 	format_header(NMCR_MAGIC, struct NMCR),
 	
 	.read = nmcr_read,
+	.read_mem = nmcr_read_mem,
 	.free = nmcr_free,
 };
 
@@ -0,0 +1,179 @@
+/* pool.c - A small work-stealing thread pool
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <stdlib.h> /* NULL, calloc, free */
+#include <pthread.h> /* pthread_create, pthread_join, pthread_mutex_*, pthread_once, pthread_key_create, pthread_getspecific, pthread_setspecific */
+
+#include "common.h" /* OKAY, NOMEM, CALLOC, FREE, warn */
+#include "pool.h"
+
+/* Each thread owns a range of tasks. It takes tasks from the front of
+ * its own range; once that runs dry, it steals the back half of
+ * someone else's. */
+struct queue {
+	pthread_mutex_t lock;
+	struct pool *pool;
+	int next;
+	int end;
+};
+
+struct pool {
+	pool_task *task;
+	void *ctx;
+	struct queue *queues;
+	pthread_t *threads;
+	int jobs;
+	int started; /* threads actually running, counting the caller */
+};
+
+/* Set (to the pool) on a thread while it runs a pool's tasks. A task
+ * which runs a pool of its own gets its tasks run in order instead: the
+ * outer pool already has a thread per job busy, and starting jobs more
+ * for each of them would only have them all fighting over the cpus. */
+static pthread_key_t current_pool;
+static pthread_once_t current_pool_once = PTHREAD_ONCE_INIT;
+
+static void
+make_current_pool(void)
+{
+	if (pthread_key_create(&current_pool, NULL)) {
+		warn("pool: could not create thread key");
+	}
+}
+
+/* take the next task from our own range */
+static int
+take(struct queue *q, int *n)
+{
+	int found = 0;
+	pthread_mutex_lock(&q->lock);
+	if (q->next < q->end) {
+		*n = q->next++;
+		found = 1;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+/* steal the back half of another thread's range, rounding up so that a
+ * last task is stolen too, and take the first task of it */
+static int
+steal(struct queue *self, int *n)
+{
+	struct pool *pool = self->pool;
+	int me = self - pool->queues;
+
+	for (int i = 1; i < pool->jobs; i++) {
+		struct queue *victim = &pool->queues[(me + i) % pool->jobs];
+		int begin, end;
+
+		pthread_mutex_lock(&victim->lock);
+		end = victim->end;
+		begin = end - (end - victim->next + 1) / 2;
+		if (begin < end) {
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin < end) {
+			pthread_mutex_lock(&self->lock);
+			*n = begin;
+			self->next = begin + 1;
+			self->end = end;
+			pthread_mutex_unlock(&self->lock);
+			return 1;
+		}
+	}
+
+	// nothing left to steal. there may still be tasks running, but
+	// no more will be handed out.
+	return 0;
+}
+
+static void *
+work(void *arg)
+{
+	struct queue *q = arg;
+	struct pool *pool = q->pool;
+	int worker = q - pool->queues;
+	int n;
+
+	pthread_setspecific(current_pool, pool);
+
+	while (take(q, &n) || steal(q, &n)) {
+		pool->task(pool->ctx, worker, n);
+	}
+
+	pthread_setspecific(current_pool, NULL);
+	return NULL;
+}
+
+int
+pool_run(int jobs, int begin, int end, pool_task *task, void *ctx)
+{
+	assert(task != NULL);
+
+	if (end - begin < jobs) {
+		jobs = end - begin;
+	}
+
+	pthread_once(&current_pool_once, make_current_pool);
+	if (pthread_getspecific(current_pool) != NULL) {
+		jobs = 1;
+	}
+
+	if (jobs <= 1) {
+		for (int n = begin; n < end; n++) {
+			task(ctx, 0, n);
+		}
+		return OKAY;
+	}
+
+	struct pool pool = {.task = task, .ctx = ctx, .jobs = jobs};
+	CALLOC(pool.queues, jobs);
+	CALLOC(pool.threads, jobs);
+	if (pool.queues == NULL || pool.threads == NULL) {
+		FREE(pool.queues);
+		FREE(pool.threads);
+		return NOMEM;
+	}
+
+	// split the tasks evenly to start with
+	for (int i = 0; i < jobs; i++) {
+		struct queue *q = &pool.queues[i];
+		pthread_mutex_init(&q->lock, NULL);
+		q->pool = &pool;
+		q->next = begin + (int)((long long)(end - begin) * i / jobs);
+		q->end = begin + (int)((long long)(end - begin) * (i + 1) / jobs);
+	}
+
+	// the calling thread is worker 0. if a thread can't be started,
+	// the others will steal its tasks.
+	for (pool.started = 1; pool.started < jobs; pool.started++) {
+		int i = pool.started;
+		if (pthread_create(&pool.threads[i], NULL, work, &pool.queues[i])) {
+			warn("pool: could not start thread %d", i);
+			break;
+		}
+	}
+
+	work(&pool.queues[0]);
+
+	for (int i = 1; i < pool.started; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+
+	for (int i = 0; i < jobs; i++) {
+		pthread_mutex_destroy(&pool.queues[i].lock);
+	}
+
+	FREE(pool.queues);
+	FREE(pool.threads);
+
+	return OKAY;
+}
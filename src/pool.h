@@ -0,0 +1,21 @@
+/*
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+/* A task is called once for each n in [begin, end). worker is the index
+ * of the thread running it, from 0 to jobs-1, so tasks can keep
+ * per-thread state in an array. */
+typedef void pool_task(void *ctx, int worker, int n);
+
+/* Run the tasks on jobs threads (including the calling thread) and wait
+ * for them all to finish. Idle threads steal work from busy ones. With
+ * jobs <= 1, or when called from a task of another pool, the tasks run in
+ * order on the calling thread. */
+extern int pool_run(int jobs, int begin, int end, pool_task *task, void *ctx);
+
+#endif /* POOL_H */
@@ -18,8 +18,10 @@
 #include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS, NULL, exit */
 #include <stdio.h> /* FILE, fclose, fopen, fwrite, perror, printf, sprintf */
 //#include <stdarg.h> /* va_list, va_end, va_start */
-#include <string.h> /* strcat */
+#include <stdbool.h> /* bool, true, false */
+#include <string.h> /* strcat, strcmp, strncmp */
 #include <limits.h> /* INT_MAX */
+#include <ctype.h> /* isalnum */
 
 #ifdef _WIN32
 # include <direct.h> /* _mkdir */
@@ -29,6 +31,7 @@
 #endif
 
 #include <errno.h> /* EEXIST, errno */
+#include <pthread.h> /* pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock */
 
 #include "common.h" /* FREE, ... */
 #include "image.h"
@@ -39,6 +42,11 @@
 #include "ncgr.h"
 #include "nclr.h"
 #include "ncer.h"
+#include "nanr.h"
+#include "nmcr.h"
+#include "nmar.h"
+#include "pool.h"
+#include "diskcache.h"
 
 #define MKDIR(dir) \
 	if (mkdir(OUTDIR "/" dir, 0755)) { \
@@ -80,6 +88,9 @@ open_narc(const char *filename)
 		goto error;
 	}
 
+	// load files straight out of memory if we can
+	narc_map(narc);
+
 	return narc;
 
 	error:
@@ -127,7 +138,7 @@ list(void)
 	#define FILENAME "./Resources/Narcs/pokegra.narc"
 	#define OUTDIR "./Out/test"
 	struct NARC *narc;
-	struct nitro *chunk;
+	magic_t magic;
 
 	narc = open_narc(FILENAME);
 
@@ -136,9 +147,10 @@ list(void)
 	for (int i = 0; i < (int)count; i++) {
 		u32 size = narc_get_file_size(narc, i);
 		if (0 < size) {
-			chunk = narc_load_file(narc, i);
-			if (chunk != NULL) {
-				printf("%3d %s\n", i, STRMAGIC(nitro_get_magic(chunk)));
+			// only the magic is needed, so don't load the whole file
+			if (!narc_get_file_magic(narc, i, &magic) &&
+			    format_lookup(magic) != NULL) {
+				printf("%3d %s\n", i, STRMAGIC(magic));
 			} else {
 				printf("%3d (error)\n", i);
 			}
@@ -150,6 +162,83 @@ list(void)
 	exit(EXIT_SUCCESS);
 }
 
+/* Print what's in a NARC, one line per file, as tab-separated values or
+ * as JSON. Only the headers of the files are read, so it's quick. */
+static void
+inventory(const char *filename, bool json)
+{
+	struct NARC *narc = open_narc(filename);
+
+	static const char *compression_names[] = {
+		[LZSS10] = "lzss10",
+		[LZSS11] = "lzss11",
+	};
+
+	if (json) {
+		printf("[\n");
+	} else {
+		printf("index\tmagic\tsize\tuncompressed_size\tcompression"
+		       "\twidth\theight\tbit_depth\tcell_count\n");
+	}
+
+	u32 count = narc_get_file_count(narc);
+	assert(count <= INT_MAX);
+	for (int i = 0; i < (int)count; i++) {
+		struct nitro_probe info;
+		bool ok = !narc_probe(narc, i, &info);
+
+		// magic numbers can be any bytes at all
+		char magic[MAGIC_BUF_SIZE];
+		strmagic(info.magic, magic);
+		for (char *p = magic; *p != '\0'; p++) {
+			if (!isalnum((unsigned char)*p)) {
+				*p = '?';
+			}
+		}
+
+		const char *compression = info.compression < 0 ? "none"
+		                        : compression_names[info.compression];
+
+		if (json) {
+			printf("  {\"index\": %d, ", i);
+			if (ok && info.magic != 0) {
+				printf("\"magic\": \"%s\", ", magic);
+			} else {
+				printf("\"magic\": null, ");
+			}
+			printf("\"size\": %lu, \"uncompressed_size\": %lu, "
+			       "\"compression\": \"%s\"",
+			       (unsigned long)info.size,
+			       (unsigned long)info.uncompressed_size,
+			       compression);
+			if (info.bit_depth != 0) {
+				printf(", \"width\": %d, \"height\": %d, \"bit_depth\": %d",
+				       info.dim.width, info.dim.height, info.bit_depth);
+			}
+			if (info.cell_count != 0) {
+				printf(", \"cell_count\": %d", info.cell_count);
+			}
+			if (!ok) {
+				printf(", \"error\": true");
+			}
+			printf("}%s\n", i + 1 < (int)count ? "," : "");
+		} else {
+			printf("%d\t%s\t%lu\t%lu\t%s\t%d\t%d\t%d\t%d\n", i,
+			       !ok ? "(error)" : info.magic == 0 ? "(empty)" : magic,
+			       (unsigned long)info.size,
+			       (unsigned long)info.uncompressed_size,
+			       compression,
+			       info.dim.width, info.dim.height, info.bit_depth,
+			       info.cell_count);
+		}
+	}
+
+	if (json) {
+		printf("]\n");
+	}
+
+	exit(EXIT_SUCCESS);
+}
 
 static void
 write_sprite(struct image *image, char *outfile)
@@ -166,15 +255,167 @@ write_sprite(struct image *image, char *outfile)
 	}
 }
 
+/* Like write_sprite, but once with each of two palettes - e.g. normal
+ * and shiny. The pixels are only compressed once. */
 static void
-rip_sprites(void)
+write_sprite_pair(struct image *image,
+                  struct palette *palette1, char *outfile1,
+                  struct palette *palette2, char *outfile2)
 {
-	#define FILENAME "./Resources/Narcs/pokegra.narc"
-	#define OUTDIR "./Out/test"
-	struct NARC *narc = open_narc(FILENAME);
+	struct palette *palettes[2];
+	char *outfiles[2];
+	FILE *fps[2];
+	int n = 0;
+
+	strcat(outfile1, ".png");
+	strcat(outfile2, ".png");
+	palettes[0] = palette1;
+	palettes[1] = palette2;
+	outfiles[0] = outfile1;
+	outfiles[1] = outfile2;
+
+	for (int i = 0; i < 2; i++) {
+		fps[n] = fopen(outfiles[i], "wb");
+		if (fps[n] == NULL) {
+			perror(outfiles[i]);
+			continue;
+		}
+		palettes[n] = palettes[i];
+		outfiles[n] = outfiles[i];
+		n++;
+	}
+
+	if (n > 0 && image_write_png_multi(image, palettes, fps, n)) {
+		warn("Error writing %s.", outfiles[0]);
+	}
+	for (int i = 0; i < n; i++) {
+		fclose(fps[i]);
+	}
+}
+
+/******************************************************************************/
+
+/* number of threads to rip with; set with -j */
+static int jobs = 1;
+
+/* what to save animations as; set with --anim */
+static enum nmar_format anim_format = NMAR_GIF;
+
+/* A batch is a numbered list of things to rip, each of which is ripped
+ * by a task. The files the tasks have in common are loaded once, up
+ * front. Ripping doesn't modify any of them, so all the threads share
+ * them. */
+struct batch {
+	const char *narc_filename;
+	const char *ncer_filename;
+
+	/* called once to load any other files the tasks need */
+	void (*setup)(struct batch *batch);
+
+	void (*task)(struct batch *batch, int n);
+
+	struct NARC *narc;
+	struct NCER *ncer;
+	struct NCLR *nclr;
+
+	/* decoded files from earlier runs; NULL unless RIP_CACHE_DIR is set */
+	struct disk_cache *disk_cache;
+
+	/* tasks which gave up on the whole batch; guarded by batch_lock */
+	size_t failures;
+};
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+batch_init(struct batch *batch)
+{
+	batch->narc = open_narc(batch->narc_filename);
+	batch->disk_cache = disk_cache_open(batch->narc);
+	if (batch->ncer_filename != NULL) {
+		batch->ncer = open_nitro(batch->ncer_filename, 'NCER');
+	}
+	if (batch->setup != NULL) {
+		batch->setup(batch);
+	}
+}
+
+/* Give up on the batch from inside a task. Other threads may be halfway
+ * through writing their files, and exiting now would cut them short, so
+ * the rest of the tasks are skipped and batch_run exits once the running
+ * ones have finished. */
+static void
+batch_fail(struct batch *batch)
+{
+	pthread_mutex_lock(&batch_lock);
+	batch->failures++;
+	pthread_mutex_unlock(&batch_lock);
+}
+
+static bool
+batch_failed(struct batch *batch)
+{
+	pthread_mutex_lock(&batch_lock);
+	bool failed = batch->failures > 0;
+	pthread_mutex_unlock(&batch_lock);
+	return failed;
+}
+
+static void
+batch_task(void *ctx, int worker, int n)
+{
+	struct batch *batch = ctx;
+	(void)worker;
+	if (!batch_failed(batch)) {
+		batch->task(batch, n);
+	}
+}
+
+/* rip n for n in [begin, end) and clean up */
+static void
+batch_run(struct batch *batch, int begin, int end, void (*task)(struct batch *, int))
+{
+	if (batch->narc == NULL) {
+		batch_init(batch);
+	}
+
+	batch->task = task;
+	if (pool_run(jobs, begin, end, batch_task, batch)) {
+		warn("Out of memory");
+		exit(EXIT_FAILURE);
+	}
+	if (batch->failures > 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (batch->ncer != NULL) {
+		nitro_free(batch->ncer);
+		FREE(batch->ncer);
+	}
+	if (batch->nclr != NULL) {
+		nitro_free(batch->nclr);
+		FREE(batch->nclr);
+	}
+
+	disk_cache_close(batch->disk_cache);
+	batch->disk_cache = NULL;
+
+	nitro_free(batch->narc);
+	FREE(batch->narc);
+}
+
+/******************************************************************************/
+
+#define FILENAME "./Resources/Narcs/pokegra.narc"
+#define OUTDIR "./Out/test"
+static void
+rip_sprites_task(struct batch *batch, int n)
+{
+	struct NARC *narc = batch->narc;
 	char outfile[256] = "";
+	char shiny_outfile[256] = "";
 
-	const struct sprite_dirs {
+	static const struct sprite_dirs {
 		const char *normal;
 		const char *shiny;
 	} dirs[] = {
@@ -183,102 +424,89 @@ rip_sprites(void)
 		{"female", "shiny/female"},
 		{"", "shiny"},
 	};
-	MKDIR("")
-	MKDIR("female")
-	MKDIR("shiny")
-	MKDIR("shiny/female")
-	MKDIR("back")
-	MKDIR("back/female")
-	MKDIR("back/shiny")
-	MKDIR("back/shiny/female")
 
 	struct image image = {};
 
-	for (int n = 1; n <= 493; n++) {
-		struct NCLR *normal_nclr = narc_load_file(narc, n*6 + 4);
-		struct NCLR *shiny_nclr = narc_load_file(narc, n*6 + 5);
+	struct palette *normal_palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*6 + 4);
+	struct palette *shiny_palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*6 + 5);
 
-		if (normal_nclr == NULL || shiny_nclr == NULL) {
-			if (errno) perror(NULL);
-			else warn("Error reading palettes.");
-			exit(EXIT_FAILURE);
+	if (normal_palette == NULL || shiny_palette == NULL) {
+		if (errno) perror(NULL);
+		else warn("Error loading palettes.");
+		if (normal_palette != NULL) {
+			FREE(normal_palette->colors);
+			FREE(normal_palette);
 		}
-
-		assert(nitro_get_magic(normal_nclr) == (magic_t)'NCLR');
-		assert(nitro_get_magic(shiny_nclr) == (magic_t)'NCLR');
-
-		struct palette *normal_palette = nclr_get_palette(normal_nclr, 0);
-		struct palette *shiny_palette = nclr_get_palette(shiny_nclr, 0);
-
-		nitro_free(normal_nclr);
-		nitro_free(shiny_nclr);
-
-		FREE(normal_nclr);
-		FREE(shiny_nclr);
-
-		if (normal_palette == NULL || shiny_palette == NULL) {
-			if (errno) perror(NULL);
-			else warn("Error loading palettes.");
-			exit(EXIT_FAILURE);
+		if (shiny_palette != NULL) {
+			FREE(shiny_palette->colors);
+			FREE(shiny_palette);
 		}
+		batch_fail(batch);
+		return;
+	}
 
-		for (int i = 0; i < 4; i++) {
-			const struct sprite_dirs *d = &dirs[i];
-
-			struct NCGR *ncgr = narc_load_file(narc, n*6 + i);
-			if (ncgr == NULL) {
-				// this is fine
-				continue;
-			}
+	for (int i = 0; i < 4; i++) {
+		const struct sprite_dirs *d = &dirs[i];
 
-			assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
-			ncgr_decrypt_pt(ncgr);
+		if (narc_get_file_size(narc, n*6 + i) == 0) {
+			// this is fine
+			continue;
+		}
 
-			sprintf(outfile, "%s/%s/%d", OUTDIR, d->normal, n);
+		sprintf(outfile, "%s/%s/%d", OUTDIR, d->normal, n);
 
-			image.pixels = ncgr_get_pixels(ncgr);
-			if (image.pixels == NULL) {
-				warn("Error ripping %s.", outfile);
-				continue;
-			}
+		image.pixels = disk_cache_load_pixels(batch->disk_cache, batch->narc, n*6 + i, CRYPT_PT, &image.dim);
+		if (image.pixels == NULL) {
+			warn("Error ripping %s.", outfile);
+			continue;
+		}
 
-			ncgr_get_dim(ncgr, &image.dim);
+		sprintf(shiny_outfile, "%s/%s/%d", OUTDIR, d->shiny, n);
+		write_sprite_pair(&image, normal_palette, outfile,
+		                  shiny_palette, shiny_outfile);
 
-			nitro_free(ncgr);
-			FREE(ncgr);
+		FREE(image.pixels);
+	}
 
-			image.palette = normal_palette;
-			write_sprite(&image, outfile);
+	FREE(normal_palette->colors);
+	FREE(shiny_palette->colors);
 
-			sprintf(outfile, "%s/%s/%d", OUTDIR, d->shiny, n);
-			image.palette = shiny_palette;
-			write_sprite(&image, outfile);
+	FREE(normal_palette);
+	FREE(shiny_palette);
+}
 
-			FREE(image.pixels);
-		}
+static void
+rip_sprites(void)
+{
+	struct batch batch = {.narc_filename = FILENAME};
 
-		FREE(normal_palette->colors);
-		FREE(shiny_palette->colors);
+	MKDIR("")
+	MKDIR("female")
+	MKDIR("shiny")
+	MKDIR("shiny/female")
+	MKDIR("back")
+	MKDIR("back/female")
+	MKDIR("back/shiny")
+	MKDIR("back/shiny/female")
 
-		FREE(normal_palette);
-		FREE(shiny_palette);
-	}
+	batch_run(&batch, 1, 493 + 1, rip_sprites_task);
 
 	printf("done\n");
 	exit(EXIT_SUCCESS);
 }
 
+#define FILENAME "./Resources/Narcs/pokegra-w.narc"
+#define OUTDIR "./Out/Sprites"
 static void
-rip_bw_sprites(void)
+rip_bw_sprites_task(struct batch *batch, int n)
 {
-	#define FILENAME "./Resources/Narcs/pokegra-w.narc"
-	#define OUTDIR "./Out/Sprites"
-	struct NARC *narc = open_narc(FILENAME);
-	struct NCER *ncer = open_nitro("./Resources/bw-pokemon.ncer", 'NCER');
+	struct NARC *narc = batch->narc;
+	struct NCER *ncer = batch->ncer;
 
 	char outfile[256] = "";
+	char shiny_outfile[256] = "";
 
-	const struct sprite_dirs {
+	static const struct sprite_dirs {
 		const char *normal;
 		const char *shiny;
 	} dirs[] = {
@@ -288,162 +516,146 @@ rip_bw_sprites(void)
 		{"back/female", "back/shiny/female"},
 	};
 
-	MKDIR("")
-	MKDIR("female")
-	MKDIR("shiny")
-	MKDIR("shiny/female")
-	MKDIR("back")
-	MKDIR("back/female")
-	MKDIR("back/shiny")
-	MKDIR("back/shiny/female")
-
 	struct image image = {};
 
-	for (int n = 0; n <= 711; n++) {
-		struct NCLR *normal_nclr = narc_load_file(narc, n*20 + 18);
-		struct NCLR *shiny_nclr = narc_load_file(narc, n*20 + 19);
+	struct palette *normal_palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*20 + 18);
+	struct palette *shiny_palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*20 + 19);
 
-		if (normal_nclr == NULL || shiny_nclr == NULL) {
-			if (errno) perror(NULL);
-			else warn("Error reading palettes.");
-			exit(EXIT_FAILURE);
+	if (normal_palette == NULL || shiny_palette == NULL) {
+		if (errno) perror(NULL);
+		else warn("Error loading palettes.");
+		if (normal_palette != NULL) {
+			FREE(normal_palette->colors);
+			FREE(normal_palette);
 		}
+		if (shiny_palette != NULL) {
+			FREE(shiny_palette->colors);
+			FREE(shiny_palette);
+		}
+		batch_fail(batch);
+		return;
+	}
 
-		assert(nitro_get_magic(normal_nclr) == (magic_t)'NCLR');
-		assert(nitro_get_magic(shiny_nclr) == (magic_t)'NCLR');
-
-		struct palette *normal_palette = nclr_get_palette(normal_nclr, 0);
-		struct palette *shiny_palette = nclr_get_palette(shiny_nclr, 0);
-
-		nitro_free(normal_nclr);
-		nitro_free(shiny_nclr);
-
-		FREE(normal_nclr);
-		FREE(shiny_nclr);
+	for (int i = 0; i < 4; i++) {
+		const struct sprite_dirs *d = &dirs[i];
 
-		if (normal_palette == NULL || shiny_palette == NULL) {
-			if (errno) perror(NULL);
-			else warn("Error loading palettes.");
-			exit(EXIT_FAILURE);
+		struct NCGR *ncgr;
+		int index = 0;
+		switch (i) {
+		case 0: case 1: index = n * 20 + i; break;
+		case 2: case 3: index = n * 20 + 9 + (i - 2); break;
+		}
+		if (narc_get_file_size(narc, index) == 0) {
+			// this is fine
+			continue;
+		}
+		ncgr = narc_load_file(narc, index);
+		if (ncgr == NULL) {
+			warn("error getting file %d", index);
+			continue;
 		}
 
-		for (int i = 0; i < 4; i++) {
-			const struct sprite_dirs *d = &dirs[i];
+		assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
 
-			struct NCGR *ncgr;
-			int index = 0;
-			switch (i) {
-			case 0: case 1: index = n * 20 + i; break;
-			case 2: case 3: index = n * 20 + 9 + (i - 2); break;
-			}
-			if (narc_get_file_size(narc, index) == 0) {
-				// this is fine
-				continue;
-			}
-			ncgr = narc_load_file(narc, index);
-			if (ncgr == NULL) {
-				warn("error getting file %d", index);
-				continue;
-			}
+		sprintf(outfile, "%s/%s/%d", OUTDIR, d->normal, n);
 
-			assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+		ncgr_get_dim(ncgr, &image.dim);
 
-			sprintf(outfile, "%s/%s/%d", OUTDIR, d->normal, n);
+		image.pixels = buffer_alloc(image.dim.height * image.dim.width);
+		if (image.pixels == NULL) {
+			warn("Error ripping %s.", outfile);
+			continue;
+		}
 
-			ncgr_get_dim(ncgr, &image.dim);
+		struct coords offset = {0,0};
+		if (ncer_draw_cell(ncer, 0, ncgr, &image, offset)) {
+			warn("error drawing cell");
+		}
+		/* if (ncer_draw_boxes(ncer, 0, &image, offset)) {
+			warn("error drawing boxes");
+		} */
 
-			image.pixels = buffer_alloc(image.dim.height * image.dim.width);
-			if (image.pixels == NULL) {
-				warn("Error ripping %s.", outfile);
-				continue;
-			}
+		nitro_free(ncgr);
+		FREE(ncgr);
 
-			struct coords offset = {0,0};
-			if (ncer_draw_cell(ncer, 0, ncgr, &image, offset)) {
-				warn("error drawing cell");
-			}
-			/* if (ncer_draw_boxes(ncer, 0, &image, offset)) {
-				warn("error drawing boxes");
-			} */
+		sprintf(shiny_outfile, "%s/%s/%d", OUTDIR, d->shiny, n);
+		write_sprite_pair(&image, normal_palette, outfile,
+		                  shiny_palette, shiny_outfile);
 
-			nitro_free(ncgr);
-			FREE(ncgr);
+		FREE(image.pixels);
+	}
 
-			image.palette = normal_palette;
-			write_sprite(&image, outfile);
+	FREE(normal_palette->colors);
+	FREE(shiny_palette->colors);
 
-			sprintf(outfile, "%s/%s/%d", OUTDIR, d->shiny, n);
-			image.palette = shiny_palette;
-			write_sprite(&image, outfile);
+	FREE(normal_palette);
+	FREE(shiny_palette);
+}
 
-			FREE(image.pixels);
-		}
+static void
+rip_bw_sprites(void)
+{
+	struct batch batch = {
+		.narc_filename = FILENAME,
+		.ncer_filename = "./Resources/bw-pokemon.ncer",
+	};
 
-		FREE(normal_palette->colors);
-		FREE(shiny_palette->colors);
+	MKDIR("")
+	MKDIR("female")
+	MKDIR("shiny")
+	MKDIR("shiny/female")
+	MKDIR("back")
+	MKDIR("back/female")
+	MKDIR("back/shiny")
+	MKDIR("back/shiny/female")
 
-		FREE(normal_palette);
-		FREE(shiny_palette);
-	}
+	batch_run(&batch, 0, 711 + 1, rip_bw_sprites_task);
 
 	printf("done\n");
 	exit(EXIT_SUCCESS);
 }
 
+#define OUTDIR "./Out/Trainers"
+#define FILENAME "./Resources/Narcs/trfgra.narc"
 static void
-rip_bw_trainers(void)
+rip_bw_trainers_task(struct batch *batch, int n)
 {
-	#define OUTDIR "./Out/Trainers"
-	#define FILENAME "./Resources/Narcs/trfgra.narc"
-	struct NARC *narc = open_narc(FILENAME);
-	struct NCER *ncer = open_nitro("./Resources/bw-trainer.ncer", 'NCER');
+	struct NARC *narc = batch->narc;
+	struct NCER *ncer = batch->ncer;
 
 	char outfile[256] = "";
 
-	MKDIR("")
-	MKDIR("parts")
-
 	struct image image = {};
 
-	for (int n = 0; n <= 187; n++) {
-		printf("%d\n", n);
-		struct NCLR *normal_nclr = narc_load_file(narc, n*8 + 7);
-
-		if (normal_nclr == NULL) {
-			if (errno) perror(NULL);
-			else warn("Error reading palettes.");
-			exit(EXIT_FAILURE);
-		}
-
-		assert(nitro_get_magic(normal_nclr) == (magic_t)'NCLR');
-
-		struct palette *normal_palette = nclr_get_palette(normal_nclr, 0);
+	printf("%d\n", n);
+	struct palette *normal_palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*8 + 7);
 
-		nitro_free(normal_nclr);
+	if (normal_palette == NULL) {
+		if (errno) perror(NULL);
+		else warn("Error loading palettes.");
+		batch_fail(batch);
+		return;
+	}
 
-		FREE(normal_nclr);
+	for (int i = 0; i < 2; i++) {
+		const char *dir;
 
-		if (normal_palette == NULL) {
-			if (errno) perror(NULL);
-			else warn("Error loading palettes.");
-			exit(EXIT_FAILURE);
+		switch (i) {
+		case 0: dir = ""; break;
+		case 1: dir = "parts"; break;
 		}
 
-		for (int i = 0; i < 2; i++) {
-			const char *dir;
+		struct NCGR *ncgr;
+		int index = n * 8 + i;
 
-			switch (i) {
-			case 0: dir = ""; break;
-			case 1: dir = "parts"; break;
-			}
+		if (narc_get_file_size(narc, index) == 0) {
+			// this is fine
+			continue;
+		}
 
-			struct NCGR *ncgr;
-			int index = n * 8 + i;
+		sprintf(outfile, "%s/%s/%d", OUTDIR, dir, n);
 
-			if (narc_get_file_size(narc, index) == 0) {
-				// this is fine
-				continue;
-			}
+		if (i == 0) {
 			ncgr = narc_load_file(narc, index);
 			if (ncgr == NULL) {
 				warn("error getting file %d", index);
@@ -452,195 +664,170 @@ rip_bw_trainers(void)
 
 			assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
 
-			sprintf(outfile, "%s/%s/%d", OUTDIR, dir, n);
-
 			ncgr_get_dim(ncgr, &image.dim);
 
-			if (i == 0) {
-				image.pixels = buffer_alloc(image.dim.height * image.dim.width);
-				if (image.pixels == NULL) {
-					warn("Error ripping %s.", outfile);
-					continue;
-				}
-				struct coords offset = {0,0};
-				if (ncer_draw_cell(ncer, 0, ncgr, &image, offset)) {
-					warn("error drawing cell");
-				}
-				/* if (ncer_draw_boxes(ncer, 0, &image, offset)) {
-					warn("error drawing boxes");
-				} */
-			} else if (i == 1) {
-				image.pixels = ncgr_get_pixels(ncgr);
-				if (image.pixels == NULL) {
-					warn("Error ripping %s.", outfile);
-					continue;
-				}
+			image.pixels = buffer_alloc(image.dim.height * image.dim.width);
+			if (image.pixels == NULL) {
+				warn("Error ripping %s.", outfile);
+				nitro_free(ncgr);
+				FREE(ncgr);
+				continue;
 			}
-
+			struct coords offset = {0,0};
+			if (ncer_draw_cell(ncer, 0, ncgr, &image, offset)) {
+				warn("error drawing cell");
+			}
+			/* if (ncer_draw_boxes(ncer, 0, &image, offset)) {
+				warn("error drawing boxes");
+			} */
 
 			nitro_free(ncgr);
 			FREE(ncgr);
-
-			image.palette = normal_palette;
-			write_sprite(&image, outfile);
-
-			FREE(image.pixels);
+		} else if (i == 1) {
+			// the parts aren't drawn with cells, so they can come
+			// straight from the cache
+			image.pixels = disk_cache_load_pixels(batch->disk_cache, batch->narc, index, CRYPT_NONE, &image.dim);
+			if (image.pixels == NULL) {
+				warn("Error ripping %s.", outfile);
+				continue;
+			}
 		}
 
-		FREE(normal_palette->colors);
+		image.palette = normal_palette;
+		write_sprite(&image, outfile);
 
-		FREE(normal_palette);
+		FREE(image.pixels);
 	}
 
+	FREE(normal_palette->colors);
+
+	FREE(normal_palette);
+}
+
+static void
+rip_bw_trainers(void)
+{
+	struct batch batch = {
+		.narc_filename = FILENAME,
+		.ncer_filename = "./Resources/bw-trainer.ncer",
+	};
+
+	MKDIR("")
+	MKDIR("parts")
+
+	batch_run(&batch, 0, 187 + 1, rip_bw_trainers_task);
+
 	printf("done\n");
 	exit(EXIT_SUCCESS);
 }
 
 /* for d/p */
+#define OUTDIR "./Out/test"
+#define FILENAME "./Resources/Narcs/trfgra.narc"
 static void
-rip_trainers(void)
+rip_trainers_task(struct batch *batch, int n)
 {
-	#define OUTDIR "./Out/test"
-	#define FILENAME "./Resources/Narcs/trfgra.narc"
-	struct NARC *narc = open_narc(FILENAME);
 	char outfile[256] = "";
-	const int trainer_count = narc_get_file_count(narc) / 2;
 
 	struct image image = {};
 
-	MKDIR("");
-
-	for (int n = 0; n < trainer_count; n++) {
-		sprintf(outfile, "%s/%d", OUTDIR, n);
+	sprintf(outfile, "%s/%d", OUTDIR, n);
 
-		struct NCGR *ncgr = narc_load_file(narc, n*2 + 0);
-		if (ncgr == NULL) {
-			if (errno) perror(outfile);
-			continue;
-		}
-		assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
-
-		struct NCLR *nclr = narc_load_file(narc, n*2 + 1);
-		if (nclr == NULL) {
-			if (errno) perror(outfile);
-			nitro_free(ncgr);
-			FREE(ncgr);
-			continue;
-		}
-		assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
-
-		image.palette = nclr_get_palette(nclr, 0);
-		if (image.palette == NULL) {
-			warn("Error ripping %s.", outfile);
-			continue; // leak
-		}
-
-		nitro_free(nclr);
-		FREE(nclr);
+	image.pixels = disk_cache_load_pixels(batch->disk_cache, batch->narc, n*2 + 0, CRYPT_PT, &image.dim);
+	if (image.pixels == NULL) {
+		if (errno) perror(outfile);
+		else warn("Error ripping %s.", outfile);
+		return;
+	}
 
-		ncgr_decrypt_pt(ncgr);
+	image.palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*2 + 1);
+	if (image.palette == NULL) {
+		if (errno) perror(outfile);
+		else warn("Error ripping %s.", outfile);
+		FREE(image.pixels);
+		return;
+	}
 
-		image.pixels = ncgr_get_pixels(ncgr);
-		if (image.pixels == NULL) {
-			warn("Error ripping %s.", outfile);
-			continue; // leak
-		}
+	write_sprite(&image, outfile);
 
-		ncgr_get_dim(ncgr, &image.dim);
+	FREE(image.pixels);
+	FREE(image.palette->colors);
+	FREE(image.palette);
+}
 
-		nitro_free(ncgr);
-		FREE(ncgr);
+static void
+rip_trainers(void)
+{
+	struct batch batch = {.narc_filename = FILENAME};
+	batch_init(&batch);
+	const int trainer_count = narc_get_file_count(batch.narc) / 2;
 
-		write_sprite(&image, outfile);
+	MKDIR("");
 
-		FREE(image.pixels);
-		FREE(image.palette->colors);
-		FREE(image.palette);
-	}
+	batch_run(&batch, 0, trainer_count, rip_trainers_task);
 
 	printf("done\n");
 	exit(EXIT_SUCCESS);
 }
 
 /* for hg/ss */
+#define FILENAME "./Resources/Narcs/trbgra.narc"
+#define OUTDIR "./Out/test"
 static void
-rip_trainers2(void)
+rip_trainers2_task(struct batch *batch, int n)
 {
-	#define FILENAME "./Resources/Narcs/trbgra.narc"
-	#define OUTDIR "./Out/test"
-	struct NARC *narc = open_narc(FILENAME);
-	char outfile[256] = "";
-	const int trainer_count = narc_get_file_count(narc) / 5;
-
-	MKDIR("frames");
+	char outfile[256] = "";
 
 	struct image image = {};
 
-	for (int n = 0; n < trainer_count; n++) {
-		struct NCLR *nclr = narc_load_file(narc, n*5 + 1);
-		if (nclr == NULL) {
-			if (errno) perror(NULL);
-			continue;
-		}
-		assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
+	image.palette = disk_cache_load_palette(batch->disk_cache, batch->narc, n*5 + 1);
+	if (image.palette == NULL) {
+		if (errno) perror(NULL);
+		return;
+	}
 
-		image.palette = nclr_get_palette(nclr, 0);
-		if (image.palette == NULL) {
-			if (errno) perror(NULL);
-			nitro_free(nclr);
-			FREE(nclr);
-			continue;
+	int spriteindex;
+	for (int i = 0; i < 2; i++) {
+		switch (i) {
+		case 0:
+			spriteindex = 0;
+			sprintf(outfile, "%s/frames/%d", OUTDIR, n);
+			break;
+		case 1:
+			spriteindex = 4;
+			sprintf(outfile, "%s/%d", OUTDIR, n);
+			break;
 		}
+		puts(outfile);
 
-		nitro_free(nclr);
-		FREE(nclr);
-
-		int spriteindex;
-		for (int i = 0; i < 2; i++) {
-			switch (i) {
-			case 0:
-				spriteindex = 0;
-				sprintf(outfile, "%s/frames/%d", OUTDIR, n);
-				break;
-			case 1:
-				spriteindex = 4;
-				sprintf(outfile, "%s/%d", OUTDIR, n);
-				break;
-			}
-			puts(outfile);
-
-			struct NCGR *ncgr = narc_load_file(narc, n*5 + spriteindex);
-			if (ncgr == NULL) {
-				if (errno) perror(outfile);
-				continue;
-			}
-			assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+		/* pt for platinum, dp for hgss */
+		enum crypt crypt = (i == 1) ? CRYPT_DP : CRYPT_NONE;
 
-			if (i == 1) {
-				/* pt for platinum, dp for hgss */
-				ncgr_decrypt_dp(ncgr);
-			}
+		image.pixels = disk_cache_load_pixels(batch->disk_cache, batch->narc, n*5 + spriteindex, crypt, &image.dim);
+		if (image.pixels == NULL) {
+			if (errno) perror(outfile);
+			else warn("Error ripping %s.", outfile);
+			continue;
+		}
 
-			image.pixels = ncgr_get_pixels(ncgr);
-			if (image.pixels == NULL) {
-				warn("Error ripping %s.", outfile);
-				nitro_free(ncgr);
-				FREE(ncgr);
-				continue;
-			}
+		write_sprite(&image, outfile);
 
-			ncgr_get_dim(ncgr, &image.dim);
+		FREE(image.pixels);
+	}
+	FREE(image.palette->colors);
+	FREE(image.palette);
+}
 
-			nitro_free(ncgr);
-			FREE(ncgr);
+static void
+rip_trainers2(void)
+{
+	struct batch batch = {.narc_filename = FILENAME};
+	batch_init(&batch);
+	const int trainer_count = narc_get_file_count(batch.narc) / 5;
 
-			write_sprite(&image, outfile);
+	MKDIR("frames");
 
-			FREE(image.pixels);
-		}
-		FREE(image.palette->colors);
-		FREE(image.palette);
-	}
+	batch_run(&batch, 0, trainer_count, rip_trainers2_task);
 
 	printf("done\n");
 	exit(EXIT_SUCCESS);
@@ -744,310 +931,446 @@ rip_textbox_hgss(void)
 	exit(EXIT_SUCCESS);
 }
 
+#define FILENAME "./Resources/Narcs/pokefoot.narc"
+#define OUTDIR "./Out/Footprints"
+static void
+rip_footprint_setup(struct batch *batch)
+{
+	batch->ncer = narc_load_file(batch->narc, 2);
+	assert(nitro_get_magic(batch->ncer) == (magic_t)'NCER');
+
+	batch->nclr = narc_load_file(batch->narc, 0);
+	assert(nitro_get_magic(batch->nclr) == (magic_t)'NCLR');
+}
+
+static void
+rip_footprint_task(struct batch *batch, int i)
+{
+	struct NARC *narc = batch->narc;
+	struct NCER *ncer = batch->ncer;
+	struct NCLR *nclr = batch->nclr;
+
+	char outfile[256] = "";
+	sprintf(outfile, "%s/%d", OUTDIR, i-3);
+
+	struct NCGR *ncgr = narc_load_file(narc, i);
+	assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+
+	ncer_dump(ncer, NULL);
+
+	struct dim dim;
+	ncgr_get_dim(ncgr, &dim);
+
+	warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
+
+	struct image image = {
+		.palette = nclr_get_palette(nclr, 0),
+		.pixels = buffer_alloc(16*16),
+		.dim = {16,16},
+	};
+
+	struct coords offset = {8, 8};
+	ncer_draw_cell(ncer, 0, ncgr, &image, offset);
+
+	write_sprite(&image, outfile);
+}
+
 static void
 rip_footprint(void)
 {
-	#define FILENAME "./Resources/Narcs/pokefoot.narc"
-	#define OUTDIR "./Out/Footprints"
 	MKDIR("");
 
-	struct NARC *narc = open_narc(FILENAME);
+	struct batch batch = {
+		.narc_filename = FILENAME,
+		.setup = rip_footprint_setup,
+	};
+	batch_init(&batch);
+	const int count = narc_get_file_count(batch.narc);
+
+	batch_run(&batch, 3, count, rip_footprint_task);
+
+	exit(EXIT_SUCCESS);
+}
+
+#define FILENAME "./Resources/Narcs/trfgra.narc"
+#define FILENAME2 "./Resources/Narcs/trbgra.narc"
+#define OUTDIR "./Out/Trainers"
+#define OUTDIR2 "./Out/Trainers/Back"
+struct trainer_batch {
+	struct batch batch;
+	int time;
+	int height;
+};
+
+static void
+rip_trainer_task(struct batch *batch, int i)
+{
+	struct trainer_batch *tb = (struct trainer_batch *)batch;
+	struct NARC *narc = batch->narc;
+	const int time = tb->time;
 
-	struct NCER *ncer = narc_load_file(narc, 2);
+	struct NCER *ncer = narc_load_file(narc, i * 5 + 2);
 	assert(nitro_get_magic(ncer) == (magic_t)'NCER');
 
-	struct NCLR *nclr = narc_load_file(narc, 0);
+	struct NCLR *nclr = narc_load_file(narc, i * 5 + 1);
 	assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
 
-	for (size_t i = 3; i < narc_get_file_count(narc); i++){
-
-		char outfile[256] = "";
-		sprintf(outfile, "%s/%d", OUTDIR, i-3);
+	struct NCGR *ncgr = narc_load_file(narc, i * 5);
+	assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
 
-		struct NCGR *ncgr = narc_load_file(narc, i);
-		assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+	char outfile[256] = "";
+	if (time == 1){
+		sprintf(outfile, "%s/%d", OUTDIR2, i);
+	}else{
+		sprintf(outfile, "%s/%d", OUTDIR, i);
+	}
 
-		ncer_dump(ncer, NULL);
+	//ncer_dump(ncer, NULL);
 
-		struct dim dim;
-		ncgr_get_dim(ncgr, &dim);
+	struct dim dim;
+	ncgr_get_dim(ncgr, &dim);
 
-		warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
+	//warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
 
-		struct image image = {
-			.palette = nclr_get_palette(nclr, 0),
-			.pixels = buffer_alloc(16*16),
-			.dim = {16,16},
-		};
+	const int frames = ncer_get_cell_count(ncer);
+	const int size = 80*frames;
+	int size2 = tb->height;
 
-		struct coords offset = {8, 8};
-		ncer_draw_cell(ncer, 0, ncgr, &image, offset);
+	struct image image = {
+		.palette = nclr_get_palette(nclr, 0),
+		.pixels = buffer_alloc(size2*size),
+		.dim = {size,size2},
+	};
 
-		write_sprite(&image, outfile);
+	for (int t = 1; t <= frames; t++){
+		if (i == 106 && t == 1 && time == 0){
+			size2 = 112;
+		}else if(i == 106 && t != 1){
+			size2 = 80;
+		}else if(time == 0){
+			size2 = 80;
+		}else if(time == 1){
+			size2 = 128;
+		}
+		//Trainer 106 in HGSS doesn't properly show the 1st frame as it's cut off due to the anim - just move it forward 16 px
+		//DPPt has only 104 trainers so it will never be "wrong" for DPPt
+		struct coords offset = {size2/2, (80*t) - 40};
+		ncer_draw_cell(ncer, t-1, ncgr, &image, offset);
 	}
 
-	
 
-	exit(EXIT_SUCCESS);
+	write_sprite(&image, outfile);
 }
 
 static void
 rip_trainer(void)
 {
-	#define FILENAME "./Resources/Narcs/trfgra.narc"
-	#define FILENAME2 "./Resources/Narcs/trbgra.narc"
-	#define OUTDIR "./Out/Trainers"
-	#define OUTDIR2 "./Out/Trainers/Back"
 	MKDIR("");
 	MKDIR("Back");
 
 	for (int time = 0; time < 2; time++){
-		struct NARC *narc = open_narc(FILENAME);
+		struct trainer_batch tb = {
+			.batch = {.narc_filename = FILENAME},
+			.time = time,
+			.height = 80,
+		};
 		if (time == 1){
-			narc = open_narc(FILENAME2);
+			tb.batch.narc_filename = FILENAME2;
+			tb.height = 128;
 		}
-		int trainer_count = narc_get_file_count(narc) / 5;
-		
-		for (int i = 0; i < trainer_count; i++){
+		batch_init(&tb.batch);
+		int trainer_count = narc_get_file_count(tb.batch.narc) / 5;
 
-			struct NCER *ncer = narc_load_file(narc, i * 5 + 2);
-			assert(nitro_get_magic(ncer) == (magic_t)'NCER');
-
-			struct NCLR *nclr = narc_load_file(narc, i * 5 + 1);
-			assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
+		batch_run(&tb.batch, 0, trainer_count, rip_trainer_task);
+	}
+	
 
-			struct NCGR *ncgr = narc_load_file(narc, i * 5);
-			assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+	
 
-			char outfile[256] = "";
-			if (time == 1){
-				sprintf(outfile, "%s/%d", OUTDIR2, i);
-			}else{
-				sprintf(outfile, "%s/%d", OUTDIR, i);
-			}
+	exit(EXIT_SUCCESS);
+}
 
-			//ncer_dump(ncer, NULL);
+#define FILENAME "./Resources/Narcs/pokegra-w.narc"
+#define OUTDIR "./Out/animatedSprites"
+static void
+rip_bw_animated_task(struct batch *batch, int n)
+{
+	struct NARC *narc = batch->narc;
+	char outfile[256] = "";
+	char shiny_outfile[256] = "";
+
+	// each variant is ripped with the normal palette (18) and the shiny
+	// one (19) at once
+	static const struct animated_variant {
+		int ncgr;
+		int part;
+		char dir[20];
+		char shiny_dir[20];
+	} variants[] = {
+		{2, 0, "", "shiny"},
+		{3, 0, "female", "shiny/female"},
+		{2, 9, "back", "back/shiny"},
+		{3, 9, "back/female", "back/shiny/female"},
+	};
 
-			struct dim dim;
-			ncgr_get_dim(ncgr, &dim);
+	const struct dim dim = {.width = 192, .height = 128};
+	const struct coords offset = {.x = 96, .y = 112};
 
-			//warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
+	// drawing doesn't modify the files, so all the variants can share
+	// them; load the whole lot at once
+	int indices[20];
+	void *files[20];
+	for (int i = 0; i < 20; i++) {
+		indices[i] = n * 20 + i;
+	}
+	narc_load_files(narc, indices, 20, files);
 
-			const int frames = ncer_get_cell_count(ncer);
-			const int size = 80*frames;
-			int size2 = 80;
-			if (time == 1){
-				size2 = 128;
-			}
+	for (size_t i = 0; i < sizeof(variants)/sizeof(variants[0]); i++) {
+		const struct animated_variant *v = &variants[i];
 
-			struct image image = {
-				.palette = nclr_get_palette(nclr, 0),
-				.pixels = buffer_alloc(size2*size),
-				.dim = {size,size2},
-			};
-			
-			for (int t = 1; t <= frames; t++){
-				if (i == 106 && t == 1 && time == 0){
-					size2 = 112;
-				}else if(i == 106 && t != 1){
-					size2 = 80;
-				}else if(time == 0){
-					size2 = 80;
-				}else if(time == 1){
-					size2 = 128;
-				}
-				//Trainer 106 in HGSS doesn't properly show the 1st frame as it's cut off due to the anim - just move it forward 16 px
-				//DPPt has only 104 trainers so it will never be "wrong" for DPPt
-				struct coords offset = {size2/2, (80*t) - 40};
-				ncer_draw_cell(ncer, t-1, ncgr, &image, offset);
-			}
+		if (narc_get_file_size(narc, indices[v->ncgr + v->part]) == 0) {
+			// this is fine
+			continue;
+		}
 
+		const char *ext = anim_format == NMAR_APNG ? "png" : "gif";
+		sprintf(outfile, "%s/%s/%d.%s", OUTDIR, v->dir, n, ext);
+		sprintf(shiny_outfile, "%s/%s/%d.%s", OUTDIR, v->shiny_dir, n, ext);
+
+		struct NCLR *nclrs[2] = {files[18], files[19]};
+		const char *outfiles[2] = {outfile, shiny_outfile};
+		struct NCGR *ncgr = files[v->ncgr + v->part];
+		struct NCER *ncer = files[4 + v->part];
+		struct NANR *nanr = files[5 + v->part];
+		struct NMCR *nmcr = files[6 + v->part];
+		struct NMAR *nmar = files[7 + v->part];
+
+		if (nitro_get_magic(nclrs[0]) != (magic_t)'NCLR' ||
+		    nitro_get_magic(nclrs[1]) != (magic_t)'NCLR' ||
+		    nitro_get_magic(ncgr) != (magic_t)'NCGR' ||
+		    nitro_get_magic(ncer) != (magic_t)'NCER' ||
+		    nitro_get_magic(nanr) != NANR_MAGIC ||
+		    nitro_get_magic(nmcr) != NMCR_MAGIC ||
+		    nitro_get_magic(nmar) != NMAR_MAGIC) {
+			warn("Error loading files for %s.", outfile);
+		} else if (nmar_save_animations(nmar, 0, nmcr, nanr, ncer, ncgr, nclrs,
+		                                dim, offset, anim_format, outfiles, 2)) {
+			warn("Error writing %s.", outfile);
+		}
+	}
 
-			write_sprite(&image, outfile);
+	for (int i = 0; i < 20; i++) {
+		if (files[i] != NULL) {
+			nitro_free(files[i]);
+			FREE(files[i]);
 		}
 	}
-	
+}
 
-	
+/* Every animation is drawn into one reused frame and written straight
+ * to the gif (or apng) */
+static void
+rip_bw_animated(void)
+{
+	struct batch batch = {.narc_filename = FILENAME};
+
+	MKDIR("")
+	MKDIR("female")
+	MKDIR("shiny")
+	MKDIR("shiny/female")
+	MKDIR("back")
+	MKDIR("back/female")
+	MKDIR("back/shiny")
+	MKDIR("back/shiny/female")
+
+	batch_init(&batch);
+	const int count = narc_get_file_count(batch.narc) / 20;
 
+	batch_run(&batch, 0, count, rip_bw_animated_task);
+
+	printf("done\n");
 	exit(EXIT_SUCCESS);
 }
 
+#define FILENAME "./Resources/Narcs/poke_icon.narc"
+#define OUTDIR "./Out/test"
 static void
-rip_icon(void)
+rip_icon_setup(struct batch *batch)
 {
+	batch->ncer = narc_load_file(batch->narc, 4);
+	//assert(nitro_get_magic(batch->ncer) == (magic_t)'NCER');
 
-	MKDIR("");
+	batch->nclr = narc_load_file(batch->narc, 0);
+	//assert(nitro_get_magic(batch->nclr) == (magic_t)'NCLR');
+}
 
-	#define FILENAME "./Resources/Narcs/poke_icon.narc"
-	#define OUTDIR "./Out/test"
-	struct NARC *narc = open_narc(FILENAME);
+static void
+rip_icon_task(struct batch *batch, int i)
+{
+	struct NARC *narc = batch->narc;
+	struct NCER *ncer = batch->ncer;
+	struct NCLR *nclr = batch->nclr;
 
-	struct NCER *ncer = narc_load_file(narc, 4);
-	//assert(nitro_get_magic(ncer) == (magic_t)'NCER');
-	
-	struct NCLR *nclr = narc_load_file(narc, 0);
-	//assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
-	for (size_t i = 5; i < narc_get_file_count(narc); i++)
-	{
-		char outfile[256] = "";
-		sprintf(outfile, "%s/%d", OUTDIR, i-5);
-		struct NCGR *ncgr = narc_load_file(narc, i);
-		//assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+	char outfile[256] = "";
+	sprintf(outfile, "%s/%d", OUTDIR, i-5);
+	struct NCGR *ncgr = narc_load_file(narc, i);
+	//assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
 
-		ncer_dump(ncer, NULL);
+	ncer_dump(ncer, NULL);
 
-		struct dim dim;
-		ncgr_get_dim(ncgr, &dim);
+	struct dim dim;
+	ncgr_get_dim(ncgr, &dim);
 
-		warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
+	warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
 
-		struct image image = {
-			.palette = nclr_get_palette(nclr, 0),
-			.pixels = buffer_alloc(32*24),
-			.dim = {24,32},
-		};
+	struct image image = {
+		.palette = nclr_get_palette(nclr, 0),
+		.pixels = buffer_alloc(32*24),
+		.dim = {24,32},
+	};
 
-		struct coords offset = {16, 8};
-		ncer_draw_cell(ncer, 0, ncgr, &image, offset);
+	struct coords offset = {16, 8};
+	ncer_draw_cell(ncer, 0, ncgr, &image, offset);
 
-		
-		write_sprite(&image, outfile);
-		
-		nitro_free(ncgr);
-		FREE(ncgr);
+	
+	write_sprite(&image, outfile);
+	
+	nitro_free(ncgr);
+	FREE(ncgr);
+}
 
-	}
-	nitro_free(ncer);
-	FREE(ncer);
-	nitro_free(nclr);
-	FREE(nclr);
+static void
+rip_icon(void)
+{
+
+	MKDIR("");
+
+	struct batch batch = {
+		.narc_filename = FILENAME,
+		.setup = rip_icon_setup,
+	};
+	batch_init(&batch);
+	const int count = narc_get_file_count(batch.narc);
+
+	batch_run(&batch, 5, count, rip_icon_task);
 
 	exit(EXIT_SUCCESS);
 }
 
+#define FILENAME "./Resources/Narcs/poke_icon-w.narc"
+#define OUTDIR "./Out/pokeIcons"
 static void
-bwrip_icon(void)
+bwrip_icon_setup(struct batch *batch)
 {
-	#define FILENAME "./Resources/Narcs/poke_icon-w.narc"
-	#define OUTDIR "./Out/pokeIcons"
+	batch->ncer = narc_load_file(batch->narc, 2);
+	//assert(nitro_get_magic(batch->ncer) == (magic_t)'NCER');
 
-	MKDIR("");
+	batch->nclr = narc_load_file(batch->narc, 0);
+	//assert(nitro_get_magic(batch->nclr) == (magic_t)'NCLR');
+}
 
-	struct NARC *narc = open_narc(FILENAME);
+static void
+bw2rip_icon_setup(struct batch *batch)
+{
+	batch->ncer = narc_load_file(batch->narc, 3);
+	//assert(nitro_get_magic(batch->ncer) == (magic_t)'NCER');
 
-	struct NCER *ncer = narc_load_file(narc, 2);
-	//assert(nitro_get_magic(ncer) == (magic_t)'NCER');
-	
-	struct NCLR *nclr = narc_load_file(narc, 0);
-	//assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
-	for (size_t i = 7; i < narc_get_file_count(narc); i=i+2)
-	{
-		char outfile[256] = "";
-		sprintf(outfile, "%s/%d", OUTDIR, (i-7)/2);
-		struct NCGR *ncgr = narc_load_file(narc, i);
-		//assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
+	batch->nclr = narc_load_file(batch->narc, 0);
+	//assert(nitro_get_magic(batch->nclr) == (magic_t)'NCLR');
+}
 
-		//ncer_dump(ncer, NULL);
+/* the icons are every other file, starting from first */
+struct icon_batch {
+	struct batch batch;
+	int first;
+	int step;
+};
 
-		struct dim dim;
-		ncgr_get_dim(ncgr, &dim);
+static void
+bwrip_icon_task(struct batch *batch, int n)
+{
+	struct icon_batch *ib = (struct icon_batch *)batch;
+	struct NARC *narc = batch->narc;
+	struct NCLR *nclr = batch->nclr;
 
-		//warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
+	const int i = ib->first + n * ib->step;
 
-		struct image image = {
-			.palette = nclr_get_palette(nclr, 0),
-			//.pixels = buffer_alloc(32*24),
-			//.dim = {24,32},
-			.pixels = buffer_alloc(32*64),
-			.dim = {32,64},
-		};
+	char outfile[256] = "";
+	sprintf(outfile, "%s/%d", OUTDIR, (i-7)/2);
+	struct NCGR *ncgr = narc_load_file(narc, i);
+	//assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
 
-		struct coords offset = {16, 8};
-		struct coords offset2 = {16, 32};
-		//ncer_draw_cell(ncer, 0, ncgr, &image, offset);
-		//ncer_draw_cell(ncer, 2, ncgr, &image, offset2);
+	//ncer_dump(ncer, NULL);
 
-		image.pixels = ncgr_get_pixels(ncgr);
-			if (image.pixels == NULL) {
-				warn("Error ripping %s.", outfile);
-				continue;
-			}
-		image.palette = nclr_get_palette(nclr, 0);
-		
-		write_sprite(&image, outfile);
-		
-		nitro_free(ncgr);
-		FREE(ncgr);
+	struct dim dim;
+	ncgr_get_dim(ncgr, &dim);
 
-	}
-	nitro_free(ncer);
-	FREE(ncer);
-	nitro_free(nclr);
-	FREE(nclr);
+	//warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
 
-	exit(EXIT_SUCCESS);
+	struct image image = {
+		.palette = nclr_get_palette(nclr, 0),
+		//.pixels = buffer_alloc(32*24),
+		//.dim = {24,32},
+		.pixels = buffer_alloc(32*64),
+		.dim = {32,64},
+	};
+
+	//struct coords offset = {16, 8};
+	//struct coords offset2 = {16, 32};
+	//ncer_draw_cell(ncer, 0, ncgr, &image, offset);
+	//ncer_draw_cell(ncer, 2, ncgr, &image, offset2);
+
+	image.pixels = ncgr_get_pixels(ncgr);
+		if (image.pixels == NULL) {
+			warn("Error ripping %s.", outfile);
+			return;
+		}
+	image.palette = nclr_get_palette(nclr, 0);
+	
+	write_sprite(&image, outfile);
+	
+	nitro_free(ncgr);
+	FREE(ncgr);
 }
 
 static void
-bw2rip_icon(void)
+bwrip_icon(void)
 {
-	#define FILENAME "./Resources/Narcs/poke_icon-w.narc"
-	#define OUTDIR "./Out/pokeIcons"
-
 	MKDIR("");
 
-	struct NARC *narc = open_narc(FILENAME);
-
-	struct NCER *ncer = narc_load_file(narc, 3);
-	//assert(nitro_get_magic(ncer) == (magic_t)'NCER');
-	
-	struct NCLR *nclr = narc_load_file(narc, 0);
-	//assert(nitro_get_magic(nclr) == (magic_t)'NCLR');
-	for (size_t i = 8; i < narc_get_file_count(narc); i=i+2)
-	{
-		char outfile[256] = "";
-		sprintf(outfile, "%s/%d", OUTDIR, (i-7)/2);
-		struct NCGR *ncgr = narc_load_file(narc, i);
-		//assert(nitro_get_magic(ncgr) == (magic_t)'NCGR');
-
-		//ncer_dump(ncer, NULL);
-
-		struct dim dim;
-		ncgr_get_dim(ncgr, &dim);
+	struct icon_batch ib = {
+		.batch = {
+			.narc_filename = FILENAME,
+			.setup = bwrip_icon_setup,
+		},
+		.first = 7,
+		.step = 2,
+	};
+	batch_init(&ib.batch);
+	const int count = narc_get_file_count(ib.batch.narc);
 
-		//warn("ncer.dim = {.width=%u, .height=%u}", dim.width, dim.height);
+	batch_run(&ib.batch, 0, (count - ib.first + 1) / 2, bwrip_icon_task);
 
-		struct image image = {
-			.palette = nclr_get_palette(nclr, 0),
-			//.pixels = buffer_alloc(32*24),
-			//.dim = {24,32},
-			.pixels = buffer_alloc(32*64),
-			.dim = {32,64},
-		};
+	exit(EXIT_SUCCESS);
+}
 
-		struct coords offset = {16, 8};
-		struct coords offset2 = {16, 32};
-		//ncer_draw_cell(ncer, 0, ncgr, &image, offset);
-		//ncer_draw_cell(ncer, 2, ncgr, &image, offset2);
+static void
+bw2rip_icon(void)
+{
+	MKDIR("");
 
-		image.pixels = ncgr_get_pixels(ncgr);
-			if (image.pixels == NULL) {
-				warn("Error ripping %s.", outfile);
-				continue;
-			}
-		image.palette = nclr_get_palette(nclr, 0);
-		
-		write_sprite(&image, outfile);
-		
-		nitro_free(ncgr);
-		FREE(ncgr);
+	struct icon_batch ib = {
+		.batch = {
+			.narc_filename = FILENAME,
+			.setup = bw2rip_icon_setup,
+		},
+		.first = 8,
+		.step = 2,
+	};
+	batch_init(&ib.batch);
+	const int count = narc_get_file_count(ib.batch.narc);
 
-	}
-	nitro_free(ncer);
-	FREE(ncer);
-	nitro_free(nclr);
-	FREE(nclr);
+	batch_run(&ib.batch, 0, (count - ib.first + 1) / 2, bwrip_icon_task);
 
 	exit(EXIT_SUCCESS);
 }
@@ -1208,7 +1531,6 @@ render_ncer(void)
 int
 main(int argc, char *argv[])
 {
-	UNUSED(argc);
 	//list();
 	//rip_sprites();
 	//rip_bw_sprites();
@@ -1220,8 +1542,75 @@ main(int argc, char *argv[])
 	//bwrip_icon();
 	//dump_ncer();
 	//render_ncer();
-	int i;
-	sscanf(argv[1], "%d", &i);
+	int i = 0;
+	const char *list_format = NULL;
+	const char *list_filename = "./Resources/Narcs/pokegra.narc";
+	int png_band_rows = 0;
+	for (int arg = 1; arg < argc; arg++) {
+		if (strncmp(argv[arg], "--list", 6) == 0) {
+			// --list[=tsv|json] [narc]: print what's in a narc
+			list_format = "tsv";
+			if (argv[arg][6] == '=') {
+				list_format = argv[arg] + 7;
+			} else if (argv[arg][6] != '\0') {
+				list_format = "";
+			}
+			if (strcmp(list_format, "tsv") != 0 &&
+			    strcmp(list_format, "json") != 0) {
+				warn("usage: rip --list[=tsv|json] [narc]");
+				exit(EXIT_FAILURE);
+			}
+		} else if (strncmp(argv[arg], "--png=", 6) == 0) {
+			// --png=store|fast|max: how hard to compress
+			const char *s = argv[arg] + 6;
+			if (strcmp(s, "store") == 0) {
+				image_set_png_compression(IMAGE_PNG_STORE);
+			} else if (strcmp(s, "fast") == 0) {
+				image_set_png_compression(IMAGE_PNG_FAST);
+			} else if (strcmp(s, "max") == 0) {
+				image_set_png_compression(IMAGE_PNG_MAX);
+			} else {
+				warn("usage: rip [--png=store|fast|max] mode");
+				exit(EXIT_FAILURE);
+			}
+		} else if (strncmp(argv[arg], "--png-band=", 11) == 0) {
+			// --png-band=ROWS: the rows in each band of a big png
+			if (sscanf(argv[arg] + 11, "%d", &png_band_rows) != 1 ||
+			    png_band_rows < 0) {
+				warn("usage: rip [--png-band=rows] mode");
+				exit(EXIT_FAILURE);
+			}
+		} else if (strncmp(argv[arg], "--anim=", 7) == 0) {
+			// --anim=gif|apng: what to save animations as
+			const char *s = argv[arg] + 7;
+			if (strcmp(s, "gif") == 0) {
+				anim_format = NMAR_GIF;
+			} else if (strcmp(s, "apng") == 0) {
+				anim_format = NMAR_APNG;
+			} else {
+				warn("usage: rip [--anim=gif|apng] mode");
+				exit(EXIT_FAILURE);
+			}
+		} else if (strncmp(argv[arg], "-j", 2) == 0) {
+			// -j N or -jN: rip with N threads
+			const char *s = argv[arg] + 2;
+			if (*s == '\0' && arg + 1 < argc) {
+				s = argv[++arg];
+			}
+			if (sscanf(s, "%d", &jobs) != 1 || jobs < 1) {
+				warn("usage: rip [-j jobs] mode");
+				exit(EXIT_FAILURE);
+			}
+		} else if (list_format != NULL) {
+			list_filename = argv[arg];
+		} else {
+			sscanf(argv[arg], "%d", &i);
+		}
+	}
+	image_set_png_threads(jobs, png_band_rows);
+	if (list_format != NULL) {
+		inventory(list_filename, strcmp(list_format, "json") == 0);
+	}
 	switch(i) 
 	{ 
 		case 1: 
@@ -1263,6 +1652,9 @@ main(int argc, char *argv[])
 		case 13: 
 			rip_trainer();
 			break;
+		case 14: 
+			rip_bw_animated();
+			break;
 		default:
 			list();
 			break;
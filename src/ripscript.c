@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <libguile.h>
 
 #include "common.h"
@@ -28,6 +29,7 @@
 #include "nmcr.h"
 #include "nmar.h"
 #include "image.h"
+#include "diskcache.h"
 
 static scm_t_bits nitro_tag;
 static scm_t_bits image_tag;
@@ -64,10 +66,18 @@ static SCM load_narc(SCM s_filename)
 		SCM symbol = scm_from_locale_symbol("misc-error");
 		scm_error(symbol, "load-narc", "Could not load narc", SCM_UNDEFINED, SCM_UNDEFINED);
 	}
+	narc_map(narc);
 
 	scm_dynwind_end();
 
-	SCM_RETURN_NEWSMOB(nitro_tag, narc);
+	// a narc has no parent. its third word is its disk cache, if
+	// there is one.
+	struct disk_cache *disk_cache = disk_cache_open(narc);
+
+	SCM s_narc;
+	SCM_NEWSMOB3(s_narc, nitro_tag, narc, SCM_UNPACK(SCM_BOOL_F), disk_cache);
+
+	return s_narc;
 }
 
 static SCM file_count(SCM obj)
@@ -90,9 +100,9 @@ static SCM get_file_size(SCM s_narc, SCM s_n)
 	return scm_from_int(narc_get_file_size(narc, n));
 }
 
-static SCM get_magic(SCM obj);
-
-static SCM load_narc_file(SCM s_narc, SCM s_n, SCM s_type)
+/* The magic of a file in a narc, as a symbol. Only the start of the file
+ * is read (and decompressed), so this is much cheaper than loading it. */
+static SCM narc_file_magic(SCM s_narc, SCM s_n)
 {
 	assert_nitro_type('CRAN', s_narc);
 	void *data = (void *) SCM_SMOB_DATA(s_narc);
@@ -100,23 +110,70 @@ static SCM load_narc_file(SCM s_narc, SCM s_n, SCM s_type)
 
 	int n = scm_to_int(s_n);
 
-	void *nitro = narc_load_file(narc, n);
-	if (nitro == NULL) {
+	magic_t magic;
+	if (narc_get_file_magic(narc, n, &magic)) {
 		SCM s = scm_from_locale_symbol("narc-error");
-		scm_error(s, "narc-load-file", "Error loading file from narc", SCM_UNDEFINED, SCM_UNDEFINED);
+		scm_error(s, "narc-file-magic", "Error reading file from narc", SCM_UNDEFINED, SCM_UNDEFINED);
 	}
 
-	SCM s_nitro;
-	SCM_NEWSMOB(s_nitro, nitro_tag, nitro);
+	char buf[MAGIC_BUF_SIZE];
+	strmagic(magic, buf);
+
+	return scm_from_locale_symbol(buf);
+}
+
+static SCM narc_cache_stats(void)
+{
+	struct narc_cache_stats stats;
+	narc_cache_get_stats(&stats);
+
+	return scm_list_n(
+		scm_cons(scm_from_locale_symbol("hits"), scm_from_ulong(stats.hits)),
+		scm_cons(scm_from_locale_symbol("misses"), scm_from_ulong(stats.misses)),
+		scm_cons(scm_from_locale_symbol("evictions"), scm_from_ulong(stats.evictions)),
+		scm_cons(scm_from_locale_symbol("entries"), scm_from_size_t(stats.entries)),
+		scm_cons(scm_from_locale_symbol("bytes"), scm_from_size_t(stats.bytes)),
+		scm_cons(scm_from_locale_symbol("budget"), scm_from_size_t(stats.budget)),
+		SCM_UNDEFINED);
+}
+
+static SCM set_narc_cache_budget(SCM s_bytes)
+{
+	narc_cache_set_budget(scm_to_size_t(s_bytes));
+
+	return SCM_UNSPECIFIED;
+}
+
+static SCM load_narc_file(SCM s_narc, SCM s_n, SCM s_type)
+{
+	assert_nitro_type('CRAN', s_narc);
+	void *data = (void *) SCM_SMOB_DATA(s_narc);
+	struct NARC *narc = data;
+
+	int n = scm_to_int(s_n);
 
 	if (s_type == SCM_UNDEFINED) { }
 	else if (scm_is_symbol(s_type)) {
-		SCM s_magic = get_magic(s_nitro);
+		// check the type before going to the trouble of loading it
+		SCM s_magic = narc_file_magic(s_narc, s_n);
 		if (!scm_is_eq(s_magic, s_type)) { goto error; }
 	} else {
 		scm_wrong_type_arg("narc-load-file", SCM_ARG3, s_type);
 	}
 
+	void *nitro = narc_cache_load(narc, n);
+	if (nitro == NULL) {
+		SCM s = scm_from_locale_symbol("narc-error");
+		scm_error(s, "narc-load-file", "Error loading file from narc", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+
+	// the file may borrow the narc's mapping, so keep the narc
+	// alive for as long as the file is. the third word is the index
+	// plus one while the file belongs to the cache, or 0 once we
+	// have a copy of our own.
+	SCM s_nitro;
+	SCM_NEWSMOB3(s_nitro, nitro_tag, nitro, SCM_UNPACK(s_narc), n + 1);
+
 	return s_nitro;
 
 error:
@@ -142,15 +199,51 @@ static SCM get_magic(SCM obj)
 	return s_magic;
 }
 
+static SCM mark_nitro(SCM obj)
+{
+	// the parent narc, if any
+	return SCM_SMOB_OBJECT_2(obj);
+}
+
 static size_t free_nitro(SCM obj)
 {
 	void *nitro = (void *) SCM_SMOB_DATA(obj);
 
-	nitro_free(nitro);
+	if (scm_is_false(SCM_SMOB_OBJECT_2(obj))) {
+		disk_cache_close((void *) SCM_SMOB_DATA_3(obj));
+		nitro_free(nitro);
+	} else if (SCM_SMOB_DATA_3(obj) != 0) {
+		narc_cache_release(nitro);
+	} else {
+		nitro_free(nitro);
+	}
 
 	return 0;
 }
 
+/* Files from the cache are shared, so before changing one, swap it for
+ * a fresh copy of our own. */
+static void *own_nitro(SCM obj, const char *subr)
+{
+	void *nitro = (void *) SCM_SMOB_DATA(obj);
+	int n = (int)SCM_SMOB_DATA_3(obj) - 1;
+	if (n < 0) {
+		return nitro;
+	}
+
+	struct NARC *narc = (void *) SCM_SMOB_DATA(SCM_SMOB_OBJECT_2(obj));
+	void *copy = narc_load_file(narc, n);
+	if (copy == NULL) {
+		SCM s = scm_from_locale_symbol("narc-error");
+		scm_error(s, subr, "Error loading file from narc", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+
+	SCM_SET_SMOB_DATA(obj, copy);
+	SCM_SET_SMOB_DATA_3(obj, 0);
+	narc_cache_release(nitro);
+	return copy;
+}
+
 static SCM make_image(SCM s_dim)
 {
 	struct image *image = scm_gc_malloc(sizeof(struct image), "image");
@@ -191,7 +284,7 @@ static size_t free_image(SCM obj)
 static SCM decrypt_pt(SCM obj)
 {
 	assert_nitro_type('NCGR', obj);
-	struct NCGR *ncgr = (void *) SCM_SMOB_DATA(obj);
+	struct NCGR *ncgr = own_nitro(obj, "ncgr-decrypt-pt");
 	ncgr_decrypt_pt(ncgr);
 
 	return SCM_UNSPECIFIED;
@@ -200,7 +293,7 @@ static SCM decrypt_pt(SCM obj)
 static SCM decrypt_dp(SCM obj)
 {
 	assert_nitro_type('NCGR', obj);
-	struct NCGR *ncgr = (void *) SCM_SMOB_DATA(obj);
+	struct NCGR *ncgr = own_nitro(obj, "ncgr-decrypt-dp");
 	ncgr_decrypt_dp(ncgr);
 
 	return SCM_UNSPECIFIED;
@@ -230,6 +323,68 @@ static SCM image_set_pixels_from_ncgr(SCM s_image, SCM s_ncgr)
 	return SCM_UNSPECIFIED;
 }
 
+/* Like image-set-pixels-from-ncgr and image-set-palette-from-nclr, but
+ * straight from a narc. These go through the disk cache, so they can
+ * skip loading the file at all. crypt is #f, pt or dp. */
+static SCM image_set_pixels_from_narc(SCM s_image, SCM s_narc, SCM s_n, SCM s_crypt)
+{
+	scm_assert_smob_type(image_tag, s_image);
+	assert_nitro_type('CRAN', s_narc);
+
+	struct image *image = (void *) SCM_SMOB_DATA(s_image);
+	struct NARC *narc = (void *) SCM_SMOB_DATA(s_narc);
+	struct disk_cache *disk_cache = (void *) SCM_SMOB_DATA_3(s_narc);
+
+	int n = scm_to_int(s_n);
+
+	enum crypt crypt = CRYPT_NONE;
+	if (s_crypt == SCM_UNDEFINED || scm_is_false(s_crypt)) { }
+	else if (scm_is_eq(s_crypt, scm_from_locale_symbol("pt"))) { crypt = CRYPT_PT; }
+	else if (scm_is_eq(s_crypt, scm_from_locale_symbol("dp"))) { crypt = CRYPT_DP; }
+	else {
+		scm_wrong_type_arg("image-set-pixels-from-narc", SCM_ARG4, s_crypt);
+	}
+
+	struct dim dim;
+	struct buffer *pixels = disk_cache_load_pixels(disk_cache, narc, n, crypt, &dim);
+	if (pixels == NULL) {
+		SCM s = scm_from_locale_symbol("narc-error");
+		scm_error(s, "image-set-pixels-from-narc", "Error getting pixels", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+
+	free(image->pixels);
+	image->pixels = pixels;
+	image->dim = dim;
+
+	return SCM_UNSPECIFIED;
+}
+
+static SCM image_set_palette_from_narc(SCM s_image, SCM s_narc, SCM s_n)
+{
+	scm_assert_smob_type(image_tag, s_image);
+	assert_nitro_type('CRAN', s_narc);
+
+	struct image *image = (void *) SCM_SMOB_DATA(s_image);
+	struct NARC *narc = (void *) SCM_SMOB_DATA(s_narc);
+	struct disk_cache *disk_cache = (void *) SCM_SMOB_DATA_3(s_narc);
+
+	int n = scm_to_int(s_n);
+
+	struct palette *palette = disk_cache_load_palette(disk_cache, narc, n);
+	if (palette == NULL) {
+		SCM s = scm_from_locale_symbol("narc-error");
+		scm_error(s, "image-set-palette-from-narc", "Error getting palette", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+
+	if (image->palette != NULL) {
+		free(image->palette->colors);
+		free(image->palette);
+	}
+	image->palette = palette;
+
+	return SCM_UNSPECIFIED;
+}
+
 static SCM image_set_pixels_from_ncer(SCM obj, SCM s_ncer, SCM s_cell_index, SCM s_ncgr)
 {
 	assert_nitro_type('NCER', s_ncer);
@@ -298,6 +453,42 @@ static SCM image_set_palette_from_nclr(SCM s_image, SCM s_nclr)
 	return SCM_UNSPECIFIED;
 }
 
+/* Give an image a copy of another image's palette, so a palette loaded
+ * once can go on any number of images. */
+static SCM image_set_palette_from_image(SCM s_image, SCM s_source)
+{
+	scm_assert_smob_type(image_tag, s_image);
+	scm_assert_smob_type(image_tag, s_source);
+
+	struct image *image = (void *) SCM_SMOB_DATA(s_image);
+	struct image *source = (void *) SCM_SMOB_DATA(s_source);
+
+	SCM s = scm_from_locale_symbol("image-error");
+	if (source->palette == NULL) {
+		scm_error(s, "image-set-palette-from-image", "Source image has no palette", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+
+	struct palette *palette;
+	if (ALLOC(palette) == NULL) {
+		scm_error(s, "image-set-palette-from-image", "Out of memory", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+	*palette = *source->palette;
+	if (CALLOC(palette->colors, palette->count ? palette->count : 1) == NULL) {
+		free(palette);
+		scm_error(s, "image-set-palette-from-image", "Out of memory", SCM_UNDEFINED, SCM_UNDEFINED);
+	}
+	memcpy(palette->colors, source->palette->colors,
+	       palette->count * sizeof palette->colors[0]);
+
+	if (image->palette != NULL) {
+		free(image->palette->colors);
+		free(image->palette);
+	}
+	image->palette = palette;
+
+	return SCM_UNSPECIFIED;
+}
+
 static SCM image_save_png(SCM obj, SCM s_filename)
 {
 	scm_assert_smob_type(image_tag, obj);
@@ -357,10 +548,28 @@ static void close_gif_handler(void *gif)
 	image_gif_close(gif);
 }
 
-/* FPS is the number of ticks to increment by.
+static void close_apng_handler(void *apng)
+{
+	image_apng_close(apng);
+}
+
+/* The optional format argument of the animation procedures: #f or gif
+ * for a gif, apng for an apng */
+static enum nmar_format to_anim_format(SCM s_format, const char *subr, int pos)
+{
+	if (s_format == SCM_UNDEFINED || scm_is_false(s_format)) { return NMAR_GIF; }
+	else if (scm_is_eq(s_format, scm_from_locale_symbol("gif"))) { return NMAR_GIF; }
+	else if (scm_is_eq(s_format, scm_from_locale_symbol("apng"))) { return NMAR_APNG; }
+	scm_wrong_type_arg(subr, pos, s_format);
+	return NMAR_GIF;
+}
+
+/* FPS is the number of ticks to increment by, and the delay of each frame
+ * in hundredths of a second.
  * Callback should take a tickcount and return an image, or #f to stop the gif
+ * Format is gif (the default) or apng.
  */
-static SCM save_gif(SCM s_filename, SCM s_dim, SCM s_nclr, SCM s_fps, SCM callback)
+static SCM save_gif(SCM s_filename, SCM s_dim, SCM s_nclr, SCM s_fps, SCM callback, SCM s_format)
 {
 	scm_dynwind_begin(0);
 	char *filename = scm_to_locale_string(s_filename);
@@ -372,9 +581,11 @@ static SCM save_gif(SCM s_filename, SCM s_dim, SCM s_nclr, SCM s_fps, SCM callba
 
 	assert_nitro_type((magic_t)'NCLR', s_nclr);
 
+	enum nmar_format format = to_anim_format(s_format, "save-gif", SCM_ARG6);
+
 	SCM gif_error = scm_from_locale_string("gif-error");
 
-	struct GifFileType *gif;
+	void *gif;
 	do {
 		struct image initial_image = {};
 		struct NCLR *nclr = (void *) SCM_SMOB_DATA(s_nclr);
@@ -386,11 +597,15 @@ static SCM save_gif(SCM s_filename, SCM s_dim, SCM s_nclr, SCM s_fps, SCM callba
 			scm_error(s, "save-gif", "error getting palette", SCM_BOOL_F, SCM_BOOL_F);
 		}
 		scm_dynwind_free(initial_image.palette);
-		gif = image_gif_new(&initial_image, filename);
+		if (format == NMAR_APNG) {
+			gif = image_apng_new(&initial_image, filename, 100);
+		} else {
+			gif = image_gif_new(&initial_image, filename);
+		}
 		if (gif == NULL) {
 			scm_error(gif_error, "save-gif", "error creating gif", SCM_BOOL_F, scm_list_1(s_filename));
 		}
-		scm_dynwind_unwind_handler(close_gif_handler, gif, 0);
+		scm_dynwind_unwind_handler(format == NMAR_APNG ? close_apng_handler : close_gif_handler, gif, 0);
 	} while(0);
 
 	SCM ticks = scm_from_uint(0);
@@ -402,13 +617,16 @@ static SCM save_gif(SCM s_filename, SCM s_dim, SCM s_nclr, SCM s_fps, SCM callba
 		}
 		scm_assert_smob_type(image_tag, s_image);
 		struct image *image = (void *) SCM_SMOB_DATA(s_image);
-		if (image_gif_add_frame(image, gif, fps)) {
+		int err = format == NMAR_APNG ? image_apng_add_frame(image, gif, fps)
+		                              : image_gif_add_frame(image, gif, fps);
+		if (err) {
 			scm_error(gif_error, "save-gif", "error adding frame", SCM_BOOL_F, scm_list_1(s_image));
 		}
 		ticks = scm_sum(ticks, s_fps);
 	} while(1);
 
-	if (image_gif_close(gif)) {
+	int err = format == NMAR_APNG ? image_apng_close(gif) : image_gif_close(gif);
+	if (err) {
 		scm_error(gif_error, "save-gif", "error closing gif", SCM_BOOL_F, SCM_BOOL_F);
 	}
 
@@ -551,12 +769,217 @@ static SCM nmar_draw_s(SCM obj, SCM s_cell_index, SCM s_tick, SCM s_nmcr, SCM s_
 
 }
 
+/* Render a whole animation to a gif (or an apng, if format is apng)
+ * without calling back into scheme for every frame */
+static SCM nmar_save_gif_s(SCM s_filename, SCM obj, SCM s_cell_index, SCM s_nmcr, SCM s_nanr, SCM s_ncer, SCM s_ncgr, SCM s_nclr, SCM s_dim, SCM s_offset, SCM s_format)
+{
+	assert_nitro_type(NMAR_MAGIC, obj);
+	assert_nitro_type(NMCR_MAGIC, s_nmcr);
+	assert_nitro_type(NANR_MAGIC, s_nanr);
+	assert_nitro_type('NCER', s_ncer);
+	assert_nitro_type('NCGR', s_ncgr);
+	assert_nitro_type('NCLR', s_nclr);
+
+	scm_dynwind_begin(0);
+	char *filename = scm_to_locale_string(s_filename);
+	scm_dynwind_free(filename);
+
+	int cell_index = scm_to_int(s_cell_index);
+
+	struct NMAR *nmar = (void *) SCM_SMOB_DATA(obj);
+	struct NMCR *nmcr = (void *) SCM_SMOB_DATA(s_nmcr);
+	struct NANR *nanr = (void *) SCM_SMOB_DATA(s_nanr);
+	struct NCER *ncer = (void *) SCM_SMOB_DATA(s_ncer);
+	struct NCGR *ncgr = (void *) SCM_SMOB_DATA(s_ncgr);
+	struct NCLR *nclr = (void *) SCM_SMOB_DATA(s_nclr);
+
+	struct dim dim;
+	dim.width = scm_to_int(scm_car(s_dim));
+	dim.height = scm_to_int(scm_cadr(s_dim));
+
+	struct coords offset;
+	offset.x = scm_to_int(scm_car(s_offset));
+	offset.y = scm_to_int(scm_cadr(s_offset));
+
+	enum nmar_format format = to_anim_format(s_format, "nmar-save-gif", SCM_ARGn);
+
+	const char *filenames[1] = {filename};
+	if (nmar_save_animations(nmar, cell_index, nmcr, nanr, ncer, ncgr, &nclr,
+	                         dim, offset, format, filenames, 1)) {
+		SCM s = scm_from_locale_symbol("gif-error");
+		scm_error(s, "nmar-save-gif", "error", SCM_BOOL_F, scm_list_1(s_filename));
+	}
+
+	scm_dynwind_end();
+
+	return SCM_UNSPECIFIED;
+}
+
+/* Batch ripping */
+
+#define MAX_MEMBERS 32
+
+/* files taken from the narc cache for the current pokemon, so the
+ * variants can share them */
+struct member_cache {
+	size_t count;
+	int indices[MAX_MEMBERS];
+	void *files[MAX_MEMBERS];
+};
+
+static void *
+cache_load(struct member_cache *cache, struct NARC *narc, int index, magic_t magic)
+{
+	for (size_t i = 0; i < cache->count; i++) {
+		if (cache->indices[i] == index) {
+			return cache->files[i];
+		}
+	}
+
+	if (cache->count >= MAX_MEMBERS) {
+		warn("too many files");
+		return NULL;
+	}
+
+	magic_t file_magic;
+	void *file = NULL;
+	if (!narc_get_file_magic(narc, index, &file_magic) && file_magic == magic) {
+		file = narc_cache_load(narc, index);
+	}
+	if (file == NULL || nitro_get_magic(file) != magic) {
+		char buf[MAGIC_BUF_SIZE];
+		warn("file %d is not a %s", index, strmagic(magic, buf));
+		narc_cache_release(file);
+		return NULL;
+	}
+
+	cache->indices[cache->count] = index;
+	cache->files[cache->count] = file;
+	cache->count++;
+	return file;
+}
+
+static void
+cache_clear(struct member_cache *cache)
+{
+	for (size_t i = 0; i < cache->count; i++) {
+		narc_cache_release(cache->files[i]);
+	}
+	cache->count = 0;
+}
+
+/* Rip the B/W animations of pokemon first through last in one go,
+ * without reopening the narc or reloading the files the variants share.
+ *
+ * variants is a list of (nclr ncgr part subdir). nclr and ncgr are the
+ * indices of the palette and the graphics among each pokemon's 20 files,
+ * and part is 0 for the front or 9 for the back. Variants without any
+ * graphics - e.g. female sprites of pokemon that look the same either
+ * way - are skipped. Animations are saved as outdir/subdir/n.gif, or as
+ * n.png if format is apng.
+ *
+ * Returns the number of animations written; failures are reported but
+ * don't stop the batch. */
+static SCM rip_animated_range(SCM s_narc, SCM s_first, SCM s_last, SCM s_variants, SCM s_outdir, SCM s_dim, SCM s_offset, SCM s_format)
+{
+	assert_nitro_type('CRAN', s_narc);
+	struct NARC *narc = (void *) SCM_SMOB_DATA(s_narc);
+
+	scm_dynwind_begin(0);
+
+	int first = scm_to_int(s_first);
+	int last = scm_to_int(s_last);
+	enum nmar_format format = to_anim_format(s_format, "rip-animated-range", SCM_ARGn);
+	const char *ext = format == NMAR_APNG ? "png" : "gif";
+
+	char *outdir = scm_to_locale_string(s_outdir);
+	scm_dynwind_free(outdir);
+
+	struct dim dim;
+	dim.width = scm_to_int(scm_car(s_dim));
+	dim.height = scm_to_int(scm_cadr(s_dim));
+
+	struct coords offset;
+	offset.x = scm_to_int(scm_car(s_offset));
+	offset.y = scm_to_int(scm_cadr(s_offset));
+
+	// (nclr ncgr part) and subdir for each variant
+	size_t variant_count = scm_to_size_t(scm_length(s_variants));
+	int (*variants)[3] = scm_malloc(sizeof(*variants) * (variant_count + 1));
+	scm_dynwind_free(variants);
+	char **subdirs = scm_malloc(sizeof(*subdirs) * (variant_count + 1));
+	scm_dynwind_free(subdirs);
+	for (size_t i = 0; i < variant_count; i++) {
+		SCM v = scm_list_ref(s_variants, scm_from_size_t(i));
+		for (int j = 0; j < 3; j++) {
+			variants[i][j] = scm_to_int(scm_list_ref(v, scm_from_int(j)));
+		}
+		subdirs[i] = scm_to_locale_string(scm_list_ref(v, scm_from_int(3)));
+		scm_dynwind_free(subdirs[i]);
+	}
+
+	struct member_cache cache = {.count = 0};
+	int written = 0;
+	const int file_count = narc_get_file_count(narc);
+
+	for (int n = first; n <= last; n++) {
+		const int base = n * 20;
+		if (base + 20 > file_count) {
+			warn("no pokemon %d", n);
+			break;
+		}
+
+		for (size_t i = 0; i < variant_count; i++) {
+			const int nclr_offset = variants[i][0];
+			const int part = variants[i][2];
+			const int ncgr_index = base + variants[i][1] + part;
+
+			if (narc_get_file_size(narc, ncgr_index) == 0) {
+				// this is fine
+				continue;
+			}
+
+			char filename[4096];
+			if (snprintf(filename, sizeof filename, "%s%s/%d.%s",
+			             outdir, subdirs[i], n, ext) >= (int)sizeof filename) {
+				warn("filename too long");
+				continue;
+			}
+
+			const char *filenames[1] = {filename};
+			struct NCLR *nclr = cache_load(&cache, narc, base + nclr_offset, 'NCLR');
+			struct NCGR *ncgr = cache_load(&cache, narc, ncgr_index, 'NCGR');
+			struct NANR *nanr = cache_load(&cache, narc, base + 5 + part, NANR_MAGIC);
+			struct NMCR *nmcr = cache_load(&cache, narc, base + 6 + part, NMCR_MAGIC);
+			struct NMAR *nmar = cache_load(&cache, narc, base + 7 + part, NMAR_MAGIC);
+			struct NCER *ncer = cache_load(&cache, narc, base + 4 + part, 'NCER');
+
+			if (nclr == NULL || ncgr == NULL || nanr == NULL ||
+			    nmcr == NULL || nmar == NULL || ncer == NULL) {
+				warn("Error loading files for %s", filename);
+			} else if (nmar_save_animations(nmar, 0, nmcr, nanr, ncer, ncgr, &nclr,
+			                                dim, offset, format, filenames, 1)) {
+				warn("Error writing %s", filename);
+			} else {
+				written++;
+			}
+		}
+
+		cache_clear(&cache);
+	}
+
+	scm_dynwind_end();
+
+	return scm_from_int(written);
+}
+
 static void
 main_callback(void *data, int argc, char *argv[])
 {
 	(void)data;
 
 	nitro_tag = scm_make_smob_type("nitro", 0);
+	scm_set_smob_mark(nitro_tag, mark_nitro);
 	scm_set_smob_free(nitro_tag, free_nitro);
 
 	image_tag = scm_make_smob_type("image", sizeof(struct image));
@@ -567,6 +990,9 @@ main_callback(void *data, int argc, char *argv[])
 	scm_c_define_gsubr("narc-file-count", 1, 0, 0, file_count);
 	scm_c_define_gsubr("narc-get-file-size", 2, 0, 0, get_file_size);
 	scm_c_define_gsubr("narc-load-file", 2, 1, 0, load_narc_file);
+	scm_c_define_gsubr("narc-file-magic", 2, 0, 0, narc_file_magic);
+	scm_c_define_gsubr("narc-cache-stats", 0, 0, 0, narc_cache_stats);
+	scm_c_define_gsubr("set-narc-cache-budget!", 1, 0, 0, set_narc_cache_budget);
 	scm_c_define_gsubr("get-magic", 1, 0, 0, get_magic);
 	scm_c_define_gsubr("make-image", 0, 1, 0, make_image);
 	scm_c_define_gsubr("ncgr-decrypt-pt", 1, 0, 0, decrypt_pt);
@@ -574,9 +1000,12 @@ main_callback(void *data, int argc, char *argv[])
 	scm_c_define_gsubr("image-set-pixels-from-ncgr", 2, 0, 0, image_set_pixels_from_ncgr);
 	scm_c_define_gsubr("image-set-pixels-from-ncer", 4, 0, 0, image_set_pixels_from_ncer);
 	scm_c_define_gsubr("image-set-palette-from-nclr", 2, 0, 0, image_set_palette_from_nclr);
+	scm_c_define_gsubr("image-set-pixels-from-narc", 3, 1, 0, image_set_pixels_from_narc);
+	scm_c_define_gsubr("image-set-palette-from-narc", 3, 0, 0, image_set_palette_from_narc);
+	scm_c_define_gsubr("image-set-palette-from-image", 2, 0, 0, image_set_palette_from_image);
 	scm_c_define_gsubr("image-save-png", 2, 0, 0, image_save_png);
 	scm_c_define_gsubr("image-save-gif", 2, 0, 0, image_save_gif);
-	scm_c_define_gsubr("save-gif", 5, 0, 0, save_gif);
+	scm_c_define_gsubr("save-gif", 5, 1, 0, save_gif);
 	scm_c_define_gsubr("ncer-get-cell-count", 1, 0, 0, ncer_get_cell_count_s);
 	scm_c_define_gsubr("nanr-draw-frame", 6, 0, 0, nanr_draw_frame_s);
 	scm_c_define_gsubr("nanr-cell-count", 1, 0, 0, nanr_cell_count);
@@ -585,6 +1014,8 @@ main_callback(void *data, int argc, char *argv[])
 	scm_c_define_gsubr("nmar-cell-count", 1, 0, 0, nmar_cell_count);
 	scm_c_define_gsubr("nmar-period", 2, 0, 0, nmar_period);
 	scm_c_define_gsubr("nmar-draw", 8, 1, 0, nmar_draw_s);
+	scm_c_define_gsubr("nmar-save-gif", 10, 1, 0, nmar_save_gif_s);
+	scm_c_define_gsubr("rip-animated-range", 7, 1, 0, rip_animated_range);
 
 	scm_shell(argc, argv);
 }
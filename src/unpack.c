@@ -0,0 +1,180 @@
+/* unpack.c - Pixel unpacking
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <string.h> /* memcpy */
+#include <pthread.h> /* pthread_once */
+
+#include "common.h" /* OKAY, FAIL, struct dim, u8 */
+#include "unpack.h"
+
+#if defined(__SSE2__)
+# include <emmintrin.h> /* _mm_* */
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define HAVE_AVX2 1
+# include <immintrin.h> /* _mm256_* */
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h> /* vld1q_u8, vst2q_u8, ... */
+#endif
+
+/* Every 4bpp kernel expands n bytes of src into 2n bytes of dest. The
+ * vector kernels do as many bytes as they can at a time and leave the
+ * rest to the scalar one. */
+typedef void unpack_kernel(u8 *dest, const u8 *src, size_t n);
+
+static void
+unpack4_scalar(u8 *dest, const u8 *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		u8 byte = src[i];
+		dest[i*2]     = byte        & 0x0f;
+		dest[i*2 + 1] = (byte >> 4) & 0x0f;
+	}
+}
+
+#if defined(__SSE2__)
+static void
+unpack4_sse2(u8 *dest, const u8 *src, size_t n)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_and_si128(bytes, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+		_mm_storeu_si128((__m128i *)(dest + i*2), _mm_unpacklo_epi8(lo, hi));
+		_mm_storeu_si128((__m128i *)(dest + i*2 + 16), _mm_unpackhi_epi8(lo, hi));
+	}
+	unpack4_scalar(dest + i*2, src + i, n - i);
+}
+#endif
+
+#if defined(HAVE_AVX2)
+__attribute__((target("avx2")))
+static void
+unpack4_avx2(u8 *dest, const u8 *src, size_t n)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i lo = _mm256_and_si256(bytes, mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask);
+		// the unpacks work within each 128-bit half, so the
+		// halves come out crossed over
+		__m256i a = _mm256_unpacklo_epi8(lo, hi);
+		__m256i b = _mm256_unpackhi_epi8(lo, hi);
+		_mm256_storeu_si256((__m256i *)(dest + i*2), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(dest + i*2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	unpack4_scalar(dest + i*2, src + i, n - i);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void
+unpack4_neon(u8 *dest, const u8 *src, size_t n)
+{
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t bytes = vld1q_u8(src + i);
+		uint8x16x2_t pixels;
+		pixels.val[0] = vandq_u8(bytes, mask);
+		pixels.val[1] = vshrq_n_u8(bytes, 4);
+		vst2q_u8(dest + i*2, pixels);
+	}
+	unpack4_scalar(dest + i*2, src + i, n - i);
+}
+#endif
+
+static unpack_kernel *unpack4 = unpack4_scalar;
+static pthread_once_t unpack4_once = PTHREAD_ONCE_INIT;
+
+/* pick the best kernel the cpu can run */
+static void
+choose_unpack4(void)
+{
+#if defined(__SSE2__)
+	unpack4 = unpack4_sse2;
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	unpack4 = unpack4_neon;
+#endif
+#if defined(HAVE_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		unpack4 = unpack4_avx2;
+	}
+#endif
+}
+
+int
+unpack_pixels(u8 *dest, const u8 *src, size_t count, int depth)
+{
+	switch (depth) {
+	case 4:
+		pthread_once(&unpack4_once, choose_unpack4);
+		unpack4(dest, src, count / 2);
+		break;
+	case 8:
+		memcpy(dest, src, count);
+		break;
+	default:
+		return FAIL;
+	}
+	return OKAY;
+}
+
+/* Expand one row of a 4bpp tile - 4 bytes - into 8 pixels at once by
+ * spreading the nibbles out into bytes. Assumes a little-endian host,
+ * like the rest of the code. */
+static inline void
+unpack4_tile_row(u8 *dest, const u8 *src)
+{
+	uint64_t v = (uint64_t)src[0] | (uint64_t)src[1] << 8 |
+	             (uint64_t)src[2] << 16 | (uint64_t)src[3] << 24;
+	v = (v | v << 16) & 0x0000ffff0000ffffULL;
+	v = (v | v << 8)  & 0x00ff00ff00ff00ffULL;
+	v = (v | v << 4)  & 0x0f0f0f0f0f0f0f0fULL;
+	memcpy(dest, &v, 8);
+}
+
+/* Tiles are 8x8 pixels, stored one after another from left to right and
+ * top to bottom. Each row of a tile goes straight to its place in the
+ * image, so there's no need for a second pass to rearrange them. */
+int
+unpack_tiles(u8 *dest, const u8 *src, struct dim dim, int depth)
+{
+	const int tile_size = depth * 8;  // bytes per tile
+	const int tile_row_size = depth;  // bytes per row of a tile
+
+	if (depth != 4 && depth != 8) {
+		return FAIL;
+	}
+
+	for (int ty = 0; ty < dim.height / 8; ty++) {
+	for (int tx = 0; tx < dim.width / 8; tx++) {
+		const u8 *tile = src + (ty * (dim.width / 8) + tx) * tile_size;
+		u8 *out = dest + (ty * 8) * dim.width + tx * 8;
+		for (int y = 0; y < 8; y++) {
+			if (depth == 4) {
+				unpack4_tile_row(out, tile + y * tile_row_size);
+			} else {
+				memcpy(out, tile + y * tile_row_size, 8);
+			}
+			out += dim.width;
+		}
+	}
+	}
+
+	return OKAY;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+#ifndef UNPACK_H
+#define UNPACK_H
+
+#include <stddef.h> /* size_t */
+#include "common.h" /* struct dim, u8 */
+
+/* Expand count pixels of depth bits each (4 or 8) from src into one byte
+ * per pixel in dest. With 4 bits per pixel, the low nibble comes first.
+ * Returns FAIL for any other depth. */
+extern int unpack_pixels(u8 *dest, const u8 *src, size_t count, int depth);
+
+/* Like unpack_pixels, but src is a series of 8x8 tiles which are laid out
+ * in dest as an image of dimensions dim. */
+extern int unpack_tiles(u8 *dest, const u8 *src, struct dim dim, int depth);
+
+#endif /* UNPACK_H */
@@ -0,0 +1,117 @@
+/* lzss_roundtrip - Check that lzss_compress_buffer's output decompresses
+ *                  back to what went in
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS, size_t */
+#include <stdio.h> /* printf */
+#include <string.h> /* memcmp, memset */
+
+#include "../src/common.h" /* FREE, struct buffer, buffer_alloc, u8, u32 */
+#include "../src/lzss.h" /* LZSS10, LZSS11, LZSS_FAST, LZSS_OPTIMAL, lzss_compress_buffer, lzss_decompress_buffer */
+
+/* the edges of the format: nothing, a single literal, the shortest match,
+ * the longest LZSS10 match, the longest short LZSS11 match, the size of
+ * the window, and a bit past it */
+static const size_t sizes[] = {0, 1, 3, 18, 0x110, 4096, 4097, 5000, 0x10110 + 100};
+
+enum pattern {
+	RANDOM,  // nothing to match
+	REPEAT,  // one long run of the same byte
+	RUNS,    // runs of all sorts of lengths, some far apart
+	PATTERN_COUNT,
+};
+
+static const char *pattern_names[] = {"random", "repeat", "runs"};
+
+static u32 seed = 12345;
+
+static u8
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static void
+fill(u8 *data, size_t size, enum pattern pattern)
+{
+	switch (pattern) {
+	case RANDOM:
+		for (size_t i = 0; i < size; i++) {
+			data[i] = rnd();
+		}
+		break;
+	case REPEAT:
+		memset(data, 0xAB, size);
+		break;
+	default:
+		for (size_t i = 0; i < size; ) {
+			size_t run = 1 + rnd() % 40;
+			if (rnd() % 8 == 0) {
+				run += 0x100 + rnd() * 16;
+			}
+			u8 byte = rnd() % 4;
+			for (; run > 0 && i < size; run--, i++) {
+				data[i] = byte;
+			}
+		}
+		break;
+	}
+}
+
+static int
+check(struct buffer *original, int mode, int effort)
+{
+	struct buffer *compressed = lzss_compress_buffer(original, mode, effort);
+	if (compressed == NULL) {
+		return 0;
+	}
+	struct buffer *decompressed = lzss_decompress_buffer(compressed);
+	int ok = decompressed != NULL &&
+	         decompressed->size == original->size &&
+	         memcmp(decompressed->data, original->data, original->size) == 0;
+	FREE(compressed);
+	FREE(decompressed);
+	return ok;
+}
+
+int
+main(void)
+{
+	int failures = 0;
+	int count = 0;
+
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		for (int pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+			struct buffer *original = buffer_alloc(sizes[i]);
+			if (original == NULL) {
+				printf("out of memory\n");
+				return EXIT_FAILURE;
+			}
+			fill(original->data, original->size, pattern);
+
+			for (int mode = LZSS10; mode <= LZSS11; mode++) {
+				for (int effort = LZSS_FAST; effort <= LZSS_OPTIMAL; effort++) {
+					count++;
+					if (!check(original, mode, effort)) {
+						failures++;
+						printf("FAIL: %s, %lu bytes, %s, %s\n",
+						       pattern_names[pattern],
+						       (unsigned long)sizes[i],
+						       mode == LZSS11 ? "LZSS11" : "LZSS10",
+						       effort == LZSS_OPTIMAL ? "optimal" : "fast");
+					}
+				}
+			}
+			FREE(original);
+		}
+	}
+
+	printf("lzss_roundtrip: %d of %d passed\n", count - failures, count);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
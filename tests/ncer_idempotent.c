@@ -0,0 +1,301 @@
+/* ncer_idempotent - Check that drawing an NCER cell gives the same pixels
+ *                   every time, whatever was drawn before it
+ *
+ * Copyright © 2011 magical
+ *
+ * This file is part of spriterip; it is licensed under the GNU GPLv3
+ * and comes with NO WARRANTY. See rip.c for details.
+ */
+
+#include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS, size_t */
+#include <stdio.h> /* printf */
+#include <string.h> /* memcmp */
+
+#include "../src/common.h" /* OKAY, FREE, struct buffer, buffer_alloc, struct coords, struct dim, u8, u16, u32, fx16 */
+#include "../src/nitro.h" /* nitro_read_buffer, nitro_free */
+#include "../src/image.h" /* struct image */
+#include "../src/ncgr.h" /* struct NCGR, ncgr_decrypt_pt */
+#include "../src/ncer.h" /* struct NCER, ncer_draw_cell, ncer_draw_cell_t, ncer_get_cell_count, ncer_get_cell_dim */
+
+/* The fixture is built here rather than ripped from a game. Its cells
+ * cover the awkward cases: objs which overlap, a double-size obj, objs
+ * which hang off the edges of the cell, and tile indexes which only come
+ * out right with the per-cell offset applied. */
+
+struct fixture_obj {
+	int x, y;
+	int size, shape;
+	int rs_mode;
+	int tile;
+};
+
+static const struct fixture_obj cell0[] = {
+	{-8, -8, 0, 0, 0, 0},
+};
+static const struct fixture_obj cell1[] = {
+	{-16, -16, 1, 0, 0, 4},
+	{-8, -8, 2, 0, 0, 8},
+};
+static const struct fixture_obj cell2[] = {
+	{-32, -32, 2, 1, 3, 20},
+	{0, 0, 1, 2, 0, 40},
+	{-4, -20, 0, 1, 0, 2},
+};
+static const struct fixture_obj cell3[] = {
+	{-32, -32, 3, 0, 0, 0},
+	{100, -100, 0, 0, 0, 1},
+};
+
+static const struct {
+	const struct fixture_obj *objs;
+	size_t obj_count;
+} cells[] = {
+	{cell0, 1},
+	{cell1, 2},
+	{cell2, 3},
+	{cell3, 2},
+};
+
+#define CELL_COUNT ((int)(sizeof(cells)/sizeof(cells[0])))
+
+/* 16x16 tiles at 4 bits per pixel */
+#define TILE_COUNT 256
+#define CHAR_SIZE (TILE_COUNT * 32)
+
+static u8 ncgr_data[2][16 + 32 + CHAR_SIZE];
+static u8 ncer_data[16 + 32 + 8*CELL_COUNT + 6*16];
+
+static u32 seed = 12345;
+
+static u8
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static u8 *
+put16(u8 *p, u16 v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+static u8 *
+put32(u8 *p, u32 v)
+{
+	p = put16(p, v & 0xffff);
+	return put16(p, v >> 16);
+}
+
+static u8 *
+put_nitro_header(u8 *p, u32 magic, u32 size)
+{
+	p = put32(p, magic);
+	p = put16(p, 0xfeff);
+	p = put16(p, 0x0101);
+	p = put32(p, size);
+	p = put16(p, 16);
+	return put16(p, 1);
+}
+
+static void
+make_ncgr(u8 *data)
+{
+	u8 *p = put_nitro_header(data, 'NCGR', 16 + 32 + CHAR_SIZE);
+	p = put32(p, 'CHAR');
+	p = put32(p, 32 + CHAR_SIZE);
+	p = put16(p, 16); // height in tiles
+	p = put16(p, 16); // width in tiles
+	p = put32(p, 3); // 4 bits per pixel
+	p = put32(p, 0); // vram_mode
+	p = put32(p, 0); // tiled
+	p = put32(p, CHAR_SIZE);
+	p = put32(p, 0);
+
+	// about one pixel in four is transparent
+	for (int i = 0; i < CHAR_SIZE * 2; i++) {
+		u8 r = rnd();
+		u8 px = r % 4 == 0 ? 0 : r >> 4;
+		if (i % 2 == 0) {
+			p[i / 2] = px;
+		} else {
+			p[i / 2] |= px << 4;
+		}
+	}
+}
+
+static size_t
+make_ncer(u8 *data)
+{
+	u8 *p = data + 16;
+	p = put32(p, 'CEBK');
+	u8 *cebk_size = p;
+	p = put32(p, 0);
+	p = put16(p, CELL_COUNT);
+	p = put16(p, 0); // cell_type
+	p = put32(p, 0x18); // cell_data_offset
+	p = put32(p, 0); // flags
+	p = put32(p, 0); // partition_data_offset
+	p = put32(p, 0);
+	p = put32(p, 0);
+
+	int obj_count = 0;
+	for (int i = 0; i < CELL_COUNT; i++) {
+		p = put16(p, cells[i].obj_count);
+		p = put16(p, 0);
+		p = put32(p, obj_count * 6);
+		obj_count += cells[i].obj_count;
+	}
+
+	for (int i = 0; i < CELL_COUNT; i++) {
+		for (size_t j = 0; j < cells[i].obj_count; j++) {
+			const struct fixture_obj *obj = &cells[i].objs[j];
+			p = put16(p, (obj->y & 0xff) | obj->rs_mode << 8 | obj->shape << 14);
+			p = put16(p, (obj->x & 0x1ff) | obj->size << 14);
+			p = put16(p, obj->tile);
+		}
+	}
+
+	size_t size = p - data;
+	put_nitro_header(data, 'NCER', size);
+	put32(cebk_size, size - 16);
+	return size;
+}
+
+/* Draw a cell onto a blank image twice the size of the cell, with its
+ * center in the middle. transform may be NULL. */
+static struct buffer *
+draw(struct NCER *ncer, int index, struct NCGR *ncgr, fx16 *transform)
+{
+	struct dim dim;
+	struct coords center;
+	ncer_get_cell_dim(ncer, index, &dim, &center);
+
+	struct image image = {
+		.dim = {.height = dim.height * 2, .width = dim.width * 2},
+	};
+	image.pixels = buffer_alloc(image.dim.height * image.dim.width);
+	if (image.pixels == NULL) {
+		return NULL;
+	}
+
+	struct coords offset = {dim.width, dim.height};
+	int status;
+	if (transform != NULL) {
+		status = ncer_draw_cell_t(ncer, index, ncgr, &image, offset, transform);
+	} else {
+		status = ncer_draw_cell(ncer, index, ncgr, &image, offset);
+	}
+	if (status != OKAY) {
+		FREE(image.pixels);
+	}
+	return image.pixels;
+}
+
+static int
+same(struct buffer *a, struct buffer *b)
+{
+	return a != NULL && b != NULL && a->size == b->size &&
+	       memcmp(a->data, b->data, a->size) == 0;
+}
+
+static int
+nonblank(struct buffer *a)
+{
+	for (size_t i = 0; a != NULL && i < a->size; i++) {
+		if (a->data[i] != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	make_ncgr(ncgr_data[0]);
+	make_ncgr(ncgr_data[1]);
+	size_t ncer_size = make_ncer(ncer_data);
+
+	struct NCER *ncer = nitro_read_buffer(ncer_data, ncer_size);
+	struct NCGR *ncgr[2] = {
+		nitro_read_buffer(ncgr_data[0], sizeof ncgr_data[0]),
+		nitro_read_buffer(ncgr_data[1], sizeof ncgr_data[1]),
+	};
+	if (ncer == NULL || ncgr[0] == NULL || ncgr[1] == NULL) {
+		printf("FAIL: couldn't load the fixture\n");
+		return EXIT_FAILURE;
+	}
+	if (ncer_get_cell_count(ncer) != CELL_COUNT) {
+		printf("FAIL: the fixture has %d cells, not %d\n",
+		       ncer_get_cell_count(ncer), CELL_COUNT);
+		return EXIT_FAILURE;
+	}
+
+	fx16 rotate[4] = {0xb5, -0xb5, 0xb5, 0xb5};
+	fx16 *transforms[] = {NULL, rotate};
+
+	int failures = 0;
+	int count = 0;
+
+	for (int t = 0; t < 2; t++) {
+		struct buffer *first[CELL_COUNT];
+		for (int i = 0; i < CELL_COUNT; i++) {
+			first[i] = draw(ncer, i, ncgr[0], transforms[t]);
+			count++;
+			if (!nonblank(first[i])) {
+				failures++;
+				printf("FAIL: cell %d%s didn't draw\n", i,
+				       t ? " (rotated)" : "");
+			}
+		}
+
+		// again, backwards, with the other NCGR drawn in between
+		for (int i = CELL_COUNT - 1; i >= 0; i--) {
+			struct buffer *other = draw(ncer, i, ncgr[1], transforms[t]);
+			struct buffer *again = draw(ncer, i, ncgr[0], transforms[t]);
+			count++;
+			if (!same(first[i], again)) {
+				failures++;
+				printf("FAIL: cell %d%s drew differently the second time\n",
+				       i, t ? " (rotated)" : "");
+			}
+			count++;
+			if (same(first[i], other)) {
+				failures++;
+				printf("FAIL: cell %d%s drew the same with a different NCGR\n",
+				       i, t ? " (rotated)" : "");
+			}
+			FREE(other);
+			FREE(again);
+		}
+
+		for (int i = 0; i < CELL_COUNT; i++) {
+			FREE(first[i]);
+		}
+	}
+
+	// drawing after the pixels change must not use the old ones
+	struct buffer *before = draw(ncer, 1, ncgr[0], NULL);
+	ncgr_decrypt_pt(ncgr[0]);
+	struct buffer *after = draw(ncer, 1, ncgr[0], NULL);
+	count++;
+	if (same(before, after)) {
+		failures++;
+		printf("FAIL: cell 1 drew the same after decrypting its NCGR\n");
+	}
+	FREE(before);
+	FREE(after);
+
+	nitro_free(ncer);
+	FREE(ncer);
+	for (int i = 0; i < 2; i++) {
+		nitro_free(ncgr[i]);
+		FREE(ncgr[i]);
+	}
+
+	printf("ncer_idempotent: %d of %d passed\n", count - failures, count);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}